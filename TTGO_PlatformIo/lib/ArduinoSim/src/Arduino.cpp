@@ -0,0 +1,31 @@
+#include "Arduino.h"
+
+static uint64_t simNowUs = 0;
+
+uint64_t simTimeUs() {
+    return simNowUs;
+}
+
+void simAdvanceUs(uint64_t us) {
+    simNowUs += us;
+}
+
+void simSetTimeUs(uint64_t us) {
+    simNowUs = us;
+}
+
+uint32_t millis() {
+    return (uint32_t)(simNowUs / 1000);
+}
+
+uint32_t micros() {
+    return (uint32_t)simNowUs;
+}
+
+void delay(uint32_t ms) {
+    simNowUs += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(uint32_t us) {
+    simNowUs += us;
+}
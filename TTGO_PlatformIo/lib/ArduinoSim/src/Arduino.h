@@ -0,0 +1,40 @@
+#pragma once
+
+// The part of the Arduino core the sensor drivers use, for host builds.
+//
+// Time is simulated: millis() / micros() return the simulation clock and
+// delay() advances it instead of sleeping, so code written for the device
+// runs as fast as the host allows. I2C transactions on the simulated bus
+// (Wire.h) advance the clock by their time on a 400 kHz bus.
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+
+#define ESP_OK 0
+
+// ESP32 log macros, printed only with -DSIM_LOG
+#ifdef SIM_LOG
+#define log_e(format, ...) fprintf(stderr, "[E] " format, ##__VA_ARGS__)
+#else
+#define log_e(format, ...) do { } while (0)
+#endif
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+// simulation clock, 64 bit micros()
+uint64_t simTimeUs();
+void simAdvanceUs(uint64_t us);
+void simSetTimeUs(uint64_t us);
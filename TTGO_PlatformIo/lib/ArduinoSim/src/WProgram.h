@@ -0,0 +1,4 @@
+#pragma once
+
+// pre 1.0 name of Arduino.h, Omron_D6FPH.h includes it when ARDUINO isn't defined
+#include "Arduino.h"
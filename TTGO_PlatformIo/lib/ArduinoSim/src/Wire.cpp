@@ -0,0 +1,69 @@
+#include "Wire.h"
+
+void TwoWire::attach(SimI2CDevice *device) {
+    if (_count < SIM_I2C_MAX_DEVICES)
+        _devices[_count++] = device;
+}
+
+void TwoWire::detachAll() {
+    _count = 0;
+}
+
+SimI2CDevice *TwoWire::find(uint8_t address) {
+    for (size_t i = 0; i < _count; i++) {
+        if (_devices[i]->address == address && _devices[i]->present)
+            return _devices[i];
+    }
+    return nullptr;
+}
+
+bool TwoWire::fails(SimI2CDevice *device) {
+    device->transactions++;
+    return device->nackEvery && device->transactions % device->nackEvery == 0;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+    _address = address;
+    _txLen = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (_txLen >= SIM_I2C_BUFFER)
+        return 0;
+    _tx[_txLen++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t len) {
+    size_t n = 0;
+    while (n < len && write(data[n]))
+        n++;
+    return n;
+}
+
+uint8_t TwoWire::endTransmission(bool) { // every transaction ends with a stop
+    simAdvanceUs((1 + _txLen) * SIM_I2C_BYTE_US);
+    SimI2CDevice *device = find(_address);
+    if (!device)
+        return 2;
+    if (fails(device))
+        return 2;
+    return device->receive(_tx, _txLen) ? 0 : 3;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t len, bool) {
+    _rxLen = 0;
+    _rxPos = 0;
+    if (len > SIM_I2C_BUFFER)
+        len = SIM_I2C_BUFFER;
+    SimI2CDevice *device = find(address);
+    if (!device || fails(device)) {
+        simAdvanceUs(SIM_I2C_BYTE_US);
+        return 0;
+    }
+    _rxLen = device->send(_rx, len);
+    simAdvanceUs((1 + len) * SIM_I2C_BYTE_US);
+    return _rxLen;
+}
+
+TwoWire Wire;
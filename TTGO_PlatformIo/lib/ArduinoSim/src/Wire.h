@@ -0,0 +1,67 @@
+#pragma once
+
+// TwoWire of the ESP32 Arduino core on a simulated bus.
+//
+// Devices (SimI2CDevice) are attached by address. A transmission is handed
+// to the device as a whole at endTransmission(), a read asks the device for
+// the bytes at requestFrom(), like the real controller clocks them. The
+// results are those of the ESP32 core: 0 ok, 2 address NACK, 3 data NACK.
+// Every transaction advances the simulation clock by its bus time.
+
+#include "Arduino.h"
+
+#define SIM_I2C_MAX_DEVICES 8
+#define SIM_I2C_BUFFER 128  // I2C_BUFFER_LENGTH of the ESP32 core
+#define SIM_I2C_BYTE_US 23  // 9 clocks at 400 kHz, plus a little
+
+class SimI2CDevice
+{
+public:
+    explicit SimI2CDevice(uint8_t address) : address(address) {}
+    virtual ~SimI2CDevice() {}
+    // a complete write transaction, false NACKs the data
+    virtual bool receive(const uint8_t *data, size_t len) = 0;
+    // fills a read transaction of len bytes, returns how many it had
+    virtual size_t send(uint8_t *data, size_t len) = 0;
+
+    uint8_t address;
+    bool present = true; // false: the address is not acknowledged
+    uint32_t nackEvery = 0; // every n-th transaction fails, 0 never
+    uint32_t transactions = 0;
+};
+
+class TwoWire
+{
+public:
+    bool begin() { _begun = true; return true; }
+    bool end() { _begun = false; return true; }
+    void beginTransmission(uint8_t address);
+    void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+    size_t write(uint8_t data);
+    size_t write(const uint8_t *data, size_t len);
+    uint8_t endTransmission(bool sendStop = true);
+    uint8_t requestFrom(uint8_t address, uint8_t len, bool sendStop = true);
+    uint8_t requestFrom(int address, int len) { return requestFrom((uint8_t)address, (uint8_t)len); }
+    int available() { return _rxLen - _rxPos; }
+    int read() { return _rxPos < _rxLen ? _rx[_rxPos++] : -1; }
+
+    // simulation side
+    void attach(SimI2CDevice *device);
+    void detachAll();
+
+private:
+    SimI2CDevice *find(uint8_t address);
+    bool fails(SimI2CDevice *device);
+
+    SimI2CDevice *_devices[SIM_I2C_MAX_DEVICES] = {};
+    size_t _count = 0;
+    bool _begun = false;
+    uint8_t _address = 0;
+    uint8_t _tx[SIM_I2C_BUFFER];
+    size_t _txLen = 0;
+    uint8_t _rx[SIM_I2C_BUFFER];
+    size_t _rxLen = 0;
+    size_t _rxPos = 0;
+};
+
+extern TwoWire Wire;
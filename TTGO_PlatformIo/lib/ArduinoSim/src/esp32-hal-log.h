@@ -0,0 +1,4 @@
+#pragma once
+
+// log_e() and friends are defined in Arduino.h of the simulation
+#include "Arduino.h"
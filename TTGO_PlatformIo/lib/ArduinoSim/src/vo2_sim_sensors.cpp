@@ -0,0 +1,228 @@
+#include "vo2_sim_sensors.h"
+
+#include "vo2_calc.h"
+
+#define SIM_PRES_PA 101325 // VO2Calc::PresPa
+#define SIM_BTPS_STPD (SIM_PRES_PA / (35 + 273.15) / 292.9 / 1.292) // rhoBTPS / rhoSTPD
+#define SIM_O2_KEY (20.9f / 120) // DFRobot key of an uncalibrated sensor
+
+//--------------------------------------------------
+// breathing model
+
+float SimBreathing::flow(uint64_t nowUs) const {
+    if (params.rate <= 0)
+        return 0;
+    double period = 60.0 / params.rate;
+    double expiration = period * params.expiration;
+    double sinceStart = nowUs / 1e6 - params.startS;
+    if (sinceStart < 0)
+        return 0;
+    // the breath starts with the inspiration, then the expiration
+    double t = fmod(sinceStart, period) - (period - expiration);
+    if (t < 0)
+        return 0;
+    // the half sine holds the tidal volume
+    return params.tidalVolume * M_PI / (2 * expiration) * sin(M_PI * t / expiration);
+}
+
+// Bernoulli of vo2MassFlow() the other way round, at the density VO2Calc
+// uses for the temperature the SCD30 reports
+float SimBreathing::pressure(uint64_t nowUs) const {
+    float rho = SIM_PRES_PA / (params.tempC + 273.15) / 287.058;
+    float massFlow = flow(nowUs) * rho / 1000;
+    float area1 = VO2_AREA_26MM;
+    float area2 = vo2VenturiArea(params.diameterMm);
+    return massFlow * massFlow * (1 / (area2 * area2) - 1 / (area1 * area1)) / (2 * rho);
+}
+
+// VO2Calc::breathCalc(): VO2 = 1000 * VE * (FiO2 - FeO2) / 100 * BTPS/STPD
+float SimBreathing::targetO2(uint64_t nowUs) const {
+    float ve = ventilation();
+    if (ve <= 0 || nowUs < params.startS * 1e6)
+        return params.fio2;
+    return params.fio2 - 100 * params.vo2 / (1000 * ve * SIM_BTPS_STPD);
+}
+
+// VO2Calc::co2Sample(): VCO2 = 1000 * VE * (ppm - initial) / 10000 * BTPS/STPD
+// and RQ = VCO2 * 44 / (VO2 * 32)
+float SimBreathing::targetCO2(uint64_t nowUs) const {
+    float ve = ventilation();
+    if (ve <= 0 || nowUs < params.startS * 1e6)
+        return params.inspiredCO2;
+    float vco2 = params.rq * params.vo2 * 32 / 44;
+    return params.inspiredCO2 + vco2 / (1000 * ve * SIM_BTPS_STPD) * 10000;
+}
+
+void SimBreathing::mix(uint64_t nowUs) {
+    if (!_mixing) {
+        _mixing = true;
+        _mixedUs = nowUs;
+        _o2 = params.fio2;
+        _co2 = params.inspiredCO2;
+        return;
+    }
+    if (nowUs <= _mixedUs)
+        return;
+    float dt = (nowUs - _mixedUs) / 1e6f;
+    float k = params.mixingTauS > 0 ? 1 - expf(-dt / params.mixingTauS) : 1;
+    _o2 += (targetO2(nowUs) - _o2) * k;
+    _co2 += (targetCO2(nowUs) - _co2) * k;
+    _mixedUs = nowUs;
+}
+
+float SimBreathing::o2(uint64_t nowUs) {
+    mix(nowUs);
+    return _o2;
+}
+
+float SimBreathing::co2(uint64_t nowUs) {
+    mix(nowUs);
+    return _co2;
+}
+
+//--------------------------------------------------
+// Omron D6F-PH
+
+SimD6FPH::SimD6FPH(SimBreathing &model, float scale, float offset)
+    : SimI2CDevice(0x6C), _model(model), _scale(scale), _offset(offset) {}
+
+bool SimD6FPH::receive(const uint8_t *data, size_t len) {
+    static const uint8_t sensCtrl[] = {0x00, 0xD0, 0x40, 0x18, 0x06};
+    if (len == sizeof(sensCtrl) && memcmp(data, sensCtrl, len) == 0) {
+        _mcu = true;
+    } else if (len == 4 && data[0] == 0x00 && data[1] == 0xD0 && data[3] == 0x2C && _mcu) {
+        _mcu = false;
+        float value;
+        if (data[2] == 0x51) // COMP_DATA1_H, Pa = (code - 1024) * scale - offset
+            value = 1024 + (_model.pressure(simTimeUs()) + _offset) / _scale;
+        else if (data[2] == 0x61) // TMP_H, the driver's conversion backwards
+            value = _model.params.tempC * 10 * 3.739f + 10214;
+        else
+            return false;
+        _buffer = (uint16_t)lroundf(fminf(fmaxf(value, 0), 0xFFFF));
+    }
+    // CTRL_REG, BUFFER_0 and the address probe need no answer
+    return true;
+}
+
+size_t SimD6FPH::send(uint8_t *data, size_t len) {
+    uint8_t buffer[2] = {(uint8_t)(_buffer >> 8), (uint8_t)_buffer};
+    size_t n = len < 2 ? len : 2;
+    memcpy(data, buffer, n);
+    return n;
+}
+
+//--------------------------------------------------
+// DFRobot oxygen sensor
+
+SimOxygen::SimOxygen(SimBreathing &model, uint8_t address) : SimI2CDevice(address), _model(model) {}
+
+bool SimOxygen::receive(const uint8_t *data, size_t len) {
+    if (len > 0)
+        _register = data[0];
+    return true;
+}
+
+size_t SimOxygen::send(uint8_t *data, size_t len) {
+    memset(data, 0, len);
+    if (_register == 0x03 && len >= 3) { // OXYGEN_DATA_REGISTER: integer, tenths, hundredths of O2 / key
+        uint32_t value = (uint32_t)lroundf(_model.o2(simTimeUs()) / SIM_O2_KEY * 100);
+        data[0] = value / 100;
+        data[1] = value / 10 % 10;
+        data[2] = value % 10;
+    }
+    // GET_KEY_REGISTER reads 0, the factory key
+    return len;
+}
+
+//--------------------------------------------------
+// Sensirion SCD30
+
+uint8_t simSensirionCrc(const uint8_t *data, size_t len) {
+    uint8_t crc = 0xFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+    return crc;
+}
+
+SimSCD30::SimSCD30(SimBreathing &model) : SimI2CDevice(0x61), _model(model) {}
+
+// a new measurement every intervalS while measuring
+void SimSCD30::measure() {
+    uint64_t now = simTimeUs();
+    if (!measuring || now - _measuredUs < (uint64_t)intervalS * 1000000)
+        return;
+    _measuredUs = now;
+    _values[0] = _model.co2(now);
+    _values[1] = _model.params.tempC;
+    _values[2] = _model.params.humidity;
+    _ready = true;
+}
+
+void SimSCD30::reply(const uint16_t *words, size_t count) {
+    _replyLen = 0;
+    for (size_t i = 0; i < count && _replyLen + 3 <= sizeof(_reply); i++) {
+        _reply[_replyLen] = words[i] >> 8;
+        _reply[_replyLen + 1] = words[i] & 0xFF;
+        _reply[_replyLen + 2] = simSensirionCrc(&_reply[_replyLen], 2);
+        _replyLen += 3;
+    }
+}
+
+bool SimSCD30::receive(const uint8_t *data, size_t len) {
+    if (len == 0)
+        return true;
+    if (len != 2 && len != 5)
+        return false;
+    uint16_t command = data[0] << 8 | data[1];
+    if (len == 5) { // command with an argument word
+        if (simSensirionCrc(&data[2], 2) != data[4])
+            return false;
+        uint16_t argument = data[2] << 8 | data[3];
+        if (command == 0x0010) { // SCD30_CONTINUOUS_MEASUREMENT
+            if (!measuring)
+                _measuredUs = simTimeUs();
+            measuring = true;
+        } else if (command == 0x4600 && argument >= 2) { // SCD30_SET_MEASUREMENT_INTERVAL
+            intervalS = argument;
+        }
+        return true;
+    }
+    measure();
+    _replyLen = 0;
+    if (command == 0x0202) { // SCD30_GET_DATA_READY
+        uint16_t ready = _ready;
+        reply(&ready, 1);
+    } else if (command == 0x0300) { // SCD30_READ_MEASUREMENT, floats as two words
+        uint16_t words[6];
+        for (int i = 0; i < 3; i++) {
+            uint32_t bits;
+            memcpy(&bits, &_values[i], sizeof(bits));
+            words[2 * i] = bits >> 16;
+            words[2 * i + 1] = bits & 0xFFFF;
+        }
+        reply(words, 6);
+        _ready = false;
+    } else if (command == 0xD100) { // SCD30_READ_FW_VERSION
+        uint16_t version = 0x0342;
+        reply(&version, 1);
+    } else if (command == 0x0104) { // SCD30_STOP_MEASUREMENT
+        measuring = false;
+    }
+    return true;
+}
+
+size_t SimSCD30::send(uint8_t *data, size_t len) {
+    size_t n = len < _replyLen ? len : _replyLen;
+    memcpy(data, _reply, n);
+    return n;
+}
+
+void simAttachSensors(SimD6FPH &pressure, SimOxygen &oxygen, SimSCD30 &co2) {
+    Wire.attach(&pressure);
+    Wire.attach(&oxygen);
+    Wire.attach(&co2);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+// Simulated sensors of the mini firmware on the Wire.h bus, driven by a
+// breathing and gas exchange model.
+//
+// SimBreathing is a subject breathing through the venturi: a half sine of
+// expiratory flow at the given rate, tidal volume and expiration fraction
+// (the inspiration goes through the valve, not the venturi), and mixed
+// expired gas whose O2 and CO2 follow the set VO2 and RQ with a first order
+// lag (the mixing chamber). The concentrations are the ones for which the
+// equations of lib/VO2Calc give back the model's VE, VO2 and RQ, so a run
+// through the real drivers and VO2Calc shows what the sampling, breath
+// segmentation and the sensor paths add. The parameters can be changed at
+// any time, e.g. for a step test.
+//
+// The devices speak the register protocol the drivers use:
+//   SimD6FPH   Omron D6F-PH at 0x6C: CTRL_REG, SENS_CTRL, COMP_DATA1_H /
+//              TMP_H conversion, BUFFER_0 read
+//   SimOxygen  DFRobot O2 sensor (ADDRESS_3): GET_KEY_REGISTER,
+//              OXYGEN_DATA_REGISTER
+//   SimSCD30   Sensirion SCD30 at 0x61: data ready, read measurement, firmware
+//              version and the commands with arguments, all words with CRC-8
+// simAttachSensors() puts all three on Wire.
+
+#include "Wire.h"
+
+struct SimBreathingParams
+{
+    float startS = 0;           // s of room air before the breathing starts
+    float rate = 20;            // breaths/min
+    float tidalVolume = 1.5;    // L expired per breath, at the venturi
+    float expiration = 0.4;     // part of a breath spent expiring
+    float vo2 = 2000;           // ml/min
+    float rq = 0.9;             // in the firmware's units, see VO2Calc::co2Sample()
+    float fio2 = 20.93;         // % O2 of the inspired air
+    float inspiredCO2 = 400;    // ppm
+    float tempC = 20;           // air temperature, also what the SCD30 reports
+    float humidity = 50;        // % RH reported by the SCD30
+    float mixingTauS = 5;       // time constant of the expired gas concentrations
+    int diameterMm = 18;        // venturi throat, DIAMETER in main_mini.cpp
+};
+
+class SimBreathing
+{
+public:
+    explicit SimBreathing(const SimBreathingParams &params = SimBreathingParams()) : params(params) {}
+
+    float ventilation() const { return params.tidalVolume * params.rate; } // VE, L/min
+    float flow(uint64_t nowUs) const;        // L/s through the venturi
+    float pressure(uint64_t nowUs) const;    // Pa across the venturi
+    float o2(uint64_t nowUs);                // % O2 of the expired gas
+    float co2(uint64_t nowUs);               // ppm CO2 of the expired gas
+
+    SimBreathingParams params;
+
+private:
+    void mix(uint64_t nowUs);
+    float targetO2(uint64_t nowUs) const;
+    float targetCO2(uint64_t nowUs) const;
+
+    bool _mixing = false; // the concentrations start at the inspired air
+    uint64_t _mixedUs = 0;
+    float _o2 = 0;
+    float _co2 = 0;
+};
+
+class SimD6FPH : public SimI2CDevice
+{
+public:
+    // scale as Omron_D6FPH::getPressureScale(), D6F-PH0025AD2 by default
+    explicit SimD6FPH(SimBreathing &model, float scale = 250.0f / 60000, float offset = 0);
+    bool receive(const uint8_t *data, size_t len) override;
+    size_t send(uint8_t *data, size_t len) override;
+
+private:
+    SimBreathing &_model;
+    float _scale;
+    float _offset;
+    bool _mcu = false; // SENS_CTRL written since the last conversion
+    uint16_t _buffer = 0;
+};
+
+class SimOxygen : public SimI2CDevice
+{
+public:
+    explicit SimOxygen(SimBreathing &model, uint8_t address = 0x73);
+    bool receive(const uint8_t *data, size_t len) override;
+    size_t send(uint8_t *data, size_t len) override;
+
+private:
+    SimBreathing &_model;
+    uint8_t _register = 0;
+};
+
+class SimSCD30 : public SimI2CDevice
+{
+public:
+    explicit SimSCD30(SimBreathing &model);
+    bool receive(const uint8_t *data, size_t len) override;
+    size_t send(uint8_t *data, size_t len) override;
+
+    uint16_t intervalS = 2; // set by the driver, SCD30_SET_MEASUREMENT_INTERVAL
+    bool measuring = false;
+
+private:
+    void measure();
+    void reply(const uint16_t *words, size_t count);
+
+    SimBreathing &_model;
+    uint64_t _measuredUs = 0;
+    bool _ready = false;
+    float _values[3] = {}; // CO2 ppm, °C, % RH of the last measurement
+    uint8_t _reply[18];
+    size_t _replyLen = 0;
+};
+
+// Sensirion CRC-8 of a word, polynomial 0x31, init 0xFF
+uint8_t simSensirionCrc(const uint8_t *data, size_t len);
+
+// puts the three sensors of the mini firmware on Wire
+void simAttachSensors(SimD6FPH &pressure, SimOxygen &oxygen, SimSCD30 &co2);
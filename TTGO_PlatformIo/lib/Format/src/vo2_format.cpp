@@ -0,0 +1,81 @@
+#include "vo2_format.h"
+
+#include <math.h>
+#include <string.h>
+
+static const uint32_t POW10[FORMAT_MAX_DECIMALS + 1] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+// copies len bytes, always terminates, returns len (snprintf semantics)
+static size_t put(char *out, size_t size, const char *text, size_t len) {
+    if (size == 0)
+        return len;
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(out, text, n);
+    out[n] = '\0';
+    return len;
+}
+
+// digits of value right aligned in tmp, at least minDigits, returns start
+static char *digits(char *end, uint64_t value, uint8_t minDigits) {
+    char *p = end;
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+        if (minDigits)
+            minDigits--;
+    } while (value || minDigits);
+    return p;
+}
+
+size_t formatTime(char *out, size_t size, uint32_t ms) {
+    uint32_t s = ms / 1000;
+    char tmp[8] = {
+        char('0' + (s / 3600) % 24 / 10), char('0' + (s / 3600) % 24 % 10), ':',
+        char('0' + (s / 60) % 60 / 10), char('0' + (s / 60) % 60 % 10), ':',
+        char('0' + s % 60 / 10), char('0' + s % 60 % 10)};
+    return put(out, size, tmp, sizeof(tmp));
+}
+
+size_t formatUInt(char *out, size_t size, uint64_t value) {
+    char tmp[20];
+    char *end = tmp + sizeof(tmp);
+    char *p = digits(end, value, 1);
+    return put(out, size, p, end - p);
+}
+
+size_t formatInt(char *out, size_t size, int32_t value) {
+    char tmp[11];
+    char *end = tmp + sizeof(tmp);
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    char *p = digits(end, magnitude, 1);
+    if (value < 0)
+        *--p = '-';
+    return put(out, size, p, end - p);
+}
+
+size_t formatFixed(char *out, size_t size, float value, uint8_t decimals) {
+    if (isnan(value))
+        return put(out, size, "nan", 3);
+    if (isinf(value))
+        return value < 0 ? put(out, size, "-inf", 4) : put(out, size, "inf", 3);
+    if (decimals > FORMAT_MAX_DECIMALS)
+        decimals = FORMAT_MAX_DECIMALS;
+
+    // scaled in double so e.g. 100000.5 keeps its decimals
+    double scaled = fabs((double)value) * POW10[decimals] + 0.5;
+    if (scaled >= 1.8e19) // beyond uint64_t, not a sensible measurement
+        return value < 0 ? put(out, size, "-inf", 4) : put(out, size, "inf", 3);
+    uint64_t units = (uint64_t)scaled;
+
+    char tmp[28];
+    char *end = tmp + sizeof(tmp);
+    char *p = end;
+    if (decimals) {
+        p = digits(p, units % POW10[decimals], decimals);
+        *--p = '.';
+    }
+    p = digits(p, units / POW10[decimals], 1);
+    if (value < 0 && units)
+        *--p = '-';
+    return put(out, size, p, end - p);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+// Text formatting without heap allocation.
+//
+// Replaces Arduino String concatenation in the telemetry and display paths.
+// Everything is written into caller provided, fixed size char buffers;
+// output is always NUL terminated and silently truncated if it does not fit.
+// Floats are formatted with integer arithmetic only (no printf / dtoa).
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FORMAT_TIME_SIZE 9    // "HH:MM:SS" + NUL
+#define FORMAT_MAX_DECIMALS 6
+
+// HH:MM:SS, hours wrap at 24 like the display always did
+size_t formatTime(char *out, size_t size, uint32_t ms);
+size_t formatUInt(char *out, size_t size, uint64_t value);
+size_t formatInt(char *out, size_t size, int32_t value);
+// fixed number of decimals, rounded half away from zero, "nan" / "inf"
+size_t formatFixed(char *out, size_t size, float value, uint8_t decimals);
+
+// Appends text to a fixed capacity buffer, e.g. one csv line:
+//   FormatBuffer<64> line;
+//   line.add(vo2, 2).add(',').add(respq, 2).add("\r\n");
+template <size_t N>
+class FormatBuffer
+{
+public:
+    FormatBuffer() { clear(); }
+
+    void clear() {
+        _len = 0;
+        _text[0] = '\0';
+        _truncated = false;
+    }
+
+    FormatBuffer &add(char c) {
+        if (_len + 1 < N) {
+            _text[_len++] = c;
+            _text[_len] = '\0';
+        } else {
+            _truncated = true;
+        }
+        return *this;
+    }
+
+    FormatBuffer &add(const char *s) {
+        while (*s)
+            add(*s++);
+        return *this;
+    }
+
+    FormatBuffer &add(float value, uint8_t decimals) {
+        return advance(formatFixed(&_text[_len], N - _len, value, decimals));
+    }
+
+    FormatBuffer &add(uint32_t value) {
+        return advance(formatUInt(&_text[_len], N - _len, value));
+    }
+
+    FormatBuffer &add(uint64_t value) {
+        return advance(formatUInt(&_text[_len], N - _len, value));
+    }
+
+    FormatBuffer &add(int32_t value) {
+        return advance(formatInt(&_text[_len], N - _len, value));
+    }
+
+    FormatBuffer &time(uint32_t ms) {
+        return advance(formatTime(&_text[_len], N - _len, ms));
+    }
+
+    const char *c_str() const { return _text; }
+    const uint8_t *data() const { return (const uint8_t *)_text; }
+    size_t length() const { return _len; }
+    bool truncated() const { return _truncated; }
+
+private:
+    FormatBuffer &advance(size_t written) {
+        // the format functions return the untruncated length
+        if (_len + written >= N) {
+            _len = N - 1;
+            _truncated = true;
+        } else {
+            _len += written;
+        }
+        return *this;
+    }
+
+    char _text[N];
+    size_t _len;
+    bool _truncated;
+};
@@ -0,0 +1,52 @@
+#include "vo2_format_lines.h"
+
+void formatCsvLine(FormatBuffer<CSV_LINE_SIZE> &line, const CsvValues &values) {
+    line.clear();
+    line.add(values.timeS, 0).add(',').add(values.vo2, 2).add(',').add(values.vo2Max, 2)
+        .add(',').add(values.vco2, 2).add(',').add(values.respq, 2).add(',').add(values.volumeExp, 2)
+        .add(',').add(values.VEmean, 2).add(',').add(values.freqVEmean, 2).add(',').add(values.o2, 2)
+        .add(',').add(values.co2perc, 3).add("\r\n");
+}
+
+void formatBatteryLine(FormatBuffer<BATTERY_LINE_SIZE> &line, float timeS, float volts) {
+    line.clear();
+    line.add(timeS, 0).add(',').add(volts, 2).add("\r\n");
+}
+
+void formatBreathJson(FormatBuffer<BREATH_JSON_SIZE> &json, const BreathRecord &rec) {
+    json.clear();
+    json.add("{\"breath\": {\"schema\": ").add((uint32_t)BREATH_SCHEMA)
+        .add(", \"seq\": ").add(rec.seq)
+        .add(", \"t_us\": ").add(rec.timeUs)
+        .add(", \"insp_ms\": ").add(rec.inspirationMs)
+        .add(", \"exp_ms\": ").add(rec.expirationMs)
+        .add(", \"flags\": ").add((uint32_t)rec.flags)
+        .add(", \"volumeExp\": ").add(rec.volumeExp, 2)
+        .add(", \"VE\": ").add(rec.VE, 2)
+        .add(", \"VEmean\": ").add(rec.VEmean, 2)
+        .add(", \"freqVE\": ").add(rec.freqVE, 1)
+        .add(", \"freqVEmean\": ").add(rec.freqVEmean, 1)
+        .add(", \"vo2Total\": ").add(rec.vo2Total, 2)
+        .add(", \"vo2Rel\": ").add(rec.vo2Rel, 2)
+        .add(", \"deltaO2_frac\": ").add(rec.deltaO2_frac, 2)
+        .add(", \"vo2TotalIn\": ").add(rec.vo2TotalIn, 2)
+        .add(", \"vo2TotalOut\": ").add(rec.vo2TotalOut, 2)
+        .add(", \"vco2Total\": ").add(rec.vco2Total, 2)
+        .add(", \"vco2Rel\": ").add(rec.vco2Rel, 2)
+        .add(", \"respq\": ").add(rec.respq, 2).add("}}\r\n");
+}
+
+void formatVoltage(FormatBuffer<DISPLAY_TEXT_SIZE> &text, float volts) {
+    text.clear();
+    text.add(volts, 2).add('V');
+}
+
+void formatSampleInterval(FormatBuffer<DISPLAY_TEXT_SIZE> &text, float meanUs, float stdUs) {
+    text.clear();
+    text.add("dt ").add(meanUs / 1000, 1).add("+-").add(stdUs / 1000, 1).add("ms");
+}
+
+void formatSampleGaps(FormatBuffer<DISPLAY_TEXT_SIZE> &text, uint32_t gaps, uint32_t gapUs) {
+    text.clear();
+    text.add("gaps ").add(gaps).add(" >").add(gapUs / 1000).add("ms");
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// The text the firmwares send and display, built in FormatBuffers: the csv
+// lines of ExcelStream() / BatteryBT(), the JSON breath record of
+// main_mini.cpp's TELEMETRY_JSON output and the short display texts. Kept
+// out of the main files so test_format can run them for a whole session.
+
+#include "vo2_format.h"
+#include "vo2_telemetry.h"
+
+#define CSV_HEADER "Time,VO2,VO2MAX,VCO2,RQ,Bvol,VEmin,Brate,outO2%,CO2%\r\n"
+#define CSV_LINE_SIZE 128
+#define BATTERY_LINE_SIZE 32
+#define BREATH_JSON_SIZE 448
+#define DISPLAY_TEXT_SIZE 24
+
+// one line of CSV_HEADER
+struct CsvValues
+{
+    float timeS;
+    float vo2;
+    float vo2Max;
+    float vco2;
+    float respq;
+    float volumeExp;
+    float VEmean;
+    float freqVEmean;
+    float o2;
+    float co2perc;
+};
+
+void formatCsvLine(FormatBuffer<CSV_LINE_SIZE> &line, const CsvValues &values);
+// Time,Voltage
+void formatBatteryLine(FormatBuffer<BATTERY_LINE_SIZE> &line, float timeS, float volts);
+// {"breath": {...}} with the fields of BreathRecord
+void formatBreathJson(FormatBuffer<BREATH_JSON_SIZE> &json, const BreathRecord &rec);
+
+// "4.12V"
+void formatVoltage(FormatBuffer<DISPLAY_TEXT_SIZE> &text, float volts);
+// "dt 10.0+-0.4ms", mean and std dev of the pressure sample interval
+void formatSampleInterval(FormatBuffer<DISPLAY_TEXT_SIZE> &text, float meanUs, float stdUs);
+// "gaps 3 >50ms"
+void formatSampleGaps(FormatBuffer<DISPLAY_TEXT_SIZE> &text, uint32_t gaps, uint32_t gapUs);
@@ -0,0 +1,93 @@
+#include "vo2_i2c_stats.h"
+
+#include <string.h>
+
+const char *const i2cDeviceNames[I2C_DEVICES] = {"pressure", "o2", "co2"};
+
+void I2CStats::write(uint8_t device, uint8_t result, uint32_t us) {
+    I2CDeviceStats &d = _devices[device];
+    d.attempts++;
+    d.latency.add(us);
+    if (result == I2C_OK)
+        return;
+    if (result == I2C_NACK_ADDRESS || result == I2C_NACK_DATA) {
+        d.nacks++; // nobody there, the bus itself is fine
+    } else {
+        d.busErrors++;
+        failed(device);
+    }
+}
+
+void I2CStats::read(uint8_t device, size_t wanted, size_t got, uint32_t us) {
+    I2CDeviceStats &d = _devices[device];
+    d.attempts++;
+    d.latency.add(us);
+    if (got < wanted) {
+        d.shortReads++; // also what an absent device gives, not a streak
+    } else {
+        d.failStreak = 0; // a complete read ends the streaks, not a write
+        d.resetStreak = 0;
+    }
+}
+
+void I2CStats::crcError(uint8_t device) {
+    _devices[device].crcErrors++;
+    failed(device);
+}
+
+bool I2CStats::recoveryNeeded(uint8_t device, uint32_t nowMs) const {
+    const I2CDeviceStats &d = _devices[device];
+    if (d.failStreak < I2C_RECOVERY_FAILURES || d.resetStreak >= I2C_RECOVERY_ATTEMPTS)
+        return false;
+    return !_recovering || nowMs - _recoveryMs >= I2C_RECOVERY_INTERVAL_MS;
+}
+
+void I2CStats::recovered(uint8_t device, uint32_t nowMs) {
+    _devices[device].recoveries++;
+    _devices[device].resetStreak++;
+    for (int i = 0; i < I2C_DEVICES; i++)
+        _devices[i].failStreak = 0;
+    _recovering = true;
+    _recoveryMs = nowMs;
+}
+
+void I2CStats::reset() {
+    memset(_devices, 0, sizeof(_devices));
+    _recovering = false;
+    _recoveryMs = 0;
+}
+
+static uint8_t *putU16(uint8_t *p, uint32_t v) {
+    if (v > 0xFFFF)
+        v = 0xFFFF;
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *putU32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (8 * i);
+    return p + 4;
+}
+
+size_t i2cStatsPack(const I2CStats &stats, uint8_t *out) {
+    uint8_t *p = out;
+    for (uint8_t i = 0; i < I2C_DEVICES; i++) {
+        const I2CDeviceStats &d = stats.device(i);
+        *p++ = i;
+        p = putU32(p, d.attempts);
+        p = putU32(p, d.nacks);
+        p = putU32(p, d.busErrors);
+        p = putU32(p, d.shortReads);
+        p = putU32(p, d.crcErrors);
+        p = putU32(p, d.retries);
+        p = putU16(p, d.recoveries);
+        p = putU16(p, d.latency.percentile(50));
+        p = putU16(p, d.latency.percentile(99));
+        p = putU16(p, d.latency.max);
+    }
+    return p - out;
+}
+
+I2CStats i2cStats;
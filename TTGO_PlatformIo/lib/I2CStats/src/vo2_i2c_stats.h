@@ -0,0 +1,88 @@
+#pragma once
+
+// Counters and latency histograms of every I2C transaction, per sensor.
+//
+// The sensor drivers report each Wire.endTransmission() and
+// Wire.requestFrom() with its result and duration, plus the checks only
+// they can make (CRC of the SCD30 words) and the retries they did. A
+// device with I2C_RECOVERY_FAILURES bus errors, timeouts or CRC failures in
+// a row asks for a bus recovery, which loop() does between sensor reads.
+// NACKs and short reads do not count: an unplugged sensor gives those and
+// a bus reset can't bring it back. Resets are at least
+// I2C_RECOVERY_INTERVAL_MS apart, and after I2C_RECOVERY_ATTEMPTS resets
+// without a good read in between the device asks for none until it reads
+// again. Everything runs in the loop() task, so there are no locks.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vo2_profiler.h" // StageHistogram
+
+#define I2C_RECOVERY_FAILURES 5       // bus errors in a row before the bus is reset
+#define I2C_RECOVERY_INTERVAL_MS 10000 // at most one reset in this time
+#define I2C_RECOVERY_ATTEMPTS 3        // resets that did not help before giving up
+
+enum i2cDevices
+{
+    I2C_PRESSURE, // Omron D6F-PH
+    I2C_O2,       // DFRobot oxygen sensor
+    I2C_CO2,      // Sensirion SCD30
+    I2C_DEVICES
+};
+
+// Wire.endTransmission() results of the ESP32 Arduino core
+enum i2cResults
+{
+    I2C_OK = 0,
+    I2C_TOO_LONG = 1,
+    I2C_NACK_ADDRESS = 2,
+    I2C_NACK_DATA = 3,
+    I2C_BUS_ERROR = 4,
+    I2C_TIMEOUT = 5,
+};
+
+struct I2CDeviceStats
+{
+    uint32_t attempts;     // transactions started
+    uint32_t nacks;        // address or data not acknowledged
+    uint32_t busErrors;    // other endTransmission() errors and timeouts
+    uint32_t shortReads;   // requestFrom() returned fewer bytes than asked
+    uint32_t crcErrors;    // data arrived but failed its checksum
+    uint32_t retries;      // reads the driver repeated after a failure
+    uint32_t recoveries;   // bus resets this device asked for
+    uint32_t failStreak;   // bus errors since the last good read
+    uint32_t resetStreak;  // bus resets since the last good read
+    StageHistogram latency; // us per transaction
+};
+
+class I2CStats
+{
+public:
+    I2CStats() { reset(); }
+    // result of Wire.endTransmission(), us it took
+    void write(uint8_t device, uint8_t result, uint32_t us);
+    // Wire.requestFrom() returned got of the wanted bytes
+    void read(uint8_t device, size_t wanted, size_t got, uint32_t us);
+    void crcError(uint8_t device);
+    void retry(uint8_t device) { _devices[device].retries++; }
+    // millis() now, for the time since the last reset
+    bool recoveryNeeded(uint8_t device, uint32_t nowMs) const;
+    void recovered(uint8_t device, uint32_t nowMs);
+    const I2CDeviceStats &device(uint8_t device) const { return _devices[device]; }
+    void reset();
+
+private:
+    void failed(uint8_t device) { _devices[device].failStreak++; }
+    I2CDeviceStats _devices[I2C_DEVICES];
+    bool _recovering;     // the bus was reset at least once
+    uint32_t _recoveryMs; // millis() of the last reset
+};
+
+// Packed for BLE, little-endian, I2C_STATS_PACKED_DEVICE bytes per device:
+//   u8 device, u32 attempts, nacks, busErrors, shortReads, crcErrors,
+//   retries, u16 recoveries, u16 p50 us, u16 p99 us, u16 max us (saturating)
+#define I2C_STATS_PACKED_DEVICE 33
+#define I2C_STATS_PACKED_SIZE (I2C_DEVICES * I2C_STATS_PACKED_DEVICE)
+size_t i2cStatsPack(const I2CStats &stats, uint8_t *out);
+
+extern I2CStats i2cStats;
+extern const char *const i2cDeviceNames[I2C_DEVICES];
@@ -37,6 +37,24 @@
 #include <Arduino.h>
 #include <Wire.h>
 #include "DFRobot_OxygenSensor.h"
+#include "vo2_i2c_stats.h"
+
+/* Wire transactions, counted with their duration in i2cStats */
+static uint8_t endTransmission()
+{
+  uint32_t start = micros();
+  uint8_t result = Wire.endTransmission();
+  i2cStats.write(I2C_O2, result, micros() - start);
+  return result;
+}
+
+static uint8_t requestFrom(uint8_t addr, uint8_t len)
+{
+  uint32_t start = micros();
+  uint8_t got = Wire.requestFrom(addr, len);
+  i2cStats.read(I2C_O2, len, got, micros() - start);
+  return got;
+}
 
 DFRobot_OxygenSensor::DFRobot_OxygenSensor()
 {
@@ -50,7 +68,7 @@ bool DFRobot_OxygenSensor::init(uint8_t addr)
 {
   this->_addr = addr;              // Set the host address
   Wire.beginTransmission(_addr);
-  if(Wire.endTransmission() == 0) {
+  if(endTransmission() == 0) {
     return true;
   }
   return false;
@@ -62,7 +80,7 @@ bool DFRobot_OxygenSensor::begin(uint8_t addr)
   this->_addr = addr;              // Set the host address
   Wire.begin();                     // connecting the i2c bus
   Wire.beginTransmission(_addr);
-  if(Wire.endTransmission() == 0) {
+  if(endTransmission() == 0) {
     return true;
   }
   return false;
@@ -73,9 +91,11 @@ void DFRobot_OxygenSensor::ReadFlash()
   uint8_t value = 0;
   Wire.beginTransmission(_addr);
   Wire.write(GET_KEY_REGISTER);
-  Wire.endTransmission();
+  endTransmission();
   delay(50);
-  Wire.requestFrom(_addr, (uint8_t)1);
+  if(requestFrom(_addr, (uint8_t)1) < 1 && _Key > 0) {
+    return;                         // keep the key read before, 0 would mean "not calibrated"
+  }
     while (Wire.available())
       value = Wire.read();
   if(value == 0) {
@@ -91,7 +111,7 @@ void DFRobot_OxygenSensor::i2cWrite(uint8_t Reg , uint8_t pdata)
   Wire.beginTransmission(_addr);
   Wire.write(Reg);
   Wire.write(pdata);
-  Wire.endTransmission();
+  endTransmission();
 }
 
 /* Set Key value */
@@ -109,32 +129,25 @@ void DFRobot_OxygenSensor::Calibrate(float vol, float mv) {
 float DFRobot_OxygenSensor::ReadOxygenData(uint8_t CollectNum)
 {
   uint8_t rxbuf[10]={0}, k = 0;
-  static uint8_t i = 0 ,j = 0;
   ReadFlash();
   if(CollectNum > 0) {
-    for(j = CollectNum - 1;  j > 0; j--) {  OxygenData[j] = OxygenData[j-1]; }
     Wire.beginTransmission(_addr);
     Wire.write(OXYGEN_DATA_REGISTER);
-    Wire.endTransmission();
+    endTransmission();
     delay(100);
-    Wire.requestFrom(_addr, (uint8_t)3);
-      while (Wire.available())
+    if(requestFrom(_addr, (uint8_t)3) < 3) {
+      i2cStats.retry(I2C_O2);
+      if(requestFrom(_addr, (uint8_t)3) < 3) {
+        // no new sample, the average of the ones before instead of a wrong value
+        return _average.average();
+      }
+    }
+      while (Wire.available() && k < 3)
         rxbuf[k++] = Wire.read();
-    OxygenData[0] = ((_Key) * (((float)rxbuf[0]) + ((float)rxbuf[1] / 10.0) + ((float)rxbuf[2] / 100.0)));
-    if(i < CollectNum) i++;
-    return getAverageNum(OxygenData, i);
+    float oxygen = ((_Key) * (((float)rxbuf[0]) + ((float)rxbuf[1] / 10.0) + ((float)rxbuf[2] / 100.0)));
+    return _average.add(oxygen, CollectNum);
   }else {
     return -1.0;
   }
 }
 
-/* Get the average data */
-float DFRobot_OxygenSensor::getAverageNum(float bArray[], uint8_t iFilterLen)
-{
-  uint8_t i = 0;
-  double bTemp = 0;
-  for(i = 0; i < iFilterLen; i++) {
-    bTemp += bArray[i];
-  }
-  return bTemp / (float)iFilterLen;
-}
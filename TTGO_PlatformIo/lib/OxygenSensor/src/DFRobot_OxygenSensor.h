@@ -36,6 +36,8 @@
 #ifndef __DFRobot_OxygenSensor_H__
 #define __DFRobot_OxygenSensor_H__
 
+#include "vo2_oxygen_average.h"
+
 #define           ADDRESS_0                 0x70           // iic slave Address
 #define           ADDRESS_1                 0x71
 #define           ADDRESS_2                 0x72
@@ -62,8 +64,7 @@ private:
   void     i2cWrite(uint8_t Reg , uint8_t pdata);
   uint8_t  _addr;                               // IIC Slave number
   float    _Key = 0.0;                          // oxygen key value
-  float    OxygenData[OCOUNT] = {0.00};
-  float    getAverageNum(float bArray[], uint8_t iFilterLen);
+  OxygenAverage _average;                       // the last CollectNum readings
 };
 
 #endif
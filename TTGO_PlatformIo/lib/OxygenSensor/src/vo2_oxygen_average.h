@@ -0,0 +1,37 @@
+#pragma once
+
+// Moving average of the DFRobot oxygen readings, as ReadOxygenData(n)
+// always did it: the newest reading goes to the front of the window, the
+// result is the mean of the first n (fewer until n readings arrived).
+// No hardware access, so it is also built by the host benchmarks.
+
+#include <stdint.h>
+
+#define OXYGEN_AVERAGE_MAX 100 // largest n, OCOUNT of the driver
+
+class OxygenAverage
+{
+public:
+    float add(float value, uint8_t n) {
+        for (uint8_t j = n - 1; j > 0; j--)
+            _data[j] = _data[j - 1];
+        _data[0] = value;
+        if (_count < n)
+            _count++;
+        return average();
+    }
+
+    // mean of the readings so far, 0 before the first one
+    float average() const {
+        if (_count == 0)
+            return 0.0;
+        double sum = 0;
+        for (uint8_t i = 0; i < _count; i++)
+            sum += _data[i];
+        return sum / (float)_count;
+    }
+
+private:
+    float _data[OXYGEN_AVERAGE_MAX] = {0.00};
+    uint8_t _count = 0;
+};
@@ -3,6 +3,7 @@
 // License as published by the Free Software Foundation; either
 // version 2.1 of the License, or (at your option) any later version.
 #include "Omron_D6FPH.h"
+#include "vo2_i2c_stats.h"
 
 Omron_D6FPH::Omron_D6FPH(void){
   // Constructor
@@ -60,12 +61,12 @@ boolean Omron_D6FPH::init(){
   _i2cPort->beginTransmission(_i2cAddress);
   _i2cPort->write(CTRL_REG);
   _i2cPort->write(0x00);
-  return (_i2cPort->endTransmission() == I2C_ERROR_OK);
+  return (endTransmission() == I2C_ERROR_OK);
 }
 
 boolean Omron_D6FPH::isConnected(){
     _i2cPort->beginTransmission((uint8_t)_i2cAddress);
-    return _i2cPort->endTransmission() == I2C_ERROR_OK;
+    return endTransmission() == I2C_ERROR_OK;
 }
 
 /**
@@ -79,10 +80,21 @@ boolean Omron_D6FPH::executeMcuMode(){
   _i2cPort->write(lowByte(SENS_CTRL));  
   _i2cPort->write(0x18);  
   _i2cPort->write(SENS_CTRL_VAL);  
-  return (_i2cPort->endTransmission() == I2C_ERROR_OK);
+  return (endTransmission() == I2C_ERROR_OK);
 }
 
 float Omron_D6FPH::getPressure(){
+    uint16_t value;
+    if(getPressureCode(&value)){
+        return codeToPressure(value);
+    }
+    return NAN;
+}
+
+/**
+ * Raw compensated output code as read from BUFFER_0, before scaling to Pa
+ */
+boolean Omron_D6FPH::getPressureCode(uint16_t *code){
     if(executeMcuMode()){
         delay(33);
         _i2cPort->beginTransmission(_i2cAddress);
@@ -90,14 +102,26 @@ float Omron_D6FPH::getPressure(){
         _i2cPort->write(highByte(COMP_DATA1_H));
         _i2cPort->write(lowByte(COMP_DATA1_H));
         _i2cPort->write(SERIAL_CTRL_VAL);
-        if (_i2cPort->endTransmission() == I2C_ERROR_OK){
-            uint16_t value;
-            if(readRegister(BUFFER_0, &value)){
-                return (float)((value - 1024.00) * _rangeMode * _rangeModeMulVal / 60000L) - _rangeModeSubVal;
-            }
+        if (endTransmission() == I2C_ERROR_OK){
+            return readRegister(BUFFER_0, code);
         }
     }
-    return NAN;
+    return false;
+}
+
+/**
+ * Pa = (code - 1024) * scale - offset, see datasheet output characteristics
+ */
+float Omron_D6FPH::codeToPressure(uint16_t code){
+    return (float)((code - 1024.00) * _rangeMode * _rangeModeMulVal / 60000L) - _rangeModeSubVal;
+}
+
+float Omron_D6FPH::getPressureScale(){
+    return (float)_rangeMode * _rangeModeMulVal / 60000L;
+}
+
+float Omron_D6FPH::getPressureOffset(){
+    return _rangeModeSubVal;
 }
 
 float Omron_D6FPH::getTemperature(){
@@ -108,7 +132,7 @@ float Omron_D6FPH::getTemperature(){
         _i2cPort->write(highByte(TMP_H));
         _i2cPort->write(lowByte(TMP_H));
         _i2cPort->write(SERIAL_CTRL_VAL);
-        if (_i2cPort->endTransmission() == I2C_ERROR_OK){
+        if (endTransmission() == I2C_ERROR_OK){
             uint16_t value;
             if(readRegister(BUFFER_0, &value)){
                 int temp = round((float)(value - 10214) / 3.739);
@@ -122,10 +146,29 @@ float Omron_D6FPH::getTemperature(){
 boolean Omron_D6FPH::readRegister(uint8_t reg, uint16_t *value) {
     _i2cPort->beginTransmission(_i2cAddress);
     _i2cPort->write(reg);
-    if(_i2cPort->endTransmission() == I2C_ERROR_OK){
-        _i2cPort->requestFrom(_i2cAddress, (uint8_t)2);
+    if(endTransmission() == I2C_ERROR_OK){
+        if(requestFrom(2) < 2){
+            return false;
+        }
         *value = ((_i2cPort->read() << 8) | _i2cPort->read());
         return true;
     }
     return false;
+}
+
+/**
+ * Wire transactions, counted with their duration in i2cStats
+ */
+uint8_t Omron_D6FPH::endTransmission(){
+    uint32_t start = micros();
+    uint8_t result = _i2cPort->endTransmission();
+    i2cStats.write(I2C_PRESSURE, result, micros() - start);
+    return result;
+}
+
+uint8_t Omron_D6FPH::requestFrom(uint8_t len){
+    uint32_t start = micros();
+    uint8_t got = _i2cPort->requestFrom(_i2cAddress, len);
+    i2cStats.read(I2C_PRESSURE, len, got, micros() - start);
+    return got;
 }
\ No newline at end of file
@@ -58,12 +58,18 @@ public:
     void setSensorModel(sensorModels sensorModel = MODEL_5050AD3);
     boolean isConnected();
     float getPressure();
+    boolean getPressureCode(uint16_t *code);
+    float codeToPressure(uint16_t code);
+    float getPressureScale();
+    float getPressureOffset();
     float getTemperature();
 private:
     sensorModels _sensorModel;
     boolean init();
     boolean readRegister(uint8_t reg, uint16_t *value);
     boolean executeMcuMode();
+    uint8_t endTransmission();
+    uint8_t requestFrom(uint8_t len);
     TwoWire *_i2cPort;
     uint8_t _i2cAddress;  
     uint16_t _rangeMode;
@@ -0,0 +1,40 @@
+#include "vo2_profiler.h"
+
+#include <string.h>
+
+const char *const profileStageNames[PROF_STAGES] = {
+    "loop", "commands", "pressure", "flow", "o2", "co2", "breath", "screen", "ble", "serial",
+};
+
+uint32_t StageHistogram::percentile(float percent) const {
+    if (count == 0)
+        return 0;
+    // 1-based rank of the sample, like the nearest rank method
+    uint32_t rank = (uint32_t)(percent / 100 * count + 0.999f);
+    if (rank < 1)
+        rank = 1;
+    if (rank > count)
+        rank = count;
+    uint32_t below = 0;
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        uint32_t n = buckets[i];
+        if (below + n < rank) {
+            below += n;
+            continue;
+        }
+        if (i == 0)
+            return 0;
+        // spread the samples of the bucket evenly over its range
+        uint64_t low = 1ull << (i - 1);
+        uint64_t high = (1ull << i) - 1;
+        uint64_t value = low + (high - low) * (rank - below) / n;
+        return value < max ? (uint32_t)value : max;
+    }
+    return max;
+}
+
+void Profiler::reset() {
+    memset(_stages, 0, sizeof(_stages));
+}
+
+Profiler profiler;
@@ -0,0 +1,102 @@
+#pragma once
+
+// Per-stage timing of the firmware loop, cheap enough to stay compiled in.
+//
+// A ProfileScope reads the CPU cycle counter when it is created and when it
+// goes out of scope and adds the difference to the histogram of its stage:
+//   { PROFILE_SCOPE(PROF_O2); Oxygen.ReadOxygenData(COLLECT_NUMBER); }
+// The histograms have one bucket per power of two cycles, so recording is a
+// count-leading-zeros and a few increments, no division and no floats; the
+// percentiles come out with the resolution of a bucket, interpolated within
+// it. Each stage must only be recorded from one task (no locks); a report
+// taken while another task records may be off by that one sample.
+// Build with -DNO_PROFILER to remove the scopes entirely.
+
+#include <stddef.h>
+#include <stdint.h>
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <time.h>
+#endif
+
+#define PROFILE_BUCKETS 33 // bucket 0: 0 cycles, bucket i: [2^(i-1), 2^i)
+
+enum profileStages
+{
+    PROF_LOOP,      // all of loop()
+    PROF_COMMANDS,  // serial command parsing and handlers
+    PROF_PRESSURE,  // D6F-PH read over I2C
+    PROF_FLOW,      // flow integral and BLE flow sample
+    PROF_O2,        // O2 sensor read
+    PROF_CO2,       // SCD30 read
+    PROF_BREATH,    // VO2 calculation, breath record, session file
+    PROF_SCREEN,    // TFT drawing
+    PROF_BLE,       // metrics notifications
+    PROF_SERIAL,    // UART writes of the telemetry task
+    PROF_STAGES
+};
+
+struct StageHistogram
+{
+    uint32_t buckets[PROFILE_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+
+    void add(uint32_t cycles) {
+        buckets[cycles ? 32 - __builtin_clz(cycles) : 0]++;
+        count++;
+        total += cycles;
+        if (cycles > max)
+            max = cycles;
+    }
+    // cycles below which percent % of the samples lie, 0 without samples
+    uint32_t percentile(float percent) const;
+};
+
+class Profiler
+{
+public:
+    Profiler() { reset(); }
+    void add(uint8_t stage, uint32_t cycles) { _stages[stage].add(cycles); }
+    const StageHistogram &stage(uint8_t stage) const { return _stages[stage]; }
+    void reset();
+
+private:
+    StageHistogram _stages[PROF_STAGES];
+};
+
+extern Profiler profiler;
+extern const char *const profileStageNames[PROF_STAGES];
+
+// free running, wraps after 2^32 cycles (17.9 s at 240 MHz); the host
+// build counts nanoseconds instead
+static inline uint32_t profileCycles() {
+#ifdef ARDUINO
+    return ESP.getCycleCount();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+#endif
+}
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(uint8_t stage) : _stage(stage), _start(profileCycles()) {}
+    ~ProfileScope() { profiler.add(_stage, profileCycles() - _start); }
+
+private:
+    uint8_t _stage;
+    uint32_t _start;
+};
+
+#ifdef NO_PROFILER
+#define PROFILE_SCOPE(stage)
+#else
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(stage)
+#endif
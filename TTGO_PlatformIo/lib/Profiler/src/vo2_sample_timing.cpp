@@ -0,0 +1,36 @@
+#include "vo2_sample_timing.h"
+
+#include <math.h>
+#include <string.h>
+
+void SampleTiming::sample(uint64_t nowUs) {
+    if (!_started) {
+        _started = true;
+        _lastUs = nowUs;
+        return;
+    }
+    uint64_t delta = nowUs - _lastUs;
+    _lastUs = nowUs;
+    uint32_t us = delta > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)delta;
+    intervals.add(us);
+    if (us > gapUs)
+        gaps++;
+    _n++;
+    double d = us - _mean;
+    _mean += d / _n;
+    _m2 += d * (us - _mean);
+}
+
+float SampleTiming::stdUs() const {
+    return _n > 1 ? sqrt(_m2 / (_n - 1)) : 0;
+}
+
+void SampleTiming::reset() {
+    gaps = 0;
+    memset(&intervals, 0, sizeof(intervals));
+    _lastUs = 0;
+    _started = false;
+    _n = 0;
+    _mean = 0;
+    _m2 = 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// Interval between pressure samples, which loop() timing decides.
+//
+// sample() is called with the time of every pressure reading. The interval
+// to the one before goes into an online mean and variance (Welford, in
+// double so hours of samples don't lose precision) and a log2 histogram in
+// microseconds. An interval over gapUs counts as a gap: samples that
+// should have been taken but weren't.
+
+#include <stdint.h>
+#include "vo2_profiler.h" // StageHistogram
+
+// Default gap threshold. During the inspiration every loop() also reads O2
+// and CO2 and waits 100 ms, so samples are ~300 ms apart there by design
+// (~285 ms in test_sim); the margin covers the screen update after a breath.
+#define SAMPLE_GAP_US 500000
+
+class SampleTiming
+{
+public:
+    explicit SampleTiming(uint32_t gapUs = SAMPLE_GAP_US) : gapUs(gapUs) { reset(); }
+
+    void sample(uint64_t nowUs);
+    void reset(); // keeps gapUs
+    uint32_t count() const { return _n; } // intervals, one less than samples
+    float meanUs() const { return _mean; }
+    float stdUs() const;
+
+    uint32_t gapUs;        // intervals above this are gaps
+    uint32_t gaps;
+    StageHistogram intervals; // us
+
+private:
+    uint64_t _lastUs;
+    bool _started;
+    uint32_t _n;
+    double _mean;
+    double _m2; // sum of squared differences from the mean
+};
@@ -29,6 +29,7 @@
 
 #include "SCD30.h"
 #include "esp32-hal-log.h"
+#include "vo2_i2c_stats.h"
 
 SCD30::SCD30(void) {
     devAddr = SCD30_I2C_ADDRESS;
@@ -49,6 +50,7 @@ bool SCD30::initialize(void) {
     startPeriodicMeasurment(); // start periodic measuments
 
     //setAutoSelfCalibration(true); // Enable auto-self-calibration
+    return true;
 }
 
 
@@ -105,6 +107,10 @@ bool SCD30::getCarbonDioxideConcentration(float* result) {
         log_e("readBuffer failed!\n");
         return false;
     }
+    if (!checkCrc(buf, 18)) {
+        log_e("CRC error!\n");
+        return false;
+    }
 
     co2U32 = (uint32_t)((((uint32_t)buf[0]) << 24) | (((uint32_t)buf[1]) << 16) |
                         (((uint32_t)buf[3]) << 8) | ((uint32_t)buf[4]));
@@ -125,7 +131,10 @@ bool SCD30::writeCommand(uint16_t command) {
     Wire.beginTransmission(devAddr);
     Wire.write(command >> 8); // MSB
     Wire.write(command & 0xff); // LSB
-    return (Wire.endTransmission() == ESP_OK);
+    uint32_t start = micros();
+    uint8_t result = Wire.endTransmission();
+    i2cStats.write(I2C_CO2, result, micros() - start);
+    return (result == ESP_OK);
 }
 
 bool SCD30::writeCommandWithArguments(uint16_t command, uint16_t arguments) {
@@ -142,13 +151,15 @@ bool SCD30::writeCommandWithArguments(uint16_t command, uint16_t arguments) {
 }
 
 uint16_t SCD30::readRegister(uint16_t address) {
-    uint8_t buf[2] = { 0 };
+    uint8_t buf[3] = { 0 };
 
    if (!writeCommand(address)) {
         log_e("writeCommand failed!\n");
         return 0;
     }
-    readBuffer(buf, 2);
+    if (!readBuffer(buf, 3) || !checkCrc(buf, 3)) {
+        return 0;
+    }
 
     return ((((uint16_t)buf[0]) << 8) | buf[1]);
 }
@@ -156,18 +167,23 @@ uint16_t SCD30::readRegister(uint16_t address) {
 bool SCD30::writeBuffer(uint8_t* data, uint8_t len) {
     Wire.beginTransmission(devAddr);
     Wire.write(data, len);
-    return (Wire.endTransmission() == ESP_OK);
+    uint32_t start = micros();
+    uint8_t result = Wire.endTransmission();
+    i2cStats.write(I2C_CO2, result, micros() - start);
+    return (result == ESP_OK);
 }
 
 bool SCD30::readBuffer(uint8_t* data, uint8_t len) {
     uint8_t i = 0;
 
+    uint32_t start = micros();
     size_t size = Wire.requestFrom(devAddr, len);
+    i2cStats.read(I2C_CO2, len, size, micros() - start);
     if (size == 0) {
         log_e("%s:%d requested %d bytes, got NO BYTES!\n", __FUNCTION__, __LINE__, len);
         return false;
     }
-    while (Wire.available()) {
+    while (Wire.available() && i < len) {
         data[i ++] = Wire.read();
     }
     return i == len;
@@ -192,4 +208,15 @@ uint8_t SCD30::calculateCrc(uint8_t data[], uint8_t len) {
     return crc;
 }
 
+// every word is followed by its CRC-8
+bool SCD30::checkCrc(uint8_t* data, uint8_t len) {
+    for (uint8_t i = 0; i + 2 < len; i += 3) {
+        if (calculateCrc(&data[i], 2) != data[i + 2]) {
+            i2cStats.crcError(I2C_CO2);
+            return false;
+        }
+    }
+    return true;
+}
+
 SCD30 scd30;
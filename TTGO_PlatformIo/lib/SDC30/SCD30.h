@@ -79,6 +79,7 @@ class SCD30 {
   private:
 
     uint8_t calculateCrc(uint8_t* data, uint8_t len);
+    bool checkCrc(uint8_t* data, uint8_t len);
 
     bool writeCommand(uint16_t command);
     bool writeCommandWithArguments(uint16_t command, uint16_t arguments);
@@ -0,0 +1,136 @@
+#include "vo2_session_block.h"
+#include "vo2_varint.h"
+
+#include <math.h>
+#include <string.h>
+
+static uint8_t *putU16(uint8_t *p, uint16_t v) {
+    *p++ = v;
+    *p++ = v >> 8;
+    return p;
+}
+
+static uint8_t *putU32(uint8_t *p, uint32_t v) {
+    p = putU16(p, v);
+    return putU16(p, v >> 16);
+}
+
+static uint8_t *putF32(uint8_t *p, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return putU32(p, bits);
+}
+
+// payload offsets of the raw blocks
+static const size_t COUNT = SESSION_BLOCK_HEADER;
+static const size_t KEYFRAME = SESSION_BLOCK_HEADER + 2;
+
+static uint16_t toU16(float value, float scale) {
+    float scaled = value * scale + 0.5f;
+    if (isnan(scaled) || scaled < 0)
+        return 0;
+    return scaled > 65535 ? 65535 : (uint16_t)scaled;
+}
+
+void sessionBlockStart(SessionBlock &block, uint8_t type, uint16_t seq) {
+    memset(block.data, 0, sizeof(block.data));
+    uint8_t *p = putU32(block.data, SESSION_MAGIC);
+    *p++ = SESSION_FORMAT;
+    *p++ = type;
+    putU16(p, seq);
+    block.count = 0;
+    // room for the count in front of the records
+    block.len = SESSION_BLOCK_HEADER + (type == SESSION_BLOCK_BREATHS ? 1 : 2);
+}
+
+void sessionBlockInfo(SessionBlock &block, const SessionInfo &info) {
+    uint8_t *p = &block.data[SESSION_BLOCK_HEADER];
+    *p++ = BREATH_SCHEMA;
+    p = putU16(p, SESSION_BLOCK_SIZE);
+    *p++ = BREATH_PAYLOAD_SIZE;
+    strncpy((char *)p, info.firmware, SESSION_FIRMWARE_SIZE);
+    p += SESSION_FIRMWARE_SIZE;
+    p = putU32(p, (uint32_t)info.startUs);
+    p = putU32(p, (uint32_t)(info.startUs >> 32));
+    p = putF32(p, info.correctionSensor);
+    p = putF32(p, info.weightkg);
+    p = putF32(p, info.initialO2);
+    p = putF32(p, info.initialCO2);
+    *p++ = info.sensorModel;
+    p = putF32(p, info.pressureScale);
+    p = putF32(p, info.pressureOffset);
+    block.len = p - block.data;
+}
+
+bool sessionBlockAddBreath(SessionBlock &block, const BreathRecord &rec) {
+    if (block.len + BREATH_PAYLOAD_SIZE > SESSION_BLOCK_END)
+        return false;
+    block.len += telemetryBreathPayload(rec, &block.data[block.len]);
+    block.count++;
+    return true;
+}
+
+bool sessionBlockAddPressure(SessionBlock &block, uint64_t timeUs, uint16_t code) {
+    uint32_t tick = timeUs / SESSION_TICK_US;
+    if (block.count == 0) {
+        uint8_t *p = putU32(&block.data[KEYFRAME], tick);
+        p = putU16(p, code);
+        block.len = p - block.data;
+        block.lastDt = 0;
+    } else {
+        if (block.len + 1 + 2 * VARINT_MAX_BYTES > SESSION_BLOCK_END || block.count == UINT16_MAX)
+            return false;
+        uint32_t dt = tick - block.lastTick;
+        int32_t ddt = (int32_t)(dt - block.lastDt);
+        int32_t dcode = (int32_t)code - block.last[0];
+        uint8_t *p = &block.data[block.len];
+        if (ddt >= -SESSION_NIBBLE_MAX && ddt <= SESSION_NIBBLE_MAX &&
+            dcode >= -SESSION_NIBBLE_MAX && dcode <= SESSION_NIBBLE_MAX) {
+            *p++ = zigzagEncode(ddt) << 4 | zigzagEncode(dcode);
+        } else {
+            *p++ = SESSION_NIBBLE_ESCAPE;
+            p = putSVarint(p, ddt);
+            p = putSVarint(p, dcode);
+        }
+        block.len = p - block.data;
+        block.lastDt = dt;
+    }
+    block.lastTick = tick;
+    block.last[0] = code;
+    block.count++;
+    return true;
+}
+
+bool sessionBlockAddGas(SessionBlock &block, uint64_t timeUs, float o2, float co2ppm) {
+    uint32_t tick = timeUs / SESSION_TICK_US;
+    uint16_t o2Code = toU16(o2, 1000);
+    uint16_t co2Code = toU16(co2ppm, 1);
+    if (block.count == 0) {
+        uint8_t *p = putU32(&block.data[KEYFRAME], tick);
+        p = putU16(p, o2Code);
+        p = putU16(p, co2Code);
+        block.len = p - block.data;
+    } else {
+        if (block.len + 3 * VARINT_MAX_BYTES > SESSION_BLOCK_END || block.count == UINT16_MAX)
+            return false;
+        uint8_t *p = &block.data[block.len];
+        p = putUVarint(p, tick - block.lastTick);
+        p = putSVarint(p, (int32_t)o2Code - block.last[0]);
+        p = putSVarint(p, (int32_t)co2Code - block.last[1]);
+        block.len = p - block.data;
+    }
+    block.lastTick = tick;
+    block.last[0] = o2Code;
+    block.last[1] = co2Code;
+    block.count++;
+    return true;
+}
+
+void sessionBlockFinish(SessionBlock &block) {
+    uint8_t type = block.data[5];
+    if (type == SESSION_BLOCK_BREATHS)
+        block.data[COUNT] = block.count;
+    else if (type != SESSION_BLOCK_INFO)
+        putU16(&block.data[COUNT], block.count);
+    putU16(&block.data[SESSION_BLOCK_END], telemetryCrc16(block.data, SESSION_BLOCK_END));
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+// Fixed size blocks of the session files recorded on the device.
+//
+// A session file is a sequence of SESSION_BLOCK_SIZE blocks, each one
+// self-contained so it can be checked and decoded on its own:
+//   u32 magic "VO2S", u8 SESSION_FORMAT, u8 sessionBlockTypes,
+//   u16 block seq, payload ..., zero padding, u16 crc
+// The CRC is CRC-16/CCITT-FALSE over everything before it.
+//
+// Payloads:
+//   info:     u8 BREATH_SCHEMA, u16 SESSION_BLOCK_SIZE, u8 record size,
+//             char firmware[24], u64 start (esp_timer us),
+//             f32 correctionSensor, f32 weightkg, f32 initialO2, f32 initialCO2,
+//             u8 pressure sensor model, f32 scale, f32 offset
+//             (Pa = (code - 1024) * scale - offset)
+//   breaths:  u8 count, count * BREATH_PAYLOAD_SIZE (see vo2_telemetry.h)
+//   pressure: u16 count, u32 tick0, u16 code0, then for every further sample
+//             dt - previous dt and the code delta, both zigzag mapped: as
+//             two nibbles (dt high) in one byte if both are within
+//             +-SESSION_NIBBLE_MAX, else SESSION_NIBBLE_ESCAPE and two svarints
+//   gas:      u16 count, u32 tick0, u16 o2 (0.001 %), u16 co2 (ppm), then
+//             for every further sample uvarint(dt), svarint(o2 delta),
+//             svarint(co2 delta)
+// Times are in SESSION_TICK_US ticks of the esp_timer clock. Every raw
+// block starts with absolute values (a keyframe), so a reader can seek to
+// any block. At a steady sample rate dt hardly changes and the code only
+// moves a few counts between samples, so most pressure samples take 1 byte.
+//
+// The matching reader is read_session_file() in tools/serial_file_parser.py.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vo2_telemetry.h"
+
+#define SESSION_MAGIC 0x53324F56 // "VO2S" in file order
+#define SESSION_FORMAT 1
+#define SESSION_BLOCK_SIZE 512
+#define SESSION_BLOCK_HEADER 8
+#define SESSION_BLOCK_END (SESSION_BLOCK_SIZE - 2) // crc
+#define SESSION_RECORDS_PER_BLOCK ((SESSION_BLOCK_END - SESSION_BLOCK_HEADER - 1) / BREATH_PAYLOAD_SIZE)
+#define SESSION_FIRMWARE_SIZE 24
+#define SESSION_TICK_US 100
+#define SESSION_NIBBLE_MAX 7       // zigzag 0..14 in a nibble
+#define SESSION_NIBBLE_ESCAPE 0xF0 // high nibble 15: varints follow
+
+enum sessionBlockTypes
+{
+    SESSION_BLOCK_INFO = 0x00,     // first block of every file
+    SESSION_BLOCK_BREATHS = 0x01,
+    SESSION_BLOCK_PRESSURE = 0x02, // raw pressure codes
+    SESSION_BLOCK_GAS = 0x03,      // raw O2 / CO2 readings
+};
+
+struct SessionInfo
+{
+    const char *firmware;
+    uint64_t startUs;
+    float correctionSensor;
+    float weightkg;
+    float initialO2;  // % O2 of ambient air at the start
+    float initialCO2; // ppm CO2 of ambient air at the start
+    uint8_t sensorModel;
+    float pressureScale;
+    float pressureOffset;
+};
+
+struct SessionBlock
+{
+    uint8_t data[SESSION_BLOCK_SIZE];
+    uint16_t len;   // bytes used
+    uint16_t count; // records or samples
+    uint32_t lastTick;
+    uint32_t lastDt;
+    int32_t last[2]; // previous values, for the deltas
+};
+
+void sessionBlockStart(SessionBlock &block, uint8_t type, uint16_t seq);
+void sessionBlockInfo(SessionBlock &block, const SessionInfo &info);
+// the add functions return false if the block is full, finish it and
+// add to a new one
+bool sessionBlockAddBreath(SessionBlock &block, const BreathRecord &rec);
+bool sessionBlockAddPressure(SessionBlock &block, uint64_t timeUs, uint16_t code);
+bool sessionBlockAddGas(SessionBlock &block, uint64_t timeUs, float o2, float co2ppm);
+// writes the count and the CRC, data is then ready to be stored
+void sessionBlockFinish(SessionBlock &block);
@@ -0,0 +1,240 @@
+#include "vo2_telemetry.h"
+#include "vo2_varint.h"
+
+#include <string.h>
+
+static uint8_t *putU8(uint8_t *p, uint8_t v) {
+    *p++ = v;
+    return p;
+}
+
+static uint8_t *putU16(uint8_t *p, uint16_t v) {
+    *p++ = v;
+    *p++ = v >> 8;
+    return p;
+}
+
+static uint8_t *putU32(uint8_t *p, uint32_t v) {
+    *p++ = v;
+    *p++ = v >> 8;
+    *p++ = v >> 16;
+    *p++ = v >> 24;
+    return p;
+}
+
+static uint8_t *putU64(uint8_t *p, uint64_t v) {
+    p = putU32(p, (uint32_t)v);
+    return putU32(p, (uint32_t)(v >> 32));
+}
+
+static uint8_t *putF32(uint8_t *p, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return putU32(p, bits);
+}
+
+uint16_t telemetryCrc16(const uint8_t *data, size_t len, uint16_t crc) {
+    // CRC-16/CCITT-FALSE, polynomial 0x1021
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            if (crc & 0x8000)
+                crc = (crc << 1) ^ 0x1021;
+            else
+                crc = crc << 1;
+        }
+    }
+    return crc;
+}
+
+size_t cobsEncode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t codeIdx = 0; // position of the pending code byte
+    size_t outIdx = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == 0) {
+            out[codeIdx] = code;
+            codeIdx = outIdx++;
+            code = 1;
+        } else {
+            out[outIdx++] = in[i];
+            code++;
+            if (code == 0xFF) {
+                out[codeIdx] = code;
+                codeIdx = outIdx++;
+                code = 1;
+            }
+        }
+    }
+    out[codeIdx] = code;
+    return outIdx;
+}
+
+size_t telemetryFrame(uint8_t type, const uint8_t *payload, size_t len, uint8_t *out) {
+    if (len > TELEMETRY_MAX_PAYLOAD)
+        return 0;
+
+    uint8_t raw[TELEMETRY_MAX_PAYLOAD + 4];
+    raw[0] = TELEMETRY_VERSION;
+    raw[1] = type;
+    memcpy(&raw[2], payload, len);
+    uint16_t crc = telemetryCrc16(raw, len + 2);
+    raw[len + 2] = crc & 0xff;
+    raw[len + 3] = crc >> 8;
+
+    out[0] = 0x00; // leading delimiter resyncs the receiver
+    size_t n = cobsEncode(raw, len + 4, &out[1]);
+    out[n + 1] = 0x00;
+    return n + 2;
+}
+
+size_t telemetryBreathPayload(const BreathRecord &rec, uint8_t *out) {
+    uint8_t *p = out;
+    p = putU8(p, BREATH_SCHEMA);
+    p = putU32(p, rec.seq);
+    p = putU64(p, rec.timeUs);
+    p = putU32(p, rec.inspirationMs);
+    p = putU32(p, rec.expirationMs);
+    p = putU8(p, rec.flags);
+    p = putF32(p, rec.volumeExp);
+    p = putF32(p, rec.VE);
+    p = putF32(p, rec.VEmean);
+    p = putF32(p, rec.freqVE);
+    p = putF32(p, rec.freqVEmean);
+    p = putF32(p, rec.vo2Total);
+    p = putF32(p, rec.vo2Rel);
+    p = putF32(p, rec.deltaO2_frac);
+    p = putF32(p, rec.vo2TotalIn);
+    p = putF32(p, rec.vo2TotalOut);
+    p = putF32(p, rec.vco2Total);
+    p = putF32(p, rec.vco2Rel);
+    p = putF32(p, rec.respq);
+    return p - out;
+}
+
+size_t telemetryBreathFrame(const BreathRecord &rec, uint8_t *out) {
+    uint8_t payload[BREATH_PAYLOAD_SIZE];
+    return telemetryFrame(TELEMETRY_BREATH, payload, telemetryBreathPayload(rec, payload), out);
+}
+
+size_t telemetryRawSampleFrame(const RawSampleRecord &rec, uint8_t *out) {
+    uint8_t payload[16];
+    uint8_t *p = payload;
+    p = putU32(p, rec.timeMs);
+    p = putF32(p, rec.pressure);
+    p = putF32(p, rec.o2);
+    p = putF32(p, rec.co2ppm);
+    return telemetryFrame(TELEMETRY_RAW_SAMPLE, payload, p - payload, out);
+}
+
+size_t telemetryEventFrame(const EventRecord &rec, uint8_t *out) {
+    uint8_t payload[9];
+    uint8_t *p = payload;
+    p = putU8(p, rec.event);
+    p = putU32(p, rec.timeMs);
+    p = putU32(p, rec.durationMs);
+    return telemetryFrame(TELEMETRY_EVENT, payload, p - payload, out);
+}
+
+size_t telemetryStreamInfoFrame(const StreamInfoRecord &rec, uint8_t *out) {
+    uint8_t payload[9];
+    uint8_t *p = payload;
+    p = putU8(p, rec.sensorModel);
+    p = putF32(p, rec.scale);
+    p = putF32(p, rec.offset);
+    return telemetryFrame(TELEMETRY_STREAM_INFO, payload, p - payload, out);
+}
+
+size_t telemetryGasSampleFrame(const GasSampleRecord &rec, uint8_t *out) {
+    uint8_t payload[12];
+    uint8_t *p = payload;
+    p = putU32(p, rec.timeUs);
+    p = putF32(p, rec.o2);
+    p = putF32(p, rec.co2ppm);
+    return telemetryFrame(TELEMETRY_GAS_SAMPLE, payload, p - payload, out);
+}
+
+size_t telemetrySampleTimingFrame(const SampleTimingRecord &rec, uint8_t *out) {
+    uint8_t payload[SAMPLE_TIMING_PAYLOAD_SIZE];
+    uint8_t *p = payload;
+    p = putU32(p, rec.timeMs);
+    p = putU32(p, rec.count);
+    p = putF32(p, rec.meanUs);
+    p = putF32(p, rec.stdUs);
+    p = putU32(p, rec.p50Us);
+    p = putU32(p, rec.p99Us);
+    p = putU32(p, rec.maxUs);
+    p = putU32(p, rec.gaps);
+    p = putU32(p, rec.totalGaps);
+    p = putU32(p, rec.gapUs);
+    return telemetryFrame(TELEMETRY_SAMPLE_TIMING, payload, p - payload, out);
+}
+
+// at most max bytes of text, no terminator
+static uint8_t *putText(uint8_t *p, const char *text, size_t max) {
+    size_t len = strnlen(text, max);
+    memcpy(p, text, len);
+    return p + len;
+}
+
+size_t telemetryReplyFrame(uint8_t status, const char *text, uint8_t *out) {
+    uint8_t payload[1 + REPLY_MAX_TEXT];
+    uint8_t *p = payload;
+    p = putU8(p, status);
+    p = putText(p, text, REPLY_MAX_TEXT);
+    return telemetryFrame(TELEMETRY_REPLY, payload, p - payload, out);
+}
+
+size_t telemetryFileInfoFrame(uint32_t size, uint8_t flags, const char *name, uint8_t *out) {
+    uint8_t payload[5 + FILE_NAME_MAX];
+    uint8_t *p = payload;
+    p = putU32(p, size);
+    p = putU8(p, flags);
+    p = putText(p, name, FILE_NAME_MAX);
+    return telemetryFrame(TELEMETRY_FILE_INFO, payload, p - payload, out);
+}
+
+size_t telemetryFileChunkFrame(uint32_t offset, const uint8_t *data, size_t len, uint8_t *out) {
+    if (len > FILE_CHUNK_MAX)
+        return 0;
+    uint8_t payload[4 + FILE_CHUNK_MAX];
+    uint8_t *p = putU32(payload, offset);
+    memcpy(p, data, len);
+    return telemetryFrame(TELEMETRY_FILE_CHUNK, payload, 4 + len, out);
+}
+
+void pressureBatchReset(PressureBatch &batch) {
+    batch.count = 0;
+    batch.len = PRESSURE_BATCH_HEADER;
+}
+
+bool pressureBatchAdd(PressureBatch &batch, uint32_t timeUs, uint16_t code) {
+    if (batch.count == 0) {
+        uint8_t *p = batch.payload;
+        p = putU32(p, timeUs);
+        p = putU16(p, code);
+        batch.len = PRESSURE_BATCH_HEADER;
+    } else {
+        if (batch.count >= PRESSURE_BATCH_MAX_SAMPLES ||
+            TELEMETRY_MAX_PAYLOAD - batch.len < 2 * VARINT_MAX_BYTES)
+            return false;
+        uint8_t *p = &batch.payload[batch.len];
+        p = putUVarint(p, timeUs - batch.lastUs);
+        p = putSVarint(p, (int32_t)code - batch.lastCode);
+        batch.len = p - batch.payload;
+    }
+    batch.lastUs = timeUs;
+    batch.lastCode = code;
+    batch.count++;
+    return true;
+}
+
+size_t telemetryPressureBatchFrame(PressureBatch &batch, uint8_t *out) {
+    if (batch.count == 0)
+        return 0;
+    batch.payload[6] = batch.count;
+    size_t n = telemetryFrame(TELEMETRY_PRESSURE_BATCH, batch.payload, batch.len, out);
+    pressureBatchReset(batch);
+    return n;
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+// Binary telemetry frames for the serial link.
+//
+// Every record is sent as one frame:
+//   [version][type][payload ...][crc16 lo][crc16 hi]
+// The frame is COBS encoded and delimited by 0x00 on both sides, so a
+// receiver can resynchronise after line noise or interleaved ESP log text.
+// CRC is CRC-16/CCITT-FALSE over version, type and payload.
+// All multi-byte fields are little-endian, floats are IEEE754 single.
+//
+// The matching decoder lives in tools/serial_file_parser.py.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TELEMETRY_VERSION 1
+
+#define TELEMETRY_MAX_PAYLOAD 255
+// worst case size on the wire of a frame carrying n payload bytes
+#define TELEMETRY_FRAME_SIZE(n) ((n) + 4 + ((n) + 4) / 254 + 1 + 2)
+#define TELEMETRY_MAX_FRAME TELEMETRY_FRAME_SIZE(TELEMETRY_MAX_PAYLOAD)
+
+enum telemetryRecordTypes
+{
+    TELEMETRY_BREATH_V0 = 0x01,  // superseded by TELEMETRY_BREATH, host decode only
+    TELEMETRY_RAW_SAMPLE = 0x02, // single pressure / O2 / CO2 sample
+    TELEMETRY_EVENT = 0x03,      // ventilation state change, host decode only
+    TELEMETRY_STREAM_INFO = 0x04,    // raw stream: pressure code scaling
+    TELEMETRY_PRESSURE_BATCH = 0x05, // raw stream: delta encoded pressure codes
+    TELEMETRY_GAS_SAMPLE = 0x06,     // raw stream: single O2 / CO2 sample
+    TELEMETRY_BREATH = 0x07,         // everything known about one breath
+    TELEMETRY_REPLY = 0x08,          // serial command finished
+    TELEMETRY_FILE_INFO = 0x09,      // one file of a listing
+    TELEMETRY_FILE_CHUNK = 0x0A,     // part of a file being downloaded
+    TELEMETRY_SAMPLE_TIMING = 0x0B,  // pressure sample intervals of the last window
+};
+
+enum telemetryReplyStatus
+{
+    REPLY_OK = 0,
+    REPLY_ERROR = 1,       // command failed, see the text
+    REPLY_UNKNOWN = 2,     // no such command
+    REPLY_BUSY = 3,        // a transfer is still running
+};
+
+enum telemetryFileFlags
+{
+    FILE_FLAG_RECORDING = 0x01, // the session being recorded right now
+};
+
+enum telemetryEvents
+{
+    TELEMETRY_EVENT_INSPIRATION = 1,
+    TELEMETRY_EVENT_EXPIRATION_DONE = 2,
+};
+
+// Layout of TELEMETRY_BREATH, bump when fields change
+#define BREATH_SCHEMA 1
+
+enum breathFlags
+{
+    BREATH_FLAG_DEMO = 0x01,    // values are from DEMO mode
+    BREATH_FLAG_DROPPED = 0x02, // telemetry was lost since the previous breath
+};
+
+// One record per breath, replaces the event + breath pair.
+// payload: u8 schema, u32 seq, u64 timeUs, u32 inspirationMs,
+// u32 expirationMs, u8 flags + 13 floats = 74 bytes
+#define BREATH_PAYLOAD_SIZE 74
+struct BreathRecord
+{
+    uint32_t seq;           // counts breaths since power on
+    uint64_t timeUs;        // end of expiration, esp_timer clock
+    uint32_t inspirationMs; // pause / inspiration before this exhale
+    uint32_t expirationMs;
+    uint8_t flags;          // breathFlags
+    float volumeExp;
+    float VE;
+    float VEmean;
+    float freqVE;
+    float freqVEmean;
+    float vo2Total;
+    float vo2Rel;
+    float deltaO2_frac;
+    float vo2TotalIn;
+    float vo2TotalOut;
+    float vco2Total;
+    float vco2Rel;
+    float respq;
+};
+
+// payload: u32 timeMs + 3 floats = 16 bytes
+struct RawSampleRecord
+{
+    uint32_t timeMs;
+    float pressure; // Pa, as returned by the D6F-PH
+    float o2;       // % O2
+    float co2ppm;   // ppm CO2
+};
+
+// payload: u8 event + u32 timeMs + u32 durationMs = 9 bytes
+struct EventRecord
+{
+    uint8_t event;
+    uint32_t timeMs;
+    uint32_t durationMs;
+};
+
+// payload: u8 sensorModel + f32 scale + f32 offset = 9 bytes
+// Pa = (code - 1024) * scale - offset
+struct StreamInfoRecord
+{
+    uint8_t sensorModel;
+    float scale;
+    float offset;
+};
+
+// payload: u32 timeUs + f32 o2 + f32 co2ppm = 12 bytes
+struct GasSampleRecord
+{
+    uint32_t timeUs;
+    float o2;
+    float co2ppm;
+};
+
+// Intervals between pressure samples since the previous record (about 30 s).
+// payload: u32 timeMs, u32 count, f32 meanUs, f32 stdUs, u32 p50Us,
+// u32 p99Us, u32 maxUs, u32 gaps, u32 totalGaps, u32 gapUs = 40 bytes
+#define SAMPLE_TIMING_PAYLOAD_SIZE 40
+struct SampleTimingRecord
+{
+    uint32_t timeMs;    // end of the window, ms since boot
+    uint32_t count;     // intervals in the window
+    float meanUs;
+    float stdUs;
+    uint32_t p50Us;     // from a log2 histogram, within a factor of two
+    uint32_t p99Us;
+    uint32_t maxUs;
+    uint32_t gaps;      // intervals over gapUs in the window
+    uint32_t totalGaps; // since power on
+    uint32_t gapUs;     // gap threshold
+};
+
+// payload: u8 telemetryReplyStatus + text (no NUL)
+#define REPLY_MAX_TEXT 64
+
+// payload: u32 size + u8 telemetryFileFlags + name (no NUL)
+#define FILE_NAME_MAX 31
+
+// payload: u32 offset + data; the frame CRC protects the chunk
+#define FILE_CHUNK_MAX 240
+
+// Pressure codes as read from the D6F-PH, collected into one frame.
+// payload: u32 t0Us, u16 code0, u8 count, then for every further sample
+// uvarint(dt us since previous sample) and svarint(code delta).
+#define PRESSURE_BATCH_HEADER 7
+#define PRESSURE_BATCH_MAX_SAMPLES 32
+struct PressureBatch
+{
+    uint32_t lastUs;
+    uint16_t lastCode;
+    uint8_t count;
+    uint8_t len;
+    uint8_t payload[TELEMETRY_MAX_PAYLOAD];
+};
+
+uint16_t telemetryCrc16(const uint8_t *data, size_t len, uint16_t crc = 0xFFFF);
+
+// COBS encode len bytes, returns encoded length (at most len + len / 254 + 1)
+size_t cobsEncode(const uint8_t *in, size_t len, uint8_t *out);
+
+// Build a complete delimited frame into out, returns number of bytes to send
+// or 0 if the payload is too large. out must hold TELEMETRY_FRAME_SIZE(len).
+size_t telemetryFrame(uint8_t type, const uint8_t *payload, size_t len, uint8_t *out);
+
+size_t telemetryBreathFrame(const BreathRecord &rec, uint8_t *out);
+// just the BREATH_PAYLOAD_SIZE payload, e.g. for the session recorder
+size_t telemetryBreathPayload(const BreathRecord &rec, uint8_t *out);
+size_t telemetryRawSampleFrame(const RawSampleRecord &rec, uint8_t *out);
+size_t telemetryEventFrame(const EventRecord &rec, uint8_t *out);
+size_t telemetryStreamInfoFrame(const StreamInfoRecord &rec, uint8_t *out);
+size_t telemetryGasSampleFrame(const GasSampleRecord &rec, uint8_t *out);
+size_t telemetrySampleTimingFrame(const SampleTimingRecord &rec, uint8_t *out);
+size_t telemetryReplyFrame(uint8_t status, const char *text, uint8_t *out);
+size_t telemetryFileInfoFrame(uint32_t size, uint8_t flags, const char *name, uint8_t *out);
+size_t telemetryFileChunkFrame(uint32_t offset, const uint8_t *data, size_t len, uint8_t *out);
+
+void pressureBatchReset(PressureBatch &batch);
+// false if the batch is full, send it and add the sample again
+bool pressureBatchAdd(PressureBatch &batch, uint32_t timeUs, uint16_t code);
+// frames the batch and resets it, returns 0 if it was empty
+size_t telemetryPressureBatchFrame(PressureBatch &batch, uint8_t *out);
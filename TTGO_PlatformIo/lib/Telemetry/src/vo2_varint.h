@@ -0,0 +1,55 @@
+#pragma once
+
+// Variable length integer helpers for delta encoded telemetry.
+//
+// Unsigned values use LEB128: 7 bits per byte, low bits first, bit 7 set
+// on every byte except the last. Signed deltas are zigzag mapped first so
+// small negative values stay short (0, -1, 1, -2 -> 0, 1, 2, 3).
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VARINT_MAX_BYTES 5 // a full uint32_t
+
+static inline uint32_t zigzagEncode(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t zigzagDecode(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline uint8_t *putUVarint(uint8_t *p, uint32_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline uint8_t *putSVarint(uint8_t *p, int32_t v) {
+    return putUVarint(p, zigzagEncode(v));
+}
+
+// returns pointer past the value, or nullptr if it runs past end
+static inline const uint8_t *getUVarint(const uint8_t *p, const uint8_t *end, uint32_t *v) {
+    uint32_t result = 0;
+    for (uint8_t shift = 0; shift < 7 * VARINT_MAX_BYTES && p < end; shift += 7) {
+        uint8_t b = *p++;
+        result |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = result;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+static inline const uint8_t *getSVarint(const uint8_t *p, const uint8_t *end, int32_t *v) {
+    uint32_t u;
+    p = getUVarint(p, end, &u);
+    if (p)
+        *v = zigzagDecode(u);
+    return p;
+}
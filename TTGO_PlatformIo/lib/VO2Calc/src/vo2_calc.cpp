@@ -0,0 +1,160 @@
+#include "vo2_calc.h"
+
+#include <math.h>
+
+float vo2VenturiArea(int diameterMm) {
+    switch (diameterMm) {
+    case 20:
+        return 0.000314;
+    case 19:
+        return 0.000284;
+    case 18:
+        return 0.000254;
+    default:
+        return 0.000201; // 16mm
+    }
+}
+
+float vo2CodeToPressure(uint16_t code, float scale, float offset) {
+    return (float)((code - 1024.00) * scale) - offset;
+}
+
+// massflow kg/s = sqrt((2 * rho * Δp) / (1/A2² - 1/A1²)) (A2 < A1)
+float vo2MassFlow(float pressurePa, float rho, float area1, float area2) {
+    return sqrt((2 * rho * fabs(pressurePa)) / ((1 / (pow(area2, 2))) - (1 / (pow(area1, 2)))));
+}
+
+void VO2Calc::begin(uint64_t nowUs) {
+    uint32_t nowMs = (uint32_t)(nowUs / 1000);
+    TimerVolCalc = nowMs; // timer for the volume (VE) integral function
+    TimerVO2calc = nowMs; // timer between VO2max calculations
+}
+
+void VO2Calc::flowSample(uint64_t nowUs, float pressureraw, float correctionSensor) {
+    uint32_t nowMs = (uint32_t)(nowUs / 1000);
+    pressure = pressure / 2 + pressureraw / 2;
+    if (pressure > VO2_SENSOR_LIMIT_PA)
+        sensorLimitBreath = true;
+    if (pressure < 0)
+        pressure = 0;
+
+    if (pressure < pressThreshold && readVE == 1) {
+        if (ventilationState == EXPIRATION) {
+            expirationTime = nowMs - TimerExpiration;
+            breathEndUs = nowUs;
+            ventilationState = EXPIRATION_DONE;
+        }
+        // read volumeVE
+        readVE = 0;
+        // DurationVE is the time of one breath (inspiration + expiration) in ms, calculated from the time between two expirations
+        DurationVE = nowMs - TimerVE;
+        TimerVE = nowMs; // start timerVE
+        // volumeExp is the expiratory volume of one breath, calculated from the integral of flow (volFlow) over expiration time (TimerExpiration)
+        volumeExp = volumeTotal;
+        volumeTotal = 0; // resets volume for next breath
+        // volumeVE is the minute ventilation (VE) in L/min, calculated from the expiratory volume and duration of one breath (DurationVE)
+        volumeVE = volumeExp / (DurationVE / 1000) * 60;
+        volumeVEmean = (volumeVEmean * 3 / 4) + (volumeVE / 4); // running mean of one minute volume (VE)
+        if (volumeVEmean < 1)
+            volumeVEmean = 0;
+        freqVE = 60000 / DurationVE;
+        if (volumeVE < 0.1)
+            freqVE = 0;
+        freqVEmean = (freqVEmean * 3 / 4) + (freqVE / 4);
+        if (freqVEmean < 1)
+            freqVEmean = 0;
+    }
+
+    if (pressure >= pressThreshold) { // ongoing integral of volumeTotal
+        if (ventilationState == INSPIRATION) {
+            inspirationTime = nowMs - TimerInspiration;
+            TimerExpiration = nowMs;
+        }
+        ventilationState = EXPIRATION;
+
+        if (volumeTotal > 0.4)
+            readVE = 1;
+        massFlow = vo2MassFlow(pressure, rho, area_1, area_2); // Bernoulli equation
+        // volFlow = massFlow / rho; // volumetric flow of air dm3/s (liter/s)
+        volFlow = 1000 * massFlow * correctionSensor / rho; // volumetric flow of air and correction of sensor calculations
+        volumeTotal = volFlow * ((nowMs - TimerVolCalc) / 1000) + volumeTotal;
+        volumeTotal2 = volFlow * ((nowMs - TimerVolCalc) / 1000) + volumeTotal2;
+    } else if ((volumeTotal2 - volumeTotalOld) > 200) { // calculate actual expiratory volume
+        expiratVol = (volumeTotal2 - volumeTotalOld);
+        volumeTotalOld = volumeTotal2;
+    }
+    TimerVolCalc = nowMs; // part of the integral function to keep calculation volume over time
+}
+
+void VO2Calc::startInspiration(uint64_t nowUs) {
+    uint32_t nowMs = (uint32_t)(nowUs / 1000);
+    ventilationState = INSPIRATION;
+    TimerVO2diff = nowMs - TimerVO2calc;
+    TimerVO2calc = nowMs; // resets the timer
+    TimerInspiration = nowMs;
+}
+
+void VO2Calc::o2Sample(float o2) {
+    lastO2 = o2;
+    if (lastO2 > initialO2)
+        initialO2 = lastO2; // correction for drift of O2 sensor
+}
+
+void VO2Calc::co2Sample(float ppm, float tempC, float weightkg) {
+    co2ppm = ppm;
+    if (initialCO2 == 0)
+        initialCO2 = co2ppm;
+    // PPM is already a volume (mole) fraction for gases. To get the percentage, divide by 10000.
+    co2perc = co2ppm / 10000;
+    co2temp = tempC;
+
+    float co2percdiff = (co2ppm - initialCO2) / 10000; // calculates difference to initial CO2
+    if (co2percdiff < 0)
+        co2percdiff = 0;
+
+    // VCO2 calculation is based on changes in CO2 concentration (difference to baseline)
+    vco2Total = 1000 * volumeVEmean * rhoBTPS / rhoSTPD * co2percdiff; // = vco2 in ml/min (* co2% * 10 for L in ml)
+    vco2Rel = vco2Total / weightkg;                                    // correction for wt
+    respq = (vco2Total * 44) / (vo2Total * 32);                        // respiratory quotient based on molarity
+    // CO2: 44g/mol, O2: 32 g/mol
+    if (isnan(respq))
+        respq = 0; // correction for errors/div by 0
+    if (respq > 1.5)
+        respq = 0;
+}
+
+void VO2Calc::airDensity() {
+    TempC = co2temp;                             // temperature from the CO2 sensor
+    rho = PresPa / (co2temp + 273.15) / 287.058; // calculation of air density
+    rhoBTPS = PresPa / (35 + 273.15) / 292.9;    // density at BTPS: 35°C, 95% humidity
+}
+
+void VO2Calc::breathCalc(float weightkg) {
+    airDensity(); // calculates air density
+
+    deltaO2_frac = (initialO2 - lastO2) / 100; // calculated level of consumed O2 based on Oxygen level loss
+    if (deltaO2_frac < 0)
+        deltaO2_frac = 0; // correction for sensor drift
+
+    vo2TotalIn = 1000 * volumeVEmean * rhoBTPS / rhoSTPD * initialO2 / 100; // = vo2 in ml/min
+    vo2TotalOut = 1000 * volumeVEmean * rhoBTPS / rhoSTPD * lastO2 / 100;   // = vo2 in ml/min
+    vo2Total = 1000 * volumeVEmean * deltaO2_frac * rhoBTPS / rhoSTPD;      // = volume in ml/min * deltaO2_frac% * rhoBTPS / rhoSTPD
+    vo2Rel = vo2Total / weightkg;                                           // vo2Rel with correction for weight
+    if (vo2Rel > vo2MaxMax)
+        vo2MaxMax = vo2Rel;
+
+    vo2Cal = vo2Total / 1000 * 4.86;                     // vo2Rel liters/min * 4.86 Kcal/liter = kcal/min
+    calTotal = calTotal + vo2Cal * TimerVO2diff / 60000; // integral function of calories
+    vo2CalH = vo2Cal * 60.0;                             // actual calories/min. * 60 min. = cal./hour
+    vo2CalDay = vo2Cal * 1440.0;                         // actual calories/min. * 1440 min. = cal./day
+    if (vo2CalDay > vo2CalDayMax)
+        vo2CalDayMax = vo2CalDay;
+}
+
+BreathRecord VO2Calc::breathRecord(uint32_t seq, uint8_t flags) const {
+    BreathRecord rec = {seq, breathEndUs, (uint32_t)inspirationTime, (uint32_t)expirationTime, flags,
+                        volumeExp, volumeVE, volumeVEmean, freqVE, freqVEmean,
+                        vo2Total, vo2Rel, deltaO2_frac, vo2TotalIn, vo2TotalOut,
+                        vco2Total, vco2Rel, respq};
+    return rec;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+// Breath volume and gas exchange calculations of the mini firmware.
+//
+// No hardware access, so the same code runs on the device and in the
+// native replay tool (tools/replay/vo2_replay.cpp). The caller feeds it the
+// sensor readings in the order main_mini.cpp's loop() takes them:
+//   flowSample()       every differential pressure reading of the venturi
+//   startInspiration() once flowSample() has left EXPIRATION_DONE
+//   o2Sample()         every O2 reading
+//   co2Sample()        every new CO2 reading
+//   breathCalc()       after the O2 and CO2 readings following a breath
+// Times are esp_timer microseconds; the millisecond timers behave like the
+// millis() based ones the firmware always used, float included.
+// Members keep the names of the globals they replaced.
+
+#include <stdint.h>
+#include "vo2_telemetry.h"
+
+#define VO2_SENSOR_LIMIT_PA 266    // upper end of the D6F-PH0025 range
+#define VO2_PRESS_THRESHOLD 0.1    // Pa, below this there is no flow
+#define VO2_AREA_26MM 0.000531     // venturi inlet
+
+enum ventilationStates
+{
+    WAITING_PRESSURE,
+    INSPIRATION,
+    EXPIRATION,
+    EXPIRATION_DONE
+};
+
+// venturi throat area in m² for the printed case diameter (16, 18, 19, 20 mm)
+float vo2VenturiArea(int diameterMm);
+// D6F-PH output code to Pa, like Omron_D6FPH::codeToPressure()
+float vo2CodeToPressure(uint16_t code, float scale, float offset);
+// kg/s through the venturi for a pressure difference in Pa (Bernoulli)
+float vo2MassFlow(float pressurePa, float rho, float area1, float area2);
+
+class VO2Calc
+{
+public:
+    VO2Calc(float area1, float area2) : area_1(area1), area_2(area2) {}
+
+    void begin(uint64_t nowUs);
+    // pressureRaw in Pa, NAN if the sensor read failed
+    void flowSample(uint64_t nowUs, float pressureRaw, float correctionSensor);
+    void startInspiration(uint64_t nowUs);
+    void o2Sample(float o2);
+    void co2Sample(float ppm, float tempC, float weightkg);
+    void breathCalc(float weightkg);
+    BreathRecord breathRecord(uint32_t seq, uint8_t flags) const;
+
+    // venturi, set at construction
+    float area_1;
+    float area_2;
+    float pressThreshold = VO2_PRESS_THRESHOLD;
+
+    // air density
+    float rho = 1.225;     // ATP conditions: density based on ambient conditions, dry air
+    float rhoSTPD = 1.292; // STPD conditions: density at 0°C, MSL, 1013.25 hPa, dry air
+    float rhoBTPS = 1.123; // BTPS conditions: density at ambient  pressure, 35°C, 95% humidity
+    float TempC = 15.0;    // air temperature in Celsius, from the CO2 sensor
+    float PresPa = 101325; // uncorrected (absolute) barometric pressure
+
+    // flow and volume
+    int ventilationState = WAITING_PRESSURE;
+    float pressure = 0.0; // differential pressure of the venturi nozzle, filtered
+    float massFlow = 0;
+    float volFlow = 0;
+    float volumeTotal = 0; // volume of the breath so far
+    float volumeTotal2 = 0.0;
+    float volumeTotalOld = 0.0;
+    float expiratVol = 0.0; // last expiratory volume in L
+    float volumeVE = 0.0;
+    float volumeVEmean = 0.0;
+    float volumeExp = 0.0;
+    float freqVE = 0.0;     // ventilation frequency
+    float freqVEmean = 0.0; // mean ventilation frequency
+    int readVE = 0;
+    bool sensorLimitBreath = false; // flow sensor was over range during this breath
+
+    // breath timing
+    float TimerVolCalc = 0.0;
+    float TimerInspiration = 0.0;
+    float TimerExpiration = 0.0;
+    float TimerVE = 0.0;
+    float DurationVE = 0.0;
+    float TimerVO2calc = 0.0;
+    float TimerVO2diff = 0.0;    // used for integral of calories
+    float inspirationTime = 0.0; // ms from end of the last expiration to the start of this one
+    float expirationTime = 0.0;  // ms of the last expiration
+    uint64_t breathEndUs = 0;    // time of the last end of expiration
+
+    // gas exchange
+    float lastO2 = 0;
+    float initialO2 = 0;
+    float deltaO2_frac = 0;
+    float co2ppm = 0.0;     // CO2 sensor in ppm
+    float co2perc = 0.0;    // = CO2ppm /10000
+    float co2temp = 0.0;    // temperature CO2 sensor
+    float initialCO2 = 0.0; // initial value of CO2 in ppm
+    float vo2Total = 0.0;   // value of total vo2Max/min
+    float vo2TotalIn = 0.0;
+    float vo2TotalOut = 0.0;
+    float vo2Rel = 0;       // value of vo2rel ml/min/kg
+    float vo2MaxMax = 0;    // Best value of vo2 max for whole time machine is on
+    float vco2Total = 0.0;
+    float vco2Rel = 0.0;
+    float respq = 0.0; // respiratory quotient in mol VCO2 / mol VO2
+    float vo2Cal = 0;
+    float calTotal = 0;
+    float vo2CalH = 0;        // calories per hour
+    float vo2CalDay = 0.0;    // calories per day
+    float vo2CalDayMax = 0.0; // highest value of calories per day
+
+private:
+    void airDensity();
+};
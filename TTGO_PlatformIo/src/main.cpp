@@ -36,6 +36,9 @@ int vref = 1100;
 #include "SCD30.h"                //Library for CO2 sensor
 #include "Omron_D6FPH.h"          //Library for differential pressure sensor
 #include "Adafruit_BMP280.h" // Library for BMP280 ambient temp and pressure, set correct I2C address 0x76
+#include "vo2_telemetry_sink.h" // buffered, non-blocking serial and SPP output
+#include "vo2_format.h"         // text formatting without String / heap
+#include "vo2_format_lines.h"   // the csv lines and display texts
 
 // declarations for bluetooth serial --------------
 #include "BluetoothSerial.h"
@@ -50,7 +53,7 @@ BluetoothSerial SerialBT;
 #include <BLEServer.h>
 #include <BLEUtils.h>
 
-const String Version = "V2.2 2023/01/23";
+const char *Version = "V2.2 2023/01/23";
 
 byte bpm;
 
@@ -167,7 +170,7 @@ float TimerVO2calc = 0.0;
 float TimerVO2diff = 0.0; // used for integral of calories
 float TimerStart = 0.0;
 float TotalTime = 0.0;
-String TotalTimeMin = String("00:00");
+char TotalTimeMin[FORMAT_TIME_SIZE] = "00:00:00";
 int readVE = 0;
 float TimerVE = 0.0;
 float DurationVE = 0.0;
@@ -216,6 +219,7 @@ void vo2maxCalc();      // calculate VO2max
 void showScreen();      // show screen on OLED
 void ExcelStream();     // stream data to Excel
 void ExcelStreamBT();   // stream data to Excel via Bluetooth
+void ExcelLine(uint8_t outputs); // queue one csv data line
 void VO2Notify();       // notify VO2max to Sensirion App
 void ReadButtons();     // read buttons
 void tftScreen1();      // show screen 1 on TFT
@@ -329,6 +333,12 @@ void setup()
         tft.drawString("BT ready", 0, 25, 4);
     }
 
+    // csv output is queued and written by a background task ----------
+    if (!telemetrySink.begin(&Serial, &SerialBT))
+    {
+        tft.drawString("Serial ERROR!", 0, 0, 4);
+    }
+
     // init O2 sensor DF-Robot -----------
     if (!Oxygen.begin(Oxygen_IICAddress))
     {
@@ -557,22 +567,7 @@ void CheckInitialCO2()
 
 void ConvertTime(float ms)
 {
-    long inms = long(ms);
-    int h, m, s;
-    String strh, strm, strs;
-    s = (inms / 1000) % 60;
-    m = (inms / 60000) % 60;
-    h = (inms / 3600000) % 24;
-    strs = String(s);
-    if (s < 10)
-        strs = String("0") + strs;
-    strm = String(m);
-    if (m < 10)
-        strm = String("0") + strm;
-    strh = String(h);
-    if (h < 10)
-        strh = String("0") + strh;
-    TotalTimeMin = String(strh) + String(":") + String(strm) + String(":") + String(strs);
+    formatTime(TotalTimeMin, sizeof(TotalTimeMin), (uint32_t)ms);
 }
 
 //--------------------------------------------------
@@ -634,16 +629,8 @@ void VolumeCalc()
             freqVEmean = 0;
 
 #ifdef VERBOSE
-        Serial.print("volumeExp: ");
-        Serial.print(volumeExp);
-        Serial.print("   VE: ");
-        Serial.print(volumeVE);
-        Serial.print("   VEmean: ");
-        Serial.print(volumeVEmean);
-        Serial.print("   freqVE: ");
-        Serial.print(freqVE, 1);
-        Serial.print("   freqVEmean: ");
-        Serial.println(freqVEmean, 1);
+        telemetrySink.printf(SINK_UART, "volumeExp: %.2f   VE: %.2f   VEmean: %.2f   freqVE: %.1f   freqVEmean: %.1f\r\n",
+                             volumeExp, volumeVE, volumeVEmean, freqVE, freqVEmean);
 #endif
     }
     if (millis() - TimerVE > 5000)
@@ -652,16 +639,14 @@ void VolumeCalc()
     if (pressure >= pressThreshold)
     { // ongoing integral of volumeTotal
 #ifdef VERBOSE
-    Serial.print("\nTeemuR: volumeTotal: ");
-    Serial.print(volumeTotal);
-    Serial.print("\n");
+        telemetrySink.printf(SINK_UART, "\nTeemuR: volumeTotal: %.2f\n", volumeTotal);
 #endif
 
         if (volumeTotal > 50)
             readVE = 1;
-    Serial.print("TeemuR: rho = ");
-    Serial.print(rho);
-    Serial.println("\n");
+        FormatBuffer<32> rhoText;
+        rhoText.add("TeemuR: rho = ").add(rho, 2).add("\n\r\n");
+        telemetrySink.enqueue(rhoText.data(), rhoText.length());
 
         massFlow = 1000 * sqrt((abs(pressure) * 2 * rho) / ((1 / (pow(area_2, 2))) - (1 / (pow(area_1, 2))))); // Bernoulli equation
         volFlow = massFlow / rho;                                                                              // volumetric flow of air
@@ -682,46 +667,10 @@ void ExcelStream()
     // HeaderStreamed = 1;// TEST: Deactivation of header
     if (HeaderStreamed == 0)
     {
-        Serial.print("Time");
-        Serial.print(",");
-        Serial.print("VO2");
-        Serial.print(",");
-        Serial.print("VO2MAX");
-        Serial.print(",");
-        Serial.print("VCO2");
-        Serial.print(",");
-        Serial.print("RQ");
-        Serial.print(",");
-        Serial.print("Bvol");
-        Serial.print(",");
-        Serial.print("VEmin");
-        Serial.print(",");
-        Serial.print("Brate");
-        Serial.print(",");
-        Serial.print("outO2%");
-        Serial.print(",");
-        Serial.println("CO2%");
+        telemetrySink.print(CSV_HEADER, SINK_UART);
         HeaderStreamed = 1;
     }
-    Serial.print(float(TotalTime / 1000), 0);
-    Serial.print(",");
-    Serial.print(vo2Max);
-    Serial.print(",");
-    Serial.print(vo2MaxMax);
-    Serial.print(",");
-    Serial.print(vco2Max);
-    Serial.print(",");
-    Serial.print(respq);
-    Serial.print(",");
-    Serial.print(volumeExp);
-    Serial.print(",");
-    Serial.print(volumeVEmean);
-    Serial.print(",");
-    Serial.print(freqVEmean);
-    Serial.print(",");
-    Serial.print(lastO2);
-    Serial.print(",");
-    Serial.println(co2perc, 3);
+    ExcelLine(SINK_UART);
 }
 //--------------------------------------------------
 void ExcelStreamBT()
@@ -729,46 +678,20 @@ void ExcelStreamBT()
     // HeaderStreamedBT = 1;// TEST: Deactivation of header
     if (HeaderStreamedBT == 0)
     {
-        SerialBT.print("Time");
-        SerialBT.print(",");
-        SerialBT.print("VO2");
-        SerialBT.print(",");
-        SerialBT.print("VO2MAX");
-        SerialBT.print(",");
-        SerialBT.print("VCO2");
-        SerialBT.print(",");
-        SerialBT.print("RQ");
-        SerialBT.print(",");
-        SerialBT.print("Bvol");
-        SerialBT.print(",");
-        SerialBT.print("VEmin");
-        SerialBT.print(",");
-        SerialBT.print("Brate");
-        SerialBT.print(",");
-        SerialBT.print("outO2%");
-        SerialBT.print(",");
-        SerialBT.println("CO2%");
+        telemetrySink.print(CSV_HEADER, SINK_SPP);
         HeaderStreamedBT = 1;
     }
-    SerialBT.print(float(TotalTime / 1000), 0);
-    SerialBT.print(",");
-    SerialBT.print(vo2Max);
-    SerialBT.print(",");
-    SerialBT.print(vo2MaxMax);
-    SerialBT.print(",");
-    SerialBT.print(vco2Max);
-    SerialBT.print(",");
-    SerialBT.print(respq);
-    SerialBT.print(",");
-    SerialBT.print(volumeExp);
-    SerialBT.print(",");
-    SerialBT.print(volumeVEmean);
-    SerialBT.print(",");
-    SerialBT.print(freqVEmean);
-    SerialBT.print(",");
-    SerialBT.print(lastO2);
-    SerialBT.print(",");
-    SerialBT.println(co2perc, 3);
+    ExcelLine(SINK_SPP);
+}
+
+//--------------------------------------------------
+void ExcelLine(uint8_t outputs)
+{ // one csv line, queued as a single record
+    CsvValues values = {float(TotalTime / 1000), vo2Max, vo2MaxMax, vco2Max, respq,
+                        volumeExp, volumeVEmean, freqVEmean, lastO2, co2perc};
+    FormatBuffer<CSV_LINE_SIZE> line;
+    formatCsvLine(line, values);
+    telemetrySink.enqueue(line.data(), line.length(), outputs);
 }
 
 //--------------------------------------------------
@@ -778,14 +701,12 @@ void BatteryBT()
     // HeaderStreamedBT = 1;// TEST: Deactivation of header
     if (HeaderStreamedBT == 0)
     {
-        SerialBT.print("Time");
-        SerialBT.print(",");
-        SerialBT.println("Voltage");
+        telemetrySink.print("Time,Voltage\r\n", SINK_SPP);
         HeaderStreamedBT = 1;
     }
-    SerialBT.print(float(TotalTime / 1000), 0);
-    SerialBT.print(",");
-    SerialBT.println(Battery_Voltage);
+    FormatBuffer<BATTERY_LINE_SIZE> line;
+    formatBatteryLine(line, float(TotalTime / 1000), Battery_Voltage);
+    telemetrySink.enqueue(line.data(), line.length(), SINK_SPP);
 }
 
 //--------------------------------------------------
@@ -843,15 +764,8 @@ void readCO2()
             respq = 0;
 
 #ifdef VERBOSE
-        Serial.print("Carbon Dioxide Concentration is: ");
-        Serial.print(result[0]);
-        Serial.println(" ppm");
-        Serial.print("Temperature = ");
-        Serial.print(result[1]);
-        Serial.println(" ℃");
-        Serial.print("Humidity = ");
-        Serial.print(result[2]);
-        Serial.println(" %");
+        telemetrySink.printf(SINK_UART, "Carbon Dioxide Concentration is: %.2f ppm\r\nTemperature = %.2f ℃\r\nHumidity = %.2f %%\r\n",
+                             result[0], result[1], result[2]);
 #endif
     }
 }
@@ -887,10 +801,7 @@ void vo2maxCalc()
 
 #ifdef VERBOSE
     // Debug. compare co2
-    Serial.print("Calc co2 ");
-    Serial.print(initialO2 - lastO2);
-    Serial.print(" sens co2 ");
-    Serial.println(co2perc);
+    telemetrySink.printf(SINK_UART, "Calc co2 %.2f sens co2 %.2f\r\n", initialO2 - lastO2, co2perc);
 #endif
 
     co2 = initialO2 - lastO2; // calculated level of CO2 based on Oxygen level loss
@@ -1393,10 +1304,12 @@ void GetWeightkg()
 
     Timer5s = millis();
     int weightChanged = 0;
+    char weightText[12];
     tft.fillScreen(TFT_BLUE);
     tft.setTextColor(TFT_WHITE, TFT_BLUE);
     tft.drawString("Enter weight in kg", 20, 10, 4);
-    tft.drawString(String(settings.weightkg), 48, 48, 7);
+    formatFixed(weightText, sizeof(weightText), settings.weightkg, 2);
+    tft.drawString(weightText, 48, 48, 7);
 
     while ((millis() - Timer5s) < 5000)
     {
@@ -1426,7 +1339,8 @@ void GetWeightkg()
         {
             tft.fillScreen(TFT_BLUE);
             tft.drawString("New weight in kg is:", 10, 10, 4);
-            tft.drawString(String(settings.weightkg), 48, 48, 7);
+            formatFixed(weightText, sizeof(weightText), settings.weightkg, 2);
+            tft.drawString(weightText, 48, 48, 7);
             weightChanged = 0;
             Timer5s = millis();
         }
@@ -1449,7 +1363,9 @@ void readVoltage()
     if (Battery_Voltage < 3.7)
         tft.setTextColor(TFT_WHITE, TFT_RED); // battery critical
     tft.setCursor(0, 0, 4);
-    tft.print(String(Battery_Voltage) + "V");
+    FormatBuffer<DISPLAY_TEXT_SIZE> voltageText;
+    formatVoltage(voltageText, Battery_Voltage);
+    tft.print(voltageText.c_str());
 }
 
 //---------------------------------------------------------
@@ -18,6 +18,18 @@ PSRAM: Disabled*/
 #define DIAMETER 18
 
 #undef VERBOSE // additional debug logging
+#undef TELEMETRY_JSON // JSON-lines debug output instead of binary telemetry frames
+#undef TELEMETRY_RAW_SAMPLES // additionally send every pressure sample
+// RAW_STREAM (set by the lilygo-vo2mini-raw env) streams every pressure code
+// and gas sample as delta encoded frames for offline analysis
+
+#ifdef RAW_STREAM
+#define SERIAL_BAUD 921600
+#define RAW_BATCH_US 250000   // send a pressure batch at least every 250ms
+#define RAW_INFO_US 5000000   // repeat the stream info every 5s for late captures
+#else
+#define SERIAL_BAUD 115200
+#endif
 
 #include <Arduino.h>
 #include "esp_adc_cal.h" // ADC calibration data
@@ -33,6 +45,17 @@ int vref = 1100;
 #include "SCD30.h"                //Library for CO2 sensor
 #include "Omron_D6FPH.h"          //Library for differential pressure sensor
 #include "vo2_ble_service.h"          //Library for differential pressure sensor
+#include "vo2_telemetry.h"            // binary telemetry frames
+#include "vo2_telemetry_sink.h"       // buffered, non-blocking serial output
+#include "vo2_format.h"               // text formatting without String / heap
+#include "vo2_format_lines.h"         // the JSON breath record and display texts
+#include "vo2_session_recorder.h"     // breath records to LittleFS
+#include "vo2_calc.h"                 // breath volume and VO2 calculations
+#include "vo2_serial_commands.h"      // text commands from the host
+#include "vo2_session_transfer.h"     // session download over serial
+#include "vo2_profiler.h"             // per-stage timing of loop()
+#include "vo2_i2c_stats.h"            // I2C transaction counters per sensor
+#include "vo2_sample_timing.h"        // pressure sample intervals and gaps
 
 // Starts Screen for TTGO device
 TFT_eSPI tft = TFT_eSPI(); // Invoke library, pins defined in User_Setup.h
@@ -44,7 +67,7 @@ Omron_D6FPH presSensor;
 DFRobot_OxygenSensor Oxygen;
 #define COLLECT_NUMBER 10           // collect number, the collection range is 1-100.
 #define Oxygen_IICAddress ADDRESS_3 // I2C  label for o2 address
-const String Version = "V2.3 2026/02/07";
+const char *Version = "V2.3 2026/02/07";
 
 // Defines button state for adding wt
 const int buttonPin1 = 0;
@@ -65,30 +88,9 @@ int DEMO = 0; // 1 = DEMO-mode
 //  case dimensions:
 // ############################################
 
-// Defines the size of the Venturi openings for the  calculations of AirFlow
-float area_1 = 0.000531; // = 26mm diameter
-//float area_1 = 0.000401; // = 22,6mm diameter
-#if (DIAMETER == 20)
-float area_2 = 0.000314; // = 20mm diameter
-#elif (DIAMETER == 19)
-float area_2 = 0.000284; // = 19mm diameter
-#elif (DIAMETER == 18)
-float area_2 = 0.000254; // = 18mm diameter
-#else // default
-float area_2 = 0.000201; // = 16mm diameter
-#endif
-
-float rho = 1.225;     // ATP conditions: density based on ambient conditions, dry air
-float rhoSTPD = 1.292; // STPD conditions: density at 0°C, MSL, 1013.25 hPa, dry air
-float rhoBTPS = 1.123; // BTPS conditions: density at ambient  pressure, 35°C, 95% humidity
-float massFlow = 0;
-float volFlow = 0;
-float volumeTotal = 0;      // variable for holding total volume of breath
-float pressure = 0.0;       // differential pressure of the venturi nozzle
-float pressThreshold = 0.1; // threshold for starting calculation of VE
-float volumeVE = 0.0;
-float volumeVEmean = 0.0;
-float volumeExp = 0.0;
+// Defines the size of the Venturi openings for the  calculations of AirFlow,
+// the breath and gas exchange state (see vo2_calc.h)
+VO2Calc calc(VO2_AREA_26MM, vo2VenturiArea(DIAMETER)); // 26mm inlet
 
 // ##############################################################################################
 
@@ -102,58 +104,25 @@ struct
     bool bmp_on = false;          // Pressure sensor sensor active
 } settings;
 
-float TimerInspiration = 0.0;
-float TimerExpiration = 0.0;
-float TimerVolCalc = 0.0;
 float Timer5s = 0.0;
 float Timer1min = 0.0;
-float TimerVO2calc = 0.0;
-float TimerVO2diff = 0.0; // used for integral of calories
 float TimerStart = 0.0;
 float TotalTime = 0.0;
-String TotalTimeMin = String("00:00");
-int readVE = 0;
-float TimerVE = 0.0;
-float DurationVE = 0.0;
-float lastO2 = 0;
-float initialO2 = 0;
-float deltaO2_frac = 0;
-float calTotal = 0;
-float vo2Cal = 0;
-float vo2CalH = 0;        // calories per hour
-float vo2CalDay = 0.0;    // calories per day
-float vo2CalDayMax = 0.0; // highest value of calories per day
-float vo2Rel = 0;         // value of vo2rel ml/min/kg, calculated every 30 seconds
-float vo2Total = 0.0;     // value of total vo2Max/min
-float vo2MaxMax = 0;      // Best value of vo2 max for whole time machine is on
-float respq = 0.0;      // respiratory quotient in mol VCO2 / mol VO2
-float co2ppm = 0.0;     // CO2 sensor in ppm
-float co2perc = 0.0;    // = CO2ppm /10000
-float initialCO2 = 0.0; // initial value of CO2 in ppm
+char TotalTimeMin[FORMAT_TIME_SIZE] = "00:00:00";
 float calibCO2 = 0.0;   // The CO2 (ppm) value after the calibration process
-float vco2Total = 0.0;
-float vco2Rel = 0.0;
-float co2temp = 0.0; // temperature CO2 sensor
 float co2hum = 0.0;  // humidity CO2 sensor (not used in calculations)
-float freqVE = 0.0;     // ventilation frequency
-float freqVEmean = 0.0; // mean ventilation frequency
-float expiratVol = 0.0; // last expiratory volume in L
-float volumeTotalOld = 0.0;
-float volumeTotal2 = 0.0;
-float TempC = 15.0;    // Air temperature in Celsius barometric sensor BMP180
-float PresPa = 101325; // uncorrected (absolute) barometric pressure
 float Battery_Voltage = 0.0;
+uint32_t breathSeq = 0;      // sequence number of the telemetry breath records
+uint32_t droppedSeen = 0;    // telemetrySink.droppedRecords() at the last breath
+SampleTiming sampleTiming;   // pressure sample intervals since the last report
+uint32_t sampleGapsTotal = 0; // gaps of the windows reported before
+#ifdef RAW_STREAM
+PressureBatch rawBatch;
+uint32_t rawInfoUs = 0;
+#endif
 // if ble
 VO2BleServer bleServer;
 
-enum ventilationStates
-{
-    WAITING_PRESSURE,
-    INSPIRATION,
-    EXPIRATION,
-    EXPIRATION_DONE
-};
-
 enum deviceStates
 {
     DEVICE_INITIALIZE,
@@ -162,7 +131,6 @@ enum deviceStates
     DEVICE_MEASURE
 };
 
-int ventilationState = WAITING_PRESSURE;
 int state = DEVICE_INITIALIZE;
 // Forward declarations
 uint16_t readVoltage();     // read battery voltage
@@ -170,6 +138,11 @@ float readCO2();         // read CO2 sensor
 float readO2();         // read CO2 sensor
 float volumeCalc();         // (
 void vo2maxCalc();
+void sendBreath();      // telemetry breath record
+#ifdef RAW_STREAM
+void streamPressure(uint32_t timeUs, uint16_t code); // raw stream pressure sample
+void streamGas(uint32_t timeUs);                      // raw stream O2 / CO2 sample
+#endif
 void CheckInitialCO2(); // check initial CO2 value
 void CheckInitialO2();  // check initial O2 value
 void showScreen(float o2, float co2, float respq, float vol);      // show screen on OLED
@@ -177,6 +150,23 @@ void ReadButtons();     // read buttons
 void tftScreen1(float o2, float co2, float respq, float vol);      // show screen 1 on TFT
 void tftParameters();   // show parameters on TFT
 void GetWeightkg();     // get weight from scale
+void cmdPing(int argc, char **argv); // serial command: firmware version
+void cmdProfile(int argc, char **argv); // serial command: loop stage timing
+void cmdI2CStats(int argc, char **argv); // serial command: I2C counters per sensor
+void recoverI2C();      // reset the bus after repeated failures
+void cmdJitter(int argc, char **argv); // serial command: sample interval gap threshold
+void sendSampleTiming(); // telemetry sample interval record, starts a new window
+
+const SerialCommand commands[] = {
+    {"ping", cmdPing, "firmware version"},
+    {"ls", cmdSessionList, "list session files"},
+    {"get", cmdSessionGet, "get <name> <offset> [length]"},
+    {"rm", cmdSessionRemove, "rm <name>"},
+    {"baud", cmdBaud, "baud <rate>"},
+    {"prof", cmdProfile, "prof [reset]"},
+    {"i2c", cmdI2CStats, "i2c [reset]"},
+    {"jitter", cmdJitter, "jitter [gap <ms>]"},
+};
 
 void loadSettings()
 {
@@ -261,8 +251,9 @@ void setup()
 
     // init serial communication  ----------
     Wire.begin();
-    Serial.begin(115200); // drop to 9600 to see if improves reliability
-    if (!Serial)
+    Serial.setTxBufferSize(2048); // room for a few file chunks during downloads
+    Serial.begin(SERIAL_BAUD); // drop to 9600 to see if improves reliability
+    if (!Serial || !telemetrySink.begin(&Serial) || !sessionTransfer.begin(&Serial, SERIAL_BAUD))
     {
         tft.drawString("Serial ERROR!", 0, 0, 4);
     }
@@ -270,8 +261,11 @@ void setup()
     {
         tft.drawString("Serial ok", 0, 0, 4);
     }
+    serialCommands.begin(&Serial, commands, sizeof(commands) / sizeof(commands[0]));
     
     // 
+    uint32_t bleHeap = ESP.getFreeHeap();
+    uint32_t bleStart = millis();
     if (bleServer.initialize())
     {
         tft.drawString("BLE init ok", 0, 25, 4);
@@ -280,6 +274,9 @@ void setup()
     {
         tft.drawString("BLE init ERROR!", 0, 25, 4);
     }
+    // BLE footprint, to compare stacks
+    telemetrySink.printf(SINK_UART, "BLE: advertising after %u ms, stack uses %u bytes heap, %u bytes free\r\n",
+                         (unsigned)(millis() - bleStart), (unsigned)(bleHeap - ESP.getFreeHeap()), (unsigned)ESP.getFreeHeap());
 
     // init O2 sensor DF-Robot -----------
     if (!Oxygen.begin(Oxygen_IICAddress))
@@ -312,6 +309,14 @@ void setup()
     }
     // Serial.println("Flow-Sensor I2c connect success!");
     tft.drawString("Flow-Sensor ok", 0, 100, 4);
+
+    // record the session to flash, with the calibration it started with -----
+    SessionInfo session = {Version, (uint64_t)esp_timer_get_time(), settings.correctionSensor, settings.weightkg,
+                           calc.initialO2, calc.initialCO2, MODEL_0025AMD2, presSensor.getPressureScale(), presSensor.getPressureOffset()};
+    if (!sessionRecorder.begin(session))
+    {
+        tft.drawString("Recorder ERROR!", 0, 119, 2);
+    }
     delay(2000);
 
     tft.fillScreen(TFT_BLACK);
@@ -319,10 +324,9 @@ void setup()
 
     tft.drawCentreString("Ready...", 120, 55, 4);
     state = DEVICE_READY;
-    TimerVolCalc = millis(); // timer for the volume (VE) integral function
+    calc.begin(esp_timer_get_time()); // timers of the volume integral and the VO2 calculations
     Timer5s = millis();
     Timer1min = millis();
-    TimerVO2calc = millis(); // timer between VO2max calculations
     TimerStart = millis();   // holds the millis at start
     TotalTime = 0;
     // BatteryBT(); // TEST for battery discharge log
@@ -335,43 +339,77 @@ void setup()
 
 void loop()
 {
+    PROFILE_SCOPE(PROF_LOOP);
     TotalTime = millis() - TimerStart; // calculates actual total time
+    {
+        PROFILE_SCOPE(PROF_COMMANDS);
+        serialCommands.poll(); // host commands, the transfers run in their own task
+    }
     float vol = volumeCalc();
+    recoverI2C();
     // VO2max calculation, tft display and excel csv every 5s --------------
-    if (ventilationState == INSPIRATION) {
+    if (calc.ventilationState == INSPIRATION) {
         float o2 = readO2();
         float co2 = readCO2();
         //showScreen(o2, co2, respq, vol);
         delay(100);
     }
     // calls vo2maxCalc() for calculation Vo2Max after every expiration
-    if (ventilationState == EXPIRATION_DONE)
+    if (calc.ventilationState == EXPIRATION_DONE)
     {
-        ventilationState = INSPIRATION;
-        TimerVO2diff = millis() - TimerVO2calc;
-        TimerVO2calc = millis(); // resets the timer
-        TimerInspiration = millis();
+        calc.startInspiration(esp_timer_get_time()); // also resets the VO2 timer
         float o2 = readO2();
         float co2 = readCO2();
         vo2maxCalc();
         /*if (TotalTime >= 10000)*/
         {
-            showScreen(o2, co2, respq, vol);
+            PROFILE_SCOPE(PROF_SCREEN);
+            showScreen(o2, co2, calc.respq, vol);
             readVoltage();
         }
         // send BLE data ----------------
-        // Publish JSON telemetry via BLE (if a client connected)
+        // one packed notification per breath, also kept in the BLE history
+        // while no client is connected
+        PROFILE_SCOPE(PROF_BLE);
+        uint8_t i2cPacked[I2C_STATS_PACKED_SIZE];
+        bleServer.setI2CStats(i2cPacked, i2cStatsPack(i2cStats, i2cPacked));
+        VO2Metrics metrics = {breathSeq, (uint32_t)(calc.breathEndUs / 1000),
+                              calc.vo2Total, calc.vco2Total, calc.respq, calc.volumeVE, calc.volumeExp, calc.freqVE,
+                              (uint8_t)((DEMO == 1 ? METRICS_FLAG_DEMO : 0) |
+                                        (calc.sensorLimitBreath ? METRICS_FLAG_SENSOR_LIMIT : 0))};
+        bleServer.pushMetrics(metrics);
         if (bleServer.isClientConnected())
         {
-            bleServer.pushVO2Data(vo2Rel);
-            bleServer.pushVCO2Data(vco2Rel);
-            bleServer.pushRQData(respq);
+            // single value characteristics for older clients, only sent if subscribed
+            bleServer.pushVO2Data(calc.vo2Rel);
+            bleServer.pushVCO2Data(calc.vco2Rel);
+            bleServer.pushRQData(calc.respq);
         }
+        calc.sensorLimitBreath = false;
     }
 
     if (millis() - Timer1min > 30000)
     {
         Timer1min = millis(); // reset timer
+        sendSampleTiming();
+        if (bleServer.isWaveformSubscribed())
+        { // BLE waveform throughput
+            WaveformStats stats = bleServer.waveformStats();
+            telemetrySink.printf(SINK_UART, "BLE waveform: mtu %u, %.1f samples/s, %u samples, %u packets, %u bytes, %u notify failures\r\n",
+                                 (unsigned)stats.mtu, stats.samplesPerSec, (unsigned)stats.samples, (unsigned)stats.packets,
+                                 (unsigned)stats.bytes, (unsigned)stats.notifyFailures);
+        }
+        if (bleServer.isClientConnected())
+        {
+            BleQueueStats queue = bleServer.queueStats();
+            telemetrySink.printf(SINK_UART, "BLE queue: %u queued, %u sent, %u coalesced, %u dropped\r\n",
+                                 (unsigned)queue.queued, (unsigned)queue.sent, (unsigned)queue.coalesced, (unsigned)queue.dropped);
+            BleLinkInfo link = bleServer.linkInfo();
+            telemetrySink.printf(SINK_UART, "BLE link: %s, interval %.2f ms, latency %u, timeout %u ms, PHY %u/%u, mtu %u\r\n",
+                                 link.requested == BLE_LINK_STREAMING ? "streaming" : "low power", link.intervalMs,
+                                 (unsigned)link.latency, (unsigned)link.timeoutMs, (unsigned)link.txPhy, (unsigned)link.rxPhy,
+                                 (unsigned)link.mtu);
+        }
                               // BatteryBT(); //TEST für battery discharge log ++++++++++++++++++++++++++++++++++++++++++
     }
 }
@@ -380,11 +418,105 @@ void loop()
 //                  FUNCTIONS
 //----------------------------------------------------------------------------------------------------------
 
+void cmdPing(int argc, char **argv)
+{
+    serialCommands.reply(REPLY_OK, "VO2 %s", Version);
+}
+
+// one text line per stage in microseconds, then the reply
+void cmdProfile(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "reset") == 0)
+    {
+        profiler.reset();
+        serialCommands.reply(REPLY_OK, "prof reset");
+        return;
+    }
+    float cyclesPerUs = getCpuFrequencyMhz();
+    for (uint8_t i = 0; i < PROF_STAGES; i++)
+    {
+        const StageHistogram &h = profiler.stage(i);
+        if (h.count == 0)
+            continue;
+        telemetrySink.printf(SINK_UART, "prof %-8s n %lu mean %.0f p50 %.0f p95 %.0f p99 %.0f max %.0f us\r\n",
+                             profileStageNames[i], (unsigned long)h.count, h.total / h.count / cyclesPerUs,
+                             h.percentile(50) / cyclesPerUs, h.percentile(95) / cyclesPerUs,
+                             h.percentile(99) / cyclesPerUs, h.max / cyclesPerUs);
+    }
+    serialCommands.reply(REPLY_OK, "prof %u stages", (unsigned)PROF_STAGES);
+}
+
+// one text line per sensor, latencies in microseconds, then the reply
+void cmdI2CStats(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "reset") == 0)
+    {
+        i2cStats.reset();
+        serialCommands.reply(REPLY_OK, "i2c reset");
+        return;
+    }
+    for (uint8_t i = 0; i < I2C_DEVICES; i++)
+    {
+        const I2CDeviceStats &d = i2cStats.device(i);
+        telemetrySink.printf(SINK_UART, "i2c %-8s n %lu nack %lu err %lu short %lu crc %lu retry %lu recover %lu p50 %lu p99 %lu max %lu us\r\n",
+                             i2cDeviceNames[i], (unsigned long)d.attempts, (unsigned long)d.nacks,
+                             (unsigned long)d.busErrors, (unsigned long)d.shortReads, (unsigned long)d.crcErrors,
+                             (unsigned long)d.retries, (unsigned long)d.recoveries,
+                             (unsigned long)d.latency.percentile(50), (unsigned long)d.latency.percentile(99),
+                             (unsigned long)d.latency.max);
+    }
+    serialCommands.reply(REPLY_OK, "i2c %u devices", (unsigned)I2C_DEVICES);
+}
+
+// without an argument the statistics of the current window
+void cmdJitter(int argc, char **argv)
+{
+    if (argc > 2 && strcmp(argv[1], "gap") == 0)
+    {
+        long ms = atol(argv[2]);
+        if (ms <= 0 || ms > 60000)
+        {
+            serialCommands.reply(REPLY_ERROR, "gap must be 1..60000 ms");
+            return;
+        }
+        sampleTiming.gapUs = ms * 1000;
+    }
+    else if (argc > 1)
+    {
+        serialCommands.reply(REPLY_ERROR, "jitter [gap <ms>]");
+        return;
+    }
+    serialCommands.reply(REPLY_OK, "n %lu mean %.0f std %.0f us, %lu gaps > %lu ms",
+                         (unsigned long)sampleTiming.count(), sampleTiming.meanUs(), sampleTiming.stdUs(),
+                         (unsigned long)(sampleGapsTotal + sampleTiming.gaps), (unsigned long)(sampleTiming.gapUs / 1000));
+}
+
+// a sensor stuck holding SDA shows up as a run of bus errors; restarting
+// the driver clocks the bus free. I2CStats spaces the resets out and stops
+// asking after I2C_RECOVERY_ATTEMPTS that did not help.
+void recoverI2C()
+{
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < I2C_DEVICES; i++)
+    {
+        if (!i2cStats.recoveryNeeded(i, now))
+            continue;
+        Wire.end();
+        Wire.begin();
+        i2cStats.recovered(i, now);
+        telemetrySink.printf(SINK_UART, "I2C: bus reset after %u failures of %s\r\n",
+                             (unsigned)I2C_RECOVERY_FAILURES, i2cDeviceNames[i]);
+        if (i2cStats.device(i).resetStreak >= I2C_RECOVERY_ATTEMPTS)
+            telemetrySink.printf(SINK_UART, "I2C: no more resets for %s until it reads again\r\n", i2cDeviceNames[i]);
+        return;
+    }
+}
+
 void CheckInitialO2()
 {
     // check initial O2 value -----------
-    initialO2 = Oxygen.ReadOxygenData(COLLECT_NUMBER); // read and check initial VO2%
-    if (initialO2 < 20.00)
+    calc.initialO2 = Oxygen.ReadOxygenData(COLLECT_NUMBER); // read and check initial VO2%
+    if (calc.initialO2 < 20.00)
     {
         tft.fillScreen(TFT_RED);
         tft.setTextColor(TFT_WHITE, TFT_RED);
@@ -394,24 +526,24 @@ void CheckInitialO2()
         tft.println("Wait to continue!");
         while (digitalRead(buttonPin1))
         {
-            initialO2 = Oxygen.ReadOxygenData(COLLECT_NUMBER);
+            calc.initialO2 = Oxygen.ReadOxygenData(COLLECT_NUMBER);
             tft.setCursor(5, 67, 4);
             tft.print("O2: ");
-            tft.print(initialO2);
+            tft.print(calc.initialO2);
             tft.println(" % ");
             tft.setCursor(5, 105, 4);
             tft.println("Continue              >>>");
             delay(500);
         }
-        if (initialO2 < 20.00)
-            initialO2 = 20.90;
+        if (calc.initialO2 < 20.00)
+            calc.initialO2 = 20.90;
         tft.fillScreen(TFT_BLACK);
         tft.setTextColor(TFT_GREEN, TFT_BLACK);
         tft.setCursor(5, 5, 4);
         tft.println("Initial O2% set to:");
         tft.setTextColor(TFT_WHITE, TFT_BLACK);
         tft.setCursor(5, 55, 4);
-        tft.print(initialO2);
+        tft.print(calc.initialO2);
         tft.println(" % ");
         delay(5000);
     }
@@ -422,9 +554,9 @@ void CheckInitialO2()
 void CheckInitialCO2()
 { // check initial CO2 value
     readCO2();
-    initialCO2 = co2ppm;
+    calc.initialCO2 = calc.co2ppm;
 
-    if (initialCO2 > 5000)
+    if (calc.initialCO2 > 5000)
     {
         tft.fillScreen(TFT_RED);
         tft.setTextColor(TFT_WHITE, TFT_RED);
@@ -435,24 +567,24 @@ void CheckInitialCO2()
         while (digitalRead(buttonPin1))
         {
             readCO2();
-            initialCO2 = co2ppm;
+            calc.initialCO2 = calc.co2ppm;
             tft.setCursor(5, 67, 4);
             tft.print("CO2: ");
-            tft.print(initialCO2, 0);
+            tft.print(calc.initialCO2, 0);
             tft.println(" ppm ");
             tft.setCursor(5, 105, 4);
             tft.println("Continue              >>>");
             delay(500);
         }
-        if (initialCO2 > 1000)
-            initialCO2 = 1000;
+        if (calc.initialCO2 > 1000)
+            calc.initialCO2 = 1000;
         tft.fillScreen(TFT_BLACK);
         tft.setTextColor(TFT_GREEN, TFT_BLACK);
         tft.setCursor(5, 5, 4);
         tft.println("Initial CO2 set to:");
         tft.setTextColor(TFT_WHITE, TFT_BLACK);
         tft.setCursor(5, 55, 4);
-        tft.print(initialCO2, 0);
+        tft.print(calc.initialCO2, 0);
         tft.println(" ppm");
         delay(5000);
     }
@@ -460,44 +592,34 @@ void CheckInitialCO2()
 
 //--------------------------------------------------
 
-String ConvertTime(float ms)
+void ConvertTime(float ms)
 {
-    long inms = long(ms);
-    int h, m, s;
-    String strh, strm, strs;
-    s = (inms / 1000) % 60;
-    m = (inms / 60000) % 60;
-    h = (inms / 3600000) % 24;
-    strs = String(s);
-    if (s < 10)
-        strs = String("0") + strs;
-    strm = String(m);
-    if (m < 10)
-        strm = String("0") + strm;
-    strh = String(h);
-    if (h < 10)
-        strh = String("0") + strh;
-    TotalTimeMin = String(strh) + String(":") + String(strm) + String(":") + String(strs);
-    return TotalTimeMin;
+    formatTime(TotalTimeMin, sizeof(TotalTimeMin), (uint32_t)ms);
 }
 
 //--------------------------------------------------
 float readO2()
 {
-    float oxygenData = Oxygen.ReadOxygenData(COLLECT_NUMBER);
-    lastO2 = oxygenData;
-    if (lastO2 > initialO2)
-        initialO2 = lastO2; // correction for drift of O2 sensor
+    float oxygenData;
+    {
+        PROFILE_SCOPE(PROF_O2);
+        oxygenData = Oxygen.ReadOxygenData(COLLECT_NUMBER);
+    }
+    calc.o2Sample(oxygenData); // also follows the drift of the O2 sensor
 
     if (DEMO == 1)
-        lastO2 = initialO2 - 4;
+        calc.lastO2 = calc.initialO2 - 4;
+#ifdef RAW_STREAM
+    streamGas(micros());
+#endif
+#ifdef RAW_LOG
+    sessionRecorder.recordGas(esp_timer_get_time(), calc.lastO2, calc.co2ppm);
+#endif
 #ifdef VERBOSE
-        Serial.print("O2: ");
-        Serial.print(lastO2);
-        Serial.print("\n");
+        telemetrySink.printf(SINK_UART, "O2: %.2f\n", calc.lastO2);
 #endif
     
-    return lastO2;
+    return calc.lastO2;
 }
 
 //--------------------------------------------------
@@ -505,13 +627,16 @@ float readO2()
 float readCO2()
 {
     float result[3] = {0};
-
-    if (scd30.isAvailable())
+    bool available;
     {
-        scd30.getCarbonDioxideConcentration(result);
+        PROFILE_SCOPE(PROF_CO2);
+        available = scd30.isAvailable() && scd30.getCarbonDioxideConcentration(result);
+    }
 
-        co2ppm = result[0];
-        if (co2ppm >= 40000)
+    if (available)
+    {
+        float ppm = result[0];
+        if (ppm >= 40000)
         { // upper limit of CO2 sensor warning
             // tft.fillScreen(TFT_RED);
             tft.setTextColor(TFT_WHITE, TFT_RED);
@@ -519,40 +644,20 @@ float readCO2()
         }
 
         if (DEMO == 1)
-            co2ppm = 30000; // TEST+++++++++++++++++++++++++++++++++++++++++++++
-        if (initialCO2 == 0)
-            initialCO2 = co2ppm;
-        // PPM is already a volume (mole) fraction for gases. To get the percentage, divide by 10000.
-        co2perc = co2ppm / 10000;
-        co2temp = result[1];
+            ppm = 30000; // TEST+++++++++++++++++++++++++++++++++++++++++++++
         co2hum = result[2];
-
-        float co2percdiff = (co2ppm - initialCO2) / 10000; // calculates difference to initial CO2
-        if (co2percdiff < 0)
-            co2percdiff = 0;
-
-        // VCO2 calculation is based on changes in CO2 concentration (difference to baseline)
-        vco2Total = 1000 * volumeVEmean * rhoBTPS / rhoSTPD * co2percdiff; // = vco2 in ml/min (* co2% * 10 for L in ml)
-        vco2Rel = vco2Total / settings.weightkg;                         // correction for wt
-        respq = (vco2Total * 44) / (vo2Total * 32);                      // respiratory quotient based on molarity
-        // CO2: 44g/mol, O2: 32 g/mol
-        if (isnan(respq))
-             respq = 0; // correction for errors/div by 0
-        if (respq > 1.5)
-            respq = 0;
+        // VCO2 and RQ from the difference to the initial CO2
+        calc.co2Sample(ppm, result[1], settings.weightkg);
+#ifdef RAW_STREAM
+        streamGas(micros());
+#endif
+#ifdef RAW_LOG
+        sessionRecorder.recordGas(esp_timer_get_time(), calc.lastO2, calc.co2ppm);
+#endif
 
 #ifdef VERBOSE
-        Serial.print(" Initial CO2: ");
-        Serial.print(initialCO2);
-        Serial.print(" CO2: ");
-        Serial.print(result[0]);
-        Serial.print(" ppm ");
-        // Serial.print("Temperature = ");
-        Serial.print(result[1]);
-        Serial.print(" ℃");
-        // Serial.print("Humidity = ");
-        Serial.print(result[2]);
-        Serial.println(" %");
+        telemetrySink.printf(SINK_UART, " Initial CO2: %.2f CO2: %.2f ppm %.2f ℃%.2f %%\r\n",
+                             calc.initialCO2, result[0], result[1], result[2]);
 #endif
     }
     return result[0];
@@ -564,195 +669,133 @@ float volumeCalc()
     //Serial.print("TeemuR: VolumeCalc\n");
 #endif
     // Read pressure from Omron D6F PH0025AD1 (or D6F PH0025AD2)
-    float pressureraw = presSensor.getPressure();
-    pressure = pressure / 2 + pressureraw / 2;
-#if 0
-    Serial.print("\nTeemuR: pressure: ");
-    Serial.print(pressure);
-    Serial.print("\n");
+    uint16_t pressureCode;
+    float pressureraw = NAN;
+    uint64_t nowUs = esp_timer_get_time(); // the logged time is the one the calculation used
+    bool valid;
+    {
+        PROFILE_SCOPE(PROF_PRESSURE);
+        valid = presSensor.getPressureCode(&pressureCode);
+    }
+    if (valid)
+    {
+        sampleTiming.sample(nowUs); // a failed read shows up as a longer interval
+        pressureraw = presSensor.codeToPressure(pressureCode);
+#ifdef RAW_STREAM
+        streamPressure(micros(), pressureCode);
+#endif
+#ifdef RAW_LOG
+        sessionRecorder.recordPressure(nowUs, pressureCode);
+#endif
+    }
+    PROFILE_SCOPE(PROF_FLOW);
+    calc.flowSample(nowUs, pressureraw, settings.correctionSensor);
+#ifdef TELEMETRY_RAW_SAMPLES
+    RawSampleRecord sample = {(uint32_t)millis(), pressureraw, calc.lastO2, calc.co2ppm};
+    uint8_t frame[TELEMETRY_FRAME_SIZE(16)];
+    telemetrySink.enqueue(frame, telemetryRawSampleFrame(sample, frame));
 #endif
 
-    if (isnan(pressure))
+    if (isnan(calc.pressure))
     { // isnan = is not a number,  unvalid sensor data
         tft.fillScreen(TFT_RED);
         tft.setTextColor(TFT_WHITE, TFT_RED);
         tft.drawCentreString("VENTURI ERROR!", 120, 55, 4);
     }
-    if (pressure > 266)
+    if (calc.pressure > VO2_SENSOR_LIMIT_PA)
     { // upper limit of flow sensor warning
         // tft.fillScreen(TFT_RED);
         tft.setTextColor(TFT_WHITE, TFT_RED);
         tft.drawCentreString("SENSOR LIMIT!", 120, 55, 4);
     }
-    if (pressure < 0)
-        pressure = 0;
 
+    // live flow curve for BLE clients, 0 below the threshold like the integral
+    bleServer.pushFlowSample(micros(), calc.pressure >= calc.pressThreshold ? calc.volFlow : 0);
 
-    if (pressure < pressThreshold && readVE == 1)
-    {
-        if (ventilationState == EXPIRATION)
-        {
-            float expTime = millis() - TimerExpiration;
-            Serial.print("{ \"event\": \"EXPIRATION DONE\", \"time\": ");
-            Serial.print("\""+ConvertTime(TotalTime)+"\"");
-            Serial.print(", \"duration\": ");
-            Serial.print("\""+ConvertTime(expTime)+"\"");
-            Serial.println("}");
-            ventilationState = EXPIRATION_DONE;
-        }
-        // read volumeVE
-        readVE = 0;
-        // DurationVE is the time of one breath (inspiration + expiration) in ms, calculated from the time between two expirations
-        DurationVE = millis() - TimerVE;
-        TimerVE = millis(); // start timerVE
-        // volumeExp is the expiratory volume of one breath, calculated from the integral of flow (volFlow) over expiration time (TimerExpiration)
-        volumeExp = volumeTotal;
-        volumeTotal = 0; // resets volume for next breath
-        // volumeVE is the minute ventilation (VE) in L/min, calculated from the expiratory volume and duration of one breath (DurationVE)
-        volumeVE = volumeExp / (DurationVE / 1000) * 60;
-        volumeVEmean = (volumeVEmean * 3 / 4) + (volumeVE / 4); // running mean of one minute volume (VE)
-        if (volumeVEmean < 1)
-            volumeVEmean = 0;
-        freqVE = 60000 / DurationVE;
-        if (volumeVE < 0.1)
-            freqVE = 0;
-        freqVEmean = (freqVEmean * 3 / 4) + (freqVE / 4);
-        if (freqVEmean < 1)
-            freqVEmean = 0;
-    }
-    //if (millis() - TimerVE > 5000)
-    //    readVE = 1; // readVE at least every 5s
-
-    if (pressure >= pressThreshold)
-    { // ongoing integral of volumeTotal
-        if (ventilationState == INSPIRATION)
-        {
-            float inspTime = millis() - TimerInspiration;
-            Serial.print("{ \"event\": \"INSPIRATION\"");
-            Serial.print(", \"time\": ");
-            Serial.print("\""+ConvertTime(TotalTime)+"\"");
-            Serial.print(", \"duration\": ");
-            Serial.print("\""+ConvertTime(inspTime)+"\"");
-            Serial.println("}");
-            TimerExpiration = millis();
-        }
-#if 0
-    Serial.print("\nTeemuR EXPIRATION: volumeTotal: ");
-    Serial.print(volumeTotal);
-    Serial.print("\n");
-#endif
-        ventilationState = EXPIRATION;
-
-        if (volumeTotal > 0.4)
-            readVE = 1;
-        // massflow kg/s = sqrt((2 * rho * Δp) / (1/A2² - 1/A1²)) (A2 < A1)
-        massFlow = sqrt((2 * rho * abs(pressure)) / ((1 / (pow(area_2, 2))) - (1 / (pow(area_1, 2))))); // Bernoulli equation
-        // volFlow = massFlow / rho; // volumetric flow of air dm3/s (liter/s)
-        volFlow = 1000 * massFlow * settings.correctionSensor / rho;                                           // volumetric flow of air and correction of sensor calculations
-        volumeTotal = volFlow * ((millis() - TimerVolCalc) / 1000) + volumeTotal;
-        volumeTotal2 = volFlow * ((millis() - TimerVolCalc) / 1000) + volumeTotal2;
-    }
-    else if ((volumeTotal2 - volumeTotalOld) > 200)
-    { // calculate actual expiratory volume
-        expiratVol = (volumeTotal2 - volumeTotalOld);
-        volumeTotalOld = volumeTotal2;
-    }
-    TimerVolCalc = millis(); // part of the integral function to keep calculation volume over time
-    // Resets amount of time between calcs
-
-    return expiratVol;
-}
-
-void AirDensity()
-{
-    //co2temp = result[1];
-    //co2hum = result[2];
-
-    TempC = co2temp; // bmp.readTemperature(); // Temp from baro sensor BM280
-    //Serial.print("TeemuR: AirDensity TempC = ");
-    //Serial.print(TempC);
-    //Serial.println("\n");
-
-    // co2temp is temperature from CO2 sensor
-    // PresPa = bmp.readPressure();
-    //Serial.print("TeemuR: AirDensity co2temp = ");
-    //Serial.print(co2temp);
-    //Serial.println("\n");
-    rho = PresPa / (co2temp + 273.15) / 287.058; // calculation of air density
-    rhoBTPS = PresPa / (35 + 273.15) / 292.9;    // density at BTPS: 35°C, 95% humidity
-
-    //Serial.print("TeemuR: AirDensity rho = ");
-    //Serial.print(rho);
-    //Serial.println("\n");
+    return calc.expiratVol;
 }
 
 void vo2maxCalc()
 {
-    // V02max calculation every 5s
-    AirDensity(); // calculates air density
-
+    // V02max calculation after every breath, air density first
 #ifdef VERBOSE
     // Debug. compare co2
-    Serial.print("\ninitialO2 ");
-    Serial.print(initialO2);
-    Serial.print("\nlastO2 ");
-    Serial.print(lastO2);
-    Serial.print("\nsens co2 ");
-    Serial.println(co2perc);
+    telemetrySink.printf(SINK_UART, "\ninitialO2 %.2f\nlastO2 %.2f\nsens co2 %.2f\r\n", calc.initialO2, calc.lastO2, calc.co2perc);
+#endif
+    PROFILE_SCOPE(PROF_BREATH);
+    calc.breathCalc(settings.weightkg);
+    sendBreath();
+}
+
+//--------------------------------------------------
+void sendBreath()
+{ // one self-contained record per breath, see BreathRecord
+    uint8_t flags = 0;
+    if (DEMO == 1)
+        flags |= BREATH_FLAG_DEMO;
+    uint32_t dropped = telemetrySink.droppedRecords();
+    if (dropped != droppedSeen)
+        flags |= BREATH_FLAG_DROPPED;
+    droppedSeen = dropped;
+    breathSeq++;
+    BreathRecord rec = calc.breathRecord(breathSeq, flags);
+    sessionRecorder.record(rec);
+
+#ifdef TELEMETRY_JSON
+    FormatBuffer<BREATH_JSON_SIZE> json;
+    formatBreathJson(json, rec);
+    telemetrySink.enqueue(json.data(), json.length());
+#else
+    uint8_t frame[TELEMETRY_FRAME_SIZE(BREATH_PAYLOAD_SIZE)];
+    telemetrySink.enqueue(frame, telemetryBreathFrame(rec, frame));
 #endif
+}
+
+//--------------------------------------------------
+void sendSampleTiming()
+{
+    const StageHistogram &h = sampleTiming.intervals;
+    sampleGapsTotal += sampleTiming.gaps;
+    SampleTimingRecord rec = {(uint32_t)millis(), sampleTiming.count(), sampleTiming.meanUs(), sampleTiming.stdUs(),
+                              h.percentile(50), h.percentile(99), h.max,
+                              sampleTiming.gaps, sampleGapsTotal, sampleTiming.gapUs};
+    uint8_t frame[TELEMETRY_FRAME_SIZE(SAMPLE_TIMING_PAYLOAD_SIZE)];
+    telemetrySink.enqueue(frame, telemetrySampleTimingFrame(rec, frame));
+    sampleTiming.reset();
+}
 
-    deltaO2_frac = (initialO2 - lastO2) / 100; // calculated level of consumed O2 based on Oxygen level loss
-    if (deltaO2_frac < 0)
-        deltaO2_frac = 0; // correction for sensor drift
-
-    float vo2TotalIn = 1000 * volumeVEmean * rhoBTPS / rhoSTPD * initialO2 / 100; // = vo2 in ml/min
-    float vo2TotalOut = 1000 * volumeVEmean * rhoBTPS / rhoSTPD * lastO2 / 100; // = vo2 in ml/min
-    vo2Total = 1000 * volumeVEmean * deltaO2_frac * rhoBTPS / rhoSTPD; // = volume in ml/min * deltaO2_frac% * rhoBTPS / rhoSTPD
-    vo2Rel = vo2Total / settings.weightkg;                  // vo2Rel with correction for weight
-    if (vo2Rel > vo2MaxMax)
-        vo2MaxMax = vo2Rel;
-
-    vo2Cal = vo2Total / 1000 * 4.86;                     // vo2Rel liters/min * 4.86 Kcal/liter = kcal/min
-    calTotal = calTotal + vo2Cal * TimerVO2diff / 60000; // integral function of calories
-    vo2CalH = vo2Cal * 60.0;                             // actual calories/min. * 60 min. = cal./hour
-    vo2CalDay = vo2Cal * 1440.0;                         // actual calories/min. * 1440 min. = cal./day
-    if (vo2CalDay > vo2CalDayMax)
-        vo2CalDayMax = vo2CalDay;
-
-    // TODO move the different file
-    Serial.print("{ \"volume\": {");
-    Serial.print("\"volumeExp\": ");
-    Serial.print(volumeExp);
-    Serial.print(", \"VE\": ");
-    Serial.print(volumeVE);
-    Serial.print(", \"VEmean\": ");
-    Serial.print(volumeVEmean);
-    Serial.print(", \"freqVE\": ");
-    Serial.print(freqVE, 1);
-    Serial.print(", \"freqVEmean\": ");
-    Serial.print(freqVEmean, 1);
-    Serial.println("}}");
-    Serial.print("{ \"vo2\": {");
-    Serial.print("\"vo2Total\": ");
-    Serial.print(vo2Total);
-    Serial.print(", \"vo2Rel\": ");
-    Serial.print(vo2Rel);
-    Serial.print(", \"deltaO2_frac\": ");
-    Serial.print(deltaO2_frac);
-    Serial.print(", \"vo2TotalIn\": ");
-    Serial.print(vo2TotalIn);
-    Serial.print(", \"vo2TotalOut\": ");
-    Serial.print(vo2TotalOut);
-    Serial.println("}}");
-    Serial.print("{ \"vco2\": {");
-    Serial.print("\"vco2Total\": ");
-    Serial.print(vco2Total);
-    Serial.print(", \"vco2Rel\": ");
-    Serial.print(vco2Rel);
-    Serial.print(", \"respq\": ");
-    Serial.print(respq);
-    Serial.println("}}"); 
+#ifdef RAW_STREAM
+//--------------------------------------------------
+void streamPressure(uint32_t timeUs, uint16_t code)
+{
+    static uint32_t batchStartUs = 0;
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+
+    if (rawInfoUs == 0 || timeUs - rawInfoUs >= RAW_INFO_US)
+    { // scaling of the codes, so the host can convert to Pa
+        StreamInfoRecord info = {MODEL_0025AMD2, presSensor.getPressureScale(), presSensor.getPressureOffset()};
+        telemetrySink.enqueue(frame, telemetryStreamInfoFrame(info, frame));
+        rawInfoUs = timeUs;
+    }
+    if (rawBatch.count > 0 && timeUs - batchStartUs >= RAW_BATCH_US)
+        telemetrySink.enqueue(frame, telemetryPressureBatchFrame(rawBatch, frame));
+    if (!pressureBatchAdd(rawBatch, timeUs, code))
+    { // batch full
+        telemetrySink.enqueue(frame, telemetryPressureBatchFrame(rawBatch, frame));
+        pressureBatchAdd(rawBatch, timeUs, code);
+    }
+    if (rawBatch.count == 1)
+        batchStartUs = timeUs;
+}
+
+//--------------------------------------------------
+void streamGas(uint32_t timeUs)
+{
+    GasSampleRecord rec = {timeUs, calc.lastO2, calc.co2ppm};
+    uint8_t frame[TELEMETRY_FRAME_SIZE(12)];
+    telemetrySink.enqueue(frame, telemetryGasSampleFrame(rec, frame));
 }
+#endif
 
 //--------------------------------------------------
 void showScreen(float o2, float co2, float respq, float vol)
@@ -819,17 +862,17 @@ void tftParameters()
     tft.setCursor(5, 5, 4);
     tft.print("*C");
     tft.setCursor(120, 5, 4);
-    tft.println(co2temp, 1);
+    tft.println(calc.co2temp, 1);
 
     tft.setCursor(5, 30, 4);
     tft.print("hPA");
     tft.setCursor(120, 30, 4);
-    tft.println((PresPa / 100));
+    tft.println((calc.PresPa / 100));
 
     tft.setCursor(5, 55, 4);
     tft.print("kg/m3");
     tft.setCursor(120, 55, 4);
-    tft.println(rho, 4);
+    tft.println(calc.rho, 4);
 
     tft.setCursor(5, 80, 4);
     tft.print("kg");
@@ -842,9 +885,20 @@ void tftParameters()
     tft.println(settings.correctionSensor, 2);
 
     tft.setCursor(5, 105, 4);
-    tft.print("inO2%");
-    tft.setCursor(120, 105, 4);
-    tft.println(initialO2);
+    tft.print("iO2");
+    tft.setCursor(50, 105, 4);
+    tft.println(calc.initialO2);
+
+    // pressure sample interval mean / std dev and gaps, red while the
+    // current window has gaps
+    if (sampleTiming.gaps > 0)
+        tft.setTextColor(TFT_WHITE, TFT_RED);
+    FormatBuffer<DISPLAY_TEXT_SIZE> interval;
+    formatSampleInterval(interval, sampleTiming.meanUs(), sampleTiming.stdUs());
+    tft.drawString(interval.data(), 122, 103, 2);
+    FormatBuffer<DISPLAY_TEXT_SIZE> gaps;
+    formatSampleGaps(gaps, sampleGapsTotal + sampleTiming.gaps, sampleTiming.gapUs);
+    tft.drawString(gaps.data(), 122, 119, 2);
 }
 
 //--------------------------------------------------------
@@ -876,10 +930,12 @@ void GetWeightkg()
 
     Timer5s = millis();
     int weightChanged = 0;
+    char weightText[12];
     tft.fillScreen(TFT_BLUE);
     tft.setTextColor(TFT_WHITE, TFT_BLUE);
     tft.drawString("Enter weight in kg", 20, 10, 4);
-    tft.drawString(String(settings.weightkg), 48, 48, 7);
+    formatFixed(weightText, sizeof(weightText), settings.weightkg, 2);
+    tft.drawString(weightText, 48, 48, 7);
 
     while ((millis() - Timer5s) < 5000)
     {
@@ -909,7 +965,8 @@ void GetWeightkg()
         {
             tft.fillScreen(TFT_BLUE);
             tft.drawString("New weight in kg is:", 10, 10, 4);
-            tft.drawString(String(settings.weightkg), 48, 48, 7);
+            formatFixed(weightText, sizeof(weightText), settings.weightkg, 2);
+            tft.drawString(weightText, 48, 48, 7);
             weightChanged = 0;
             Timer5s = millis();
         }
@@ -932,7 +989,9 @@ uint16_t readVoltage()
     if (Battery_Voltage < 3.7)
         tft.setTextColor(TFT_WHITE, TFT_RED); // battery critical
     tft.setCursor(0, 0, 4);
-    tft.print(String(Battery_Voltage) + "V");
+    FormatBuffer<DISPLAY_TEXT_SIZE> voltageText;
+    formatVoltage(voltageText, Battery_Voltage);
+    tft.print(voltageText.c_str());
     return v;
 }
 
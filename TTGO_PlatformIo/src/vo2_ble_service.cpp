@@ -1,10 +1,79 @@
 #include "vo2_ble_service.h"
+#include "vo2_varint.h"
+
+#define WAVEFORM_STATS_WINDOW_MS 5000
+
+// scaled, rounded and clamped to a u16 field, clamping sets *clipped
+static uint16_t toField(float value, float scale, bool *clipped) {
+    float scaled = value * scale + 0.5f;
+    if (isnan(scaled) || scaled < 0) {
+        *clipped = true;
+        return 0;
+    }
+    if (scaled > 65535) {
+        *clipped = true;
+        return 65535;
+    }
+    return (uint16_t)scaled;
+}
+
+// client has enabled notifications in the characteristic's CCCD
+static bool isSubscribed(NimBLECharacteristic *characteristic) {
+    return characteristic->getSubscribedCount() > 0;
+}
+
+static uint8_t *putU16(uint8_t *p, uint16_t v) {
+    *p++ = v;
+    *p++ = v >> 8;
+    return p;
+}
     
-void VO2BleServer::onConnect(BLEServer *pServer) {
+void VO2BleServer::onConnect(NimBLEServer *pServer, ble_gap_conn_desc *desc) {
     _BLEClientConnected = true; 
+    _connHandle = desc->conn_handle;
+    // nothing requested on this connection yet, the client's own choice
+    // is replaced right away
+    _linkRequested = BLE_LINK_AUTO;
+    updateLink();
 };
-void VO2BleServer::onDisconnect(BLEServer *pServer) {
+void VO2BleServer::onDisconnect(NimBLEServer *pServer) {
     _BLEClientConnected = false;
+    _mtu = BLE_DEFAULT_MTU;
+    _stats.mtu = _mtu;
+    _waveformCount = 0;
+    _downloading = false;
+    clearQueue();
+    // NimBLE restarts advertising by itself, so the client can reconnect
+    // and fetch the history
+}
+
+// history download requests
+void VO2BleServer::onWrite(NimBLECharacteristic *pCharacteristic) {
+    if (pCharacteristic != historyControlCharacteristic)
+        return;
+    NimBLEAttValue value = pCharacteristic->getValue();
+    const uint8_t *data = value.data();
+    if (value.length() >= 3 && data[0] == HISTORY_DOWNLOAD) {
+        startDownload(data[1] | (data[2] << 8));
+    } else if (value.length() >= 1 && data[0] == HISTORY_ABORT) {
+        _downloading = false;
+    }
+}
+
+// waveform (un)subscribed, the link follows in BLE_LINK_AUTO
+void VO2BleServer::onSubscribe(NimBLECharacteristic *pCharacteristic, ble_gap_conn_desc *desc, uint16_t subValue) {
+    if (pCharacteristic == waveformCharacteristic)
+        updateLink();
+}
+
+void VO2BleServer::onMTUChange(uint16_t MTU, ble_gap_conn_desc *desc) {
+    _mtu = MTU;
+    _stats.mtu = _mtu;
+}
+
+// called from within notify(), only the queue task sends notifications
+void VO2BleServer::onStatus(NimBLECharacteristic *pCharacteristic, Status s, int code) {
+    _lastStatus = s;
 }
 
 bool VO2BleServer::isClientConnected() const {
@@ -12,42 +81,395 @@ bool VO2BleServer::isClientConnected() const {
 }
 
 bool VO2BleServer::initialize() {
-    BLEDevice::init("VO2max Sensor");
-    pBLEServer = BLEDevice::createServer();
+    NimBLEDevice::init("VO2max Sensor");
+    NimBLEDevice::setMTU(BLE_REQUESTED_MTU); // the client picks the final value
+    _stats.mtu = _mtu;
+    pBLEServer = NimBLEDevice::createServer();
     pBLEServer->setCallbacks(this);
 
     pBLEService = pBLEServer->createService(VO2MAX_SERVICE_UUID);
-    vo2Characteristic = pBLEService->createCharacteristic(VO2_CHAR_UUID, BLECharacteristic::PROPERTY_NOTIFY);
-    vco2Characteristic = pBLEService->createCharacteristic(VCO2_CHAR_UUID, BLECharacteristic::PROPERTY_NOTIFY);
-    rqCharacteristic = pBLEService->createCharacteristic(RQ_CHAR_UUID, BLECharacteristic::PROPERTY_NOTIFY);
+    vo2Characteristic = pBLEService->createCharacteristic(VO2_CHAR_UUID, NIMBLE_PROPERTY::NOTIFY);
+    vco2Characteristic = pBLEService->createCharacteristic(VCO2_CHAR_UUID, NIMBLE_PROPERTY::NOTIFY);
+    rqCharacteristic = pBLEService->createCharacteristic(RQ_CHAR_UUID, NIMBLE_PROPERTY::NOTIFY);
+    metricsCharacteristic = pBLEService->createCharacteristic(METRICS_CHAR_UUID, NIMBLE_PROPERTY::NOTIFY);
+    waveformCharacteristic = pBLEService->createCharacteristic(WAVEFORM_CHAR_UUID, NIMBLE_PROPERTY::NOTIFY);
+    historyControlCharacteristic = pBLEService->createCharacteristic(HISTORY_CONTROL_UUID, NIMBLE_PROPERTY::WRITE);
+    historyTransferCharacteristic = pBLEService->createCharacteristic(HISTORY_TRANSFER_UUID, NIMBLE_PROPERTY::NOTIFY);
+    i2cStatsCharacteristic = pBLEService->createCharacteristic(I2C_STATS_UUID, NIMBLE_PROPERTY::READ);
+
+    _latestChar[LATEST_VO2] = vo2Characteristic;
+    _latestChar[LATEST_VCO2] = vco2Characteristic;
+    _latestChar[LATEST_RQ] = rqCharacteristic;
 
-    // Add descriptors for each characteristic
-    vo2Characteristic->addDescriptor(new BLE2902());
-    vco2Characteristic->addDescriptor(new BLE2902());
-    rqCharacteristic->addDescriptor(new BLE2902());
+    vo2Characteristic->setCallbacks(this);
+    vco2Characteristic->setCallbacks(this);
+    rqCharacteristic->setCallbacks(this);
+    metricsCharacteristic->setCallbacks(this);
+    waveformCharacteristic->setCallbacks(this);
+    historyControlCharacteristic->setCallbacks(this);
+    historyTransferCharacteristic->setCallbacks(this);
 
     pBLEService->start();
     pBLEServer->getAdvertising()->start();
-    return true;
+    return xTaskCreatePinnedToCore(queueTask, "ble_queue", BLE_QUEUE_STACK, this,
+                                   tskIDLE_PRIORITY + 1, &_queueTask, 0) == pdPASS;
 }
 
 void VO2BleServer::pushVO2Data(float vo2Max) {
-    if (vo2Characteristic) {
-        vo2Characteristic->setValue(vo2Max);
-        vo2Characteristic->notify();
-    }
+    setLatest(LATEST_VO2, vo2Max);
 }
 
 void VO2BleServer::pushVCO2Data(float vco2Max) {
-    if (vco2Characteristic) {
-        vco2Characteristic->setValue(vco2Max);
-        vco2Characteristic->notify();
-    }
+    setLatest(LATEST_VCO2, vco2Max);
 }
 
 void VO2BleServer::pushRQData(float respq) {
-    if (rqCharacteristic) {
-        rqCharacteristic->setValue(respq);
-        rqCharacteristic->notify();
+    setLatest(LATEST_RQ, respq);
+}
+
+void VO2BleServer::pushMetrics(const VO2Metrics &metrics) {
+    if (!metricsCharacteristic)
+        return;
+    bool clipped = false;
+    uint8_t value[METRICS_SIZE];
+    uint8_t *p = putU16(value, (uint16_t)metrics.seq);
+    *p++ = metrics.timeMs;
+    *p++ = metrics.timeMs >> 8;
+    *p++ = metrics.timeMs >> 16;
+    *p++ = metrics.timeMs >> 24;
+    p = putU16(p, toField(metrics.vo2, 1, &clipped));
+    p = putU16(p, toField(metrics.vco2, 1, &clipped));
+    p = putU16(p, toField(metrics.rq, 1000, &clipped));
+    p = putU16(p, toField(metrics.ve, 100, &clipped));
+    p = putU16(p, toField(metrics.vt, 1000, &clipped));
+    p = putU16(p, toField(metrics.br, 10, &clipped));
+    *p++ = metrics.flags | (clipped ? METRICS_FLAG_CLIPPED : 0);
+    addHistory(metrics.seq, value);
+    enqueue(metricsCharacteristic, value, sizeof(value));
+}
+
+bool VO2BleServer::isWaveformSubscribed() const {
+    return _BLEClientConnected && waveformCharacteristic && isSubscribed(waveformCharacteristic);
+}
+
+void VO2BleServer::setI2CStats(const uint8_t *data, size_t len) {
+    if (i2cStatsCharacteristic)
+        i2cStatsCharacteristic->setValue(data, len);
+}
+
+void VO2BleServer::pushFlowSample(uint32_t timeUs, float flow) {
+    if (!isWaveformSubscribed())
+        return;
+    float mlPerSec = flow * 1000;
+    int16_t value = mlPerSec > 32767 ? 32767 : mlPerSec < -32768 ? -32768 : (int16_t)lroundf(mlPerSec);
+
+    if (_waveformCount > 0) {
+        size_t limit = min((size_t)(_mtu - 3), (size_t)WAVEFORM_MAX_PACKET);
+        if (_waveformLen + 2 * VARINT_MAX_BYTES > limit || _waveformCount == 255 ||
+            timeUs - _waveformStartUs >= WAVEFORM_MAX_AGE_US)
+            sendWaveform();
+    }
+    if (_waveformCount == 0) {
+        uint8_t *p = _waveform;
+        *p++ = _waveformSeq;
+        *p++ = _waveformSeq >> 8;
+        *p++ = timeUs;
+        *p++ = timeUs >> 8;
+        *p++ = timeUs >> 16;
+        *p++ = timeUs >> 24;
+        *p++ = (uint16_t)value;
+        *p++ = (uint16_t)value >> 8;
+        _waveformLen = WAVEFORM_HEADER;
+        _waveformStartUs = timeUs;
+    } else {
+        uint8_t *p = &_waveform[_waveformLen];
+        p = putUVarint(p, timeUs - _waveformLastUs);
+        p = putSVarint(p, (int32_t)value - _waveformLastFlow);
+        _waveformLen = p - _waveform;
+    }
+    _waveformLastUs = timeUs;
+    _waveformLastFlow = value;
+    _waveformCount++;
+
+    uint32_t now = millis();
+    if (now - _windowStartMs >= WAVEFORM_STATS_WINDOW_MS) {
+        _stats.samplesPerSec = _windowSamples * 1000.0f / (now - _windowStartMs);
+        _windowSamples = 0;
+        _windowStartMs = now;
     }
 }
+
+void VO2BleServer::sendWaveform() {
+    _waveform[8] = _waveformCount;
+    enqueue(waveformCharacteristic, _waveform, _waveformLen, _waveformCount);
+    _waveformSeq++;
+    _waveformCount = 0;
+}
+
+WaveformStats VO2BleServer::waveformStats() const {
+    return _stats;
+}
+
+BleQueueStats VO2BleServer::queueStats() const {
+    return _queueStats;
+}
+
+void VO2BleServer::setLatest(bleLatestSlots slot, float value) {
+    if (!_BLEClientConnected || !_latestChar[slot] || !isSubscribed(_latestChar[slot]))
+        return;
+    portENTER_CRITICAL(&_queueLock);
+    if (_latestDirty & (1 << slot))
+        _queueStats.coalesced++;
+    _latestValue[slot] = value;
+    _latestDirty |= 1 << slot;
+    _queueStats.queued++;
+    portEXIT_CRITICAL(&_queueLock);
+    xTaskNotifyGive(_queueTask);
+}
+
+bool VO2BleServer::enqueue(NimBLECharacteristic *characteristic, const uint8_t *data, size_t len, uint8_t samples) {
+    if (!_BLEClientConnected || !characteristic || len > WAVEFORM_MAX_PACKET || !isSubscribed(characteristic))
+        return false;
+    portENTER_CRITICAL(&_queueLock);
+    if (_queueCount == BLE_QUEUE_LENGTH) {
+        _queueStats.dropped++;
+        portEXIT_CRITICAL(&_queueLock);
+        return false;
+    }
+    // the tail slot is not touched by the queue task until it is counted
+    BleQueueItem &item = _queue[(_queueHead + _queueCount) % BLE_QUEUE_LENGTH];
+    portEXIT_CRITICAL(&_queueLock);
+
+    item.characteristic = characteristic;
+    item.len = len;
+    item.samples = samples;
+    memcpy(item.data, data, len);
+
+    portENTER_CRITICAL(&_queueLock);
+    _queueCount++;
+    _queueStats.queued++;
+    portEXIT_CRITICAL(&_queueLock);
+    xTaskNotifyGive(_queueTask);
+    return true;
+}
+
+void VO2BleServer::clearQueue() {
+    portENTER_CRITICAL(&_queueLock);
+    _queueStats.dropped += _queueCount;
+    _queueHead = 0;
+    _queueCount = 0;
+    _latestDirty = 0;
+    portEXIT_CRITICAL(&_queueLock);
+}
+
+void VO2BleServer::queueTask(void *arg) {
+    static_cast<VO2BleServer *>(arg)->serviceQueue();
+}
+
+void VO2BleServer::serviceQueue() {
+    while (true) {
+        // a running download keeps the task busy, live data still goes first
+        ulTaskNotifyTake(pdTRUE, _downloading ? 1 : pdMS_TO_TICKS(100));
+
+        // ordered records first, oldest to newest
+        while (true) {
+            portENTER_CRITICAL(&_queueLock);
+            bool empty = _queueCount == 0;
+            size_t head = _queueHead;
+            portEXIT_CRITICAL(&_queueLock);
+            if (empty)
+                break;
+
+            bool sent = sendItem(_queue[head]);
+
+            portENTER_CRITICAL(&_queueLock);
+            if (_queueCount > 0 && _queueHead == head) { // not cleared by a disconnect meanwhile
+                _queueHead = (_queueHead + 1) % BLE_QUEUE_LENGTH;
+                _queueCount--;
+                if (sent)
+                    _queueStats.sent++;
+                else
+                    _queueStats.dropped++;
+            }
+            portEXIT_CRITICAL(&_queueLock);
+        }
+
+        // then whatever latest values are pending
+        portENTER_CRITICAL(&_queueLock);
+        uint8_t dirty = _latestDirty;
+        float values[LATEST_COUNT];
+        memcpy(values, _latestValue, sizeof(values));
+        _latestDirty = 0;
+        portEXIT_CRITICAL(&_queueLock);
+        for (uint8_t slot = 0; slot < LATEST_COUNT; slot++) {
+            if (!(dirty & (1 << slot)))
+                continue;
+            bool sent = notifyNow(_latestChar[slot], (const uint8_t *)&values[slot], sizeof(float));
+            portENTER_CRITICAL(&_queueLock);
+            if (sent)
+                _queueStats.sent++;
+            else
+                _queueStats.dropped++;
+            portEXIT_CRITICAL(&_queueLock);
+        }
+
+        // history download, one packet per pass so live data goes first
+        if (_downloading)
+            sendHistoryPacket();
+    }
+}
+
+// one ordered record, retried while the stack refuses it
+bool VO2BleServer::sendItem(const BleQueueItem &item) {
+    for (uint8_t attempt = 0; attempt < BLE_QUEUE_RETRIES; attempt++) {
+        if (!_BLEClientConnected)
+            return false;
+        if (notifyNow(item.characteristic, item.data, item.len)) {
+            if (item.characteristic == waveformCharacteristic) {
+                _stats.samples += item.samples;
+                _stats.packets++;
+                _stats.bytes += item.len;
+                _windowSamples += item.samples;
+            }
+            return true;
+        }
+        if (_lastStatus == NimBLECharacteristicCallbacks::Status::ERROR_NOTIFY_DISABLED)
+            return false; // not subscribed, retrying won't help
+        if (item.characteristic == waveformCharacteristic)
+            _stats.notifyFailures++;
+        vTaskDelay(pdMS_TO_TICKS(BLE_QUEUE_RETRY_MS));
+    }
+    return false;
+}
+
+bool VO2BleServer::notifyNow(NimBLECharacteristic *characteristic, const uint8_t *data, size_t len) {
+    _lastStatus = NimBLECharacteristicCallbacks::Status::ERROR_GATT;
+    characteristic->notify(data, len); // sent without copying into the attribute value
+    return _lastStatus == NimBLECharacteristicCallbacks::Status::SUCCESS_NOTIFY;
+}
+
+void VO2BleServer::addHistory(uint32_t seq, const uint8_t *record) {
+    portENTER_CRITICAL(&_queueLock);
+    if (_historyCount > 0 && seq != _historyNewest + 1)
+        _historyCount = 0; // seq jumped, older records can't be addressed any more
+    memcpy(_history[seq % HISTORY_LENGTH], record, METRICS_SIZE);
+    _historyNewest = seq;
+    if (_historyCount < HISTORY_LENGTH)
+        _historyCount++;
+    portEXIT_CRITICAL(&_queueLock);
+}
+
+void VO2BleServer::startDownload(uint16_t fromSeq) {
+    portENTER_CRITICAL(&_queueLock);
+    uint32_t oldest = _historyNewest + 1 - _historyCount;
+    uint16_t offset = fromSeq - (uint16_t)oldest; // the client only knows the low 16 bits
+    if (offset <= _historyCount)
+        _downloadSeq = oldest + offset; // offset == count: client is up to date
+    else
+        _downloadSeq = oldest; // too old, send all that is left
+    _downloadEnd = _historyNewest;
+    _downloadPacket = 0;
+    _downloading = true;
+    portEXIT_CRITICAL(&_queueLock);
+    updateLink();
+    xTaskNotifyGive(_queueTask);
+}
+
+// called by the queue task, returns false once the download is finished
+bool VO2BleServer::sendHistoryPacket() {
+    if (!_BLEClientConnected || !isSubscribed(historyTransferCharacteristic)) {
+        _downloading = false;
+        return false;
+    }
+    uint8_t packet[WAVEFORM_MAX_PACKET];
+    size_t len = 0;
+    size_t perPacket = (min((size_t)(_mtu - 3), sizeof(packet)) - 2) / METRICS_SIZE;
+
+    portENTER_CRITICAL(&_queueLock);
+    uint32_t oldest = _historyNewest + 1 - _historyCount;
+    if ((int32_t)(_downloadSeq - oldest) < 0)
+        _downloadSeq = oldest; // overwritten while downloading
+    uint32_t remaining = (int32_t)(_downloadEnd + 1 - _downloadSeq) > 0 ? _downloadEnd + 1 - _downloadSeq : 0;
+    packet[len++] = _downloadPacket;
+    packet[len++] = _downloadPacket >> 8;
+    if (_downloadPacket == 0) {
+        packet[len++] = _downloadSeq;
+        packet[len++] = _downloadSeq >> 8;
+        packet[len++] = remaining;
+        packet[len++] = remaining >> 8;
+        packet[len++] = METRICS_SIZE;
+    } else {
+        for (size_t i = 0; i < perPacket && remaining > 0; i++, remaining--) {
+            memcpy(&packet[len], _history[_downloadSeq % HISTORY_LENGTH], METRICS_SIZE);
+            len += METRICS_SIZE;
+            _downloadSeq++;
+        }
+    }
+    portEXIT_CRITICAL(&_queueLock);
+
+    bool sent = false;
+    for (uint8_t attempt = 0; attempt < BLE_QUEUE_RETRIES && !sent; attempt++) {
+        sent = notifyNow(historyTransferCharacteristic, packet, len);
+        if (!sent)
+            vTaskDelay(pdMS_TO_TICKS(BLE_QUEUE_RETRY_MS));
+    }
+    if (!sent || remaining == 0) {
+        _downloading = false; // finished, or the client has to ask again
+        updateLink();
+        return false;
+    }
+    _downloadPacket++;
+    return true;
+}
+
+void VO2BleServer::setLinkMode(bleLinkModes mode) {
+    _linkMode = mode;
+    updateLink();
+}
+
+bleLinkModes VO2BleServer::linkMode() const {
+    return _linkMode;
+}
+
+// asks the client for the parameters of the wanted mode, if they changed
+void VO2BleServer::updateLink() {
+    if (!_BLEClientConnected)
+        return;
+    bleLinkModes wanted = _linkMode;
+    if (wanted == BLE_LINK_AUTO)
+        wanted = isSubscribed(waveformCharacteristic) || _downloading ? BLE_LINK_STREAMING : BLE_LINK_LOW_POWER;
+    if (wanted == _linkRequested)
+        return;
+    _linkRequested = wanted;
+    if (wanted == BLE_LINK_STREAMING) {
+        pBLEServer->updateConnParams(_connHandle, BLE_STREAMING_MIN_INTERVAL, BLE_STREAMING_MAX_INTERVAL,
+                                     BLE_STREAMING_LATENCY, BLE_STREAMING_TIMEOUT);
+#if !defined(CONFIG_IDF_TARGET_ESP32) // the original ESP32 is Bluetooth 4.2, 1M PHY only
+        ble_gap_set_prefered_le_phy(_connHandle, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_CODED_ANY);
+#endif
+    } else {
+        pBLEServer->updateConnParams(_connHandle, BLE_LOW_POWER_MIN_INTERVAL, BLE_LOW_POWER_MAX_INTERVAL,
+                                     BLE_LOW_POWER_LATENCY, BLE_LOW_POWER_TIMEOUT);
+#if !defined(CONFIG_IDF_TARGET_ESP32)
+        ble_gap_set_prefered_le_phy(_connHandle, BLE_GAP_LE_PHY_1M_MASK, BLE_GAP_LE_PHY_1M_MASK, BLE_GAP_LE_PHY_CODED_ANY);
+#endif
+    }
+}
+
+// negotiated values, read back from the host stack
+BleLinkInfo VO2BleServer::linkInfo() {
+    BleLinkInfo info = {};
+    info.requested = _linkRequested;
+    info.mtu = _mtu;
+    info.txPhy = info.rxPhy = 1;
+    if (!_BLEClientConnected)
+        return info;
+    NimBLEConnInfo peer = pBLEServer->getPeerIDInfo(_connHandle);
+    info.intervalMs = peer.getConnInterval() * 1.25f;
+    info.latency = peer.getConnLatency();
+    info.timeoutMs = peer.getConnTimeout() * 10;
+#if !defined(CONFIG_IDF_TARGET_ESP32)
+    ble_gap_read_le_phy(_connHandle, &info.txPhy, &info.rxPhy);
+#endif
+    return info;
+}
@@ -1,16 +1,10 @@
 #pragma once
 
-// declarations for bluetooth serial --------------
-#include "BluetoothSerial.h"
-#if !defined(CONFIG_BT_ENABLED) || !defined(CONFIG_BLUEDROID_ENABLED)
-#error Bluetooth is not enabled! Please run `make menuconfig` to and enable it
-#endif
-
 // declarations for BLE ---------------------
-#include <BLE2902.h> // used for notifications 0x2902: Client Characteristic Configuration
-#include <BLEDevice.h>
-#include <BLEServer.h>
-#include <BLEUtils.h>
+// NimBLE host instead of Bluedroid: no Classic BT, smaller heap and flash
+// footprint. The CCCD (0x2902) is added by NimBLE for every NOTIFY
+// characteristic.
+#include <NimBLEDevice.h>
 
 // Service UUID
 const char VO2MAX_SERVICE_UUID[] = "12345678-1234-5678-1234-56789abcdef0";
@@ -18,26 +12,241 @@ const char VO2MAX_SERVICE_UUID[] = "12345678-1234-5678-1234-56789abcdef0";
 const char VO2_CHAR_UUID[] = "12345678-1234-5678-1234-56789abcdef1";
 const char VCO2_CHAR_UUID[] = "12345678-1234-5678-1234-56789abcdef2";
 const char RQ_CHAR_UUID[] = "12345678-1234-5678-1234-56789abcdef3";
+// All per-breath values packed into one notification
+const char METRICS_CHAR_UUID[] = "12345678-1234-5678-1234-56789abcdef4";
+
+// Packed metrics notification, little-endian, 19 bytes so it fits the
+// default ATT MTU (23) without fragmentation:
+//   u16 seq       breath sequence number (wraps)
+//   u32 timeMs    end of expiration, ms since boot
+//   u16 vo2       ml/min
+//   u16 vco2      ml/min
+//   u16 rq        RQ * 1000
+//   u16 ve        minute ventilation, L/min * 100
+//   u16 vt        tidal volume, ml
+//   u16 br        breath rate, 1/min * 10
+//   u8  flags     metricsFlags
+#define METRICS_SIZE 19
+
+// Live flow curve, batched and delta encoded, one packet per notification:
+//   u16 packetSeq, u32 t0Us, i16 flow0 (ml/s), u8 count,
+//   then per further sample uvarint(dt us) and svarint(flow delta ml/s)
+// A packet is sent when the next sample would not fit the negotiated MTU
+// or WAVEFORM_MAX_AGE_US after its first sample.
+const char WAVEFORM_CHAR_UUID[] = "12345678-1234-5678-1234-56789abcdef5";
+#define WAVEFORM_HEADER 9
+#define WAVEFORM_MAX_PACKET 509     // largest notification with MTU 512
+#define WAVEFORM_MAX_AGE_US 200000
+#define BLE_REQUESTED_MTU 517
+#define BLE_DEFAULT_MTU 23
+
+struct WaveformStats
+{
+    uint32_t samples;        // samples sent in accepted notifications
+    uint32_t packets;
+    uint32_t bytes;
+    uint32_t notifyFailures; // notify() reported by the stack as failed
+    float samplesPerSec;     // over the last completed measuring window
+    uint16_t mtu;
+};
+
+// History of the packed metrics records, so a client that lost the
+// connection can fetch the breaths it missed.
+// Control (write): [u8 HISTORY_DOWNLOAD][u16 first seq wanted]
+//                  or [u8 HISTORY_ABORT]
+// Transfer (notify): header [u16 0][u16 first seq][u16 count][u8 METRICS_SIZE]
+//                    then [u16 packet seq 1..n][as many records as fit the MTU]
+// If the wanted seq is no longer kept the download starts at the oldest
+// record; the header tells the client where it really starts. Records
+// keep their own seq, so breaths overwritten during a slow download show
+// up as a gap.
+const char HISTORY_CONTROL_UUID[] = "12345678-1234-5678-1234-56789abcdef6";
+const char HISTORY_TRANSFER_UUID[] = "12345678-1234-5678-1234-56789abcdef7";
+#define HISTORY_LENGTH 512 // breaths, about 25 min at 20 breaths/min
+
+// I2C transaction counters and latencies per sensor (read only), the
+// i2cStatsPack() layout in lib/I2CStats/src/vo2_i2c_stats.h. Updated by
+// loop() once per breath.
+const char I2C_STATS_UUID[] = "12345678-1234-5678-1234-56789abcdef8";
+
+enum historyOpcodes
+{
+    HISTORY_DOWNLOAD = 0x01,
+    HISTORY_ABORT = 0x02,
+};
+
+// Outbound notifications are queued and sent by a task on core 0, so
+// loop() never waits for the BLE stack. The single value characteristics
+// only keep their latest value (a newer value replaces an unsent one);
+// per-breath metrics and waveform packets are delivered in order and
+// retried while the stack is congested.
+#define BLE_QUEUE_LENGTH 8     // ordered records waiting to be sent
+#define BLE_QUEUE_RETRIES 3    // notify attempts before a record is dropped
+#define BLE_QUEUE_RETRY_MS 20
+#define BLE_QUEUE_STACK 4096
+
+enum bleLatestSlots
+{
+    LATEST_VO2,
+    LATEST_VCO2,
+    LATEST_RQ,
+    LATEST_COUNT
+};
+
+struct BleQueueStats
+{
+    uint32_t queued;    // notifications accepted into the queue or a latest slot
+    uint32_t sent;      // notifications the stack accepted
+    uint32_t coalesced; // latest values replaced before they were sent
+    uint32_t dropped;   // queue full, retries exhausted or client gone
+};
+
+struct BleQueueItem
+{
+    NimBLECharacteristic *characteristic;
+    uint16_t len;
+    uint8_t samples; // waveform samples carried, for the throughput stats
+    uint8_t data[WAVEFORM_MAX_PACKET];
+};
+
+// Connection parameters requested from the client, in BLE units
+// (interval 1.25 ms, supervision timeout 10 ms). Chosen within the limits
+// iOS accepts: max * (latency + 1) <= 2 s, timeout > 3 * that.
+// Low power: one metrics record per breath, the radio mostly sleeps.
+#define BLE_LOW_POWER_MIN_INTERVAL 80  // 100 ms
+#define BLE_LOW_POWER_MAX_INTERVAL 160 // 200 ms
+#define BLE_LOW_POWER_LATENCY 4
+#define BLE_LOW_POWER_TIMEOUT 500      // 5 s
+// Streaming: waveform packets or a history download.
+#define BLE_STREAMING_MIN_INTERVAL 12  // 15 ms
+#define BLE_STREAMING_MAX_INTERVAL 24  // 30 ms
+#define BLE_STREAMING_LATENCY 0
+#define BLE_STREAMING_TIMEOUT 200      // 2 s
+
+enum bleLinkModes
+{
+    BLE_LINK_AUTO,       // streaming while the waveform is subscribed or a download runs
+    BLE_LINK_LOW_POWER,
+    BLE_LINK_STREAMING,
+};
+
+// what the connection actually runs with
+struct BleLinkInfo
+{
+    bleLinkModes requested; // BLE_LINK_LOW_POWER or BLE_LINK_STREAMING, AUTO until connected
+    float intervalMs;
+    uint16_t latency;       // connection events the peripheral may skip
+    uint16_t timeoutMs;
+    uint8_t txPhy;          // 1 = 1M, 2 = 2M, 3 = coded
+    uint8_t rxPhy;
+    uint16_t mtu;
+};
+
+enum metricsFlags
+{
+    METRICS_FLAG_DEMO = 0x01,         // values are from DEMO mode
+    METRICS_FLAG_SENSOR_LIMIT = 0x02, // flow sensor was over range during the breath
+    METRICS_FLAG_CLIPPED = 0x04,      // a value did not fit its field and was clamped
+};
+
+struct VO2Metrics
+{
+    uint32_t seq;
+    uint32_t timeMs;
+    float vo2;      // ml/min
+    float vco2;     // ml/min
+    float rq;
+    float ve;       // L/min
+    float vt;       // L
+    float br;       // 1/min
+    uint8_t flags;  // metricsFlags
+};
 
 
-class VO2BleServer : public BLEServerCallbacks
+class VO2BleServer : public NimBLEServerCallbacks, public NimBLECharacteristicCallbacks
 {
 public:
-    void onConnect(BLEServer *pServer);
-    void onDisconnect(BLEServer *pServer);
+    void onConnect(NimBLEServer *pServer, ble_gap_conn_desc *desc);
+    void onDisconnect(NimBLEServer *pServer);
+    void onMTUChange(uint16_t MTU, ble_gap_conn_desc *desc);
+    void onStatus(NimBLECharacteristic *pCharacteristic, Status s, int code);
+    void onWrite(NimBLECharacteristic *pCharacteristic);
+    void onSubscribe(NimBLECharacteristic *pCharacteristic, ble_gap_conn_desc *desc, uint16_t subValue);
     bool isClientConnected() const;
     bool initialize();
     void pushVO2Data(float vo2Max);
     void pushVCO2Data(float vco2Max);
     void pushRQData(float respq);
+    void pushMetrics(const VO2Metrics &metrics);
+    void pushFlowSample(uint32_t timeUs, float flow);
+    WaveformStats waveformStats() const;
+    bool isWaveformSubscribed() const;
+    void setI2CStats(const uint8_t *data, size_t len);
+    BleQueueStats queueStats() const;
+    void setLinkMode(bleLinkModes mode);
+    bleLinkModes linkMode() const;
+    BleLinkInfo linkInfo();
 private:
+    void sendWaveform();
+    bool enqueue(NimBLECharacteristic *characteristic, const uint8_t *data, size_t len, uint8_t samples = 0);
+    void setLatest(bleLatestSlots slot, float value);
+    void clearQueue();
+    static void queueTask(void *arg);
+    void serviceQueue();
+    bool sendItem(const BleQueueItem &item);
+    bool notifyNow(NimBLECharacteristic *characteristic, const uint8_t *data, size_t len);
+    void addHistory(uint32_t seq, const uint8_t *record);
+    void startDownload(uint16_t fromSeq);
+    bool sendHistoryPacket();
+    void updateLink();
     bool _BLEClientConnected = false;
     // BLE server and JSON characteristic for telemetry
-    BLEServer *pBLEServer;
-    BLEService *pBLEService;
-    BLECharacteristic *vo2Characteristic; // raw value of VO2 in ml/min
-    BLECharacteristic *vco2Characteristic; // raw value of VCO2 in ml/min
-    BLECharacteristic *rqCharacteristic; // raw value of RQ in mol VCO2 / mol VO2
-    BluetoothSerial SerialBT;
+    NimBLEServer *pBLEServer;
+    NimBLEService *pBLEService;
+    NimBLECharacteristic *vo2Characteristic; // raw value of VO2 in ml/min
+    NimBLECharacteristic *vco2Characteristic; // raw value of VCO2 in ml/min
+    NimBLECharacteristic *rqCharacteristic; // raw value of RQ in mol VCO2 / mol VO2
+    NimBLECharacteristic *metricsCharacteristic; // packed VO2Metrics, see METRICS_SIZE
+    NimBLECharacteristic *waveformCharacteristic; // batched flow samples
+    NimBLECharacteristic *historyControlCharacteristic;
+    NimBLECharacteristic *historyTransferCharacteristic;
+    NimBLECharacteristic *i2cStatsCharacteristic; // packed I2C counters, read only
+    uint16_t _mtu = BLE_DEFAULT_MTU;
+    // connection parameters
+    uint16_t _connHandle;
+    bleLinkModes _linkMode = BLE_LINK_AUTO;
+    bleLinkModes _linkRequested = BLE_LINK_AUTO; // last request sent to the client, AUTO = none
+    // waveform packet being filled
+    uint8_t _waveform[WAVEFORM_MAX_PACKET];
+    size_t _waveformLen = 0;
+    uint8_t _waveformCount = 0;
+    uint16_t _waveformSeq = 0;
+    uint32_t _waveformStartUs;
+    uint32_t _waveformLastUs;
+    int16_t _waveformLastFlow;
+    // throughput
+    WaveformStats _stats = {};
+    uint32_t _windowStartMs = 0;
+    uint32_t _windowSamples = 0;
+    // outbound queue
+    BleQueueItem _queue[BLE_QUEUE_LENGTH];
+    size_t _queueHead = 0;
+    size_t _queueCount = 0;
+    NimBLECharacteristic *_latestChar[LATEST_COUNT] = {};
+    float _latestValue[LATEST_COUNT];
+    uint8_t _latestDirty = 0; // bit per bleLatestSlots
+    BleQueueStats _queueStats = {};
+    portMUX_TYPE _queueLock = portMUX_INITIALIZER_UNLOCKED;
+    TaskHandle_t _queueTask = nullptr;
+    volatile Status _lastStatus; // set by onStatus() during notify()
+    // history of packed metrics, guarded by _queueLock
+    uint8_t _history[HISTORY_LENGTH][METRICS_SIZE];
+    uint32_t _historyNewest = 0; // seq of the newest record
+    size_t _historyCount = 0;
+    // running download, sent by the queue task when no live data is pending
+    volatile bool _downloading = false;
+    uint32_t _downloadSeq;       // next record to send
+    uint32_t _downloadEnd;       // newest record when the download was requested
+    uint16_t _downloadPacket;    // next transfer packet seq, 0 = header
 
 };
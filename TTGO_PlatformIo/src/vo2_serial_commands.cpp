@@ -0,0 +1,62 @@
+#include "vo2_serial_commands.h"
+#include "vo2_telemetry.h"
+#include "vo2_telemetry_sink.h"
+
+#include <stdarg.h>
+
+void SerialCommands::begin(Stream *in, const SerialCommand *table, size_t count) {
+    _in = in;
+    _table = table;
+    _count = count;
+    _len = 0;
+}
+
+void SerialCommands::poll() {
+    if (!_in)
+        return;
+    while (_in->available() > 0) {
+        char c = _in->read();
+        if (c == '\r' || c == '\n') {
+            if (_len > 0 && !_overflow) {
+                _line[_len] = '\0';
+                execute();
+            }
+            _len = 0;
+            _overflow = false;
+        } else if (_len < COMMAND_LINE_MAX - 1) {
+            _line[_len++] = c;
+        } else {
+            _overflow = true; // the whole line is ignored
+        }
+    }
+}
+
+void SerialCommands::execute() {
+    char *argv[COMMAND_MAX_ARGS];
+    int argc = 0;
+    char *save;
+    for (char *word = strtok_r(_line, " ", &save); word && argc < COMMAND_MAX_ARGS; word = strtok_r(nullptr, " ", &save))
+        argv[argc++] = word;
+    if (argc == 0)
+        return;
+    for (size_t i = 0; i < _count; i++) {
+        if (strcmp(argv[0], _table[i].name) == 0) {
+            _lastCommandMs = millis();
+            _table[i].handler(argc, argv);
+            return;
+        }
+    }
+    reply(REPLY_UNKNOWN, "unknown command %s", argv[0]);
+}
+
+bool SerialCommands::reply(uint8_t status, const char *format, ...) {
+    char text[REPLY_MAX_TEXT + 1];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    uint8_t frame[TELEMETRY_FRAME_SIZE(1 + REPLY_MAX_TEXT)];
+    return telemetrySink.enqueue(frame, telemetryReplyFrame(status, text, frame));
+}
+
+SerialCommands serialCommands;
@@ -0,0 +1,47 @@
+#pragma once
+
+// Text commands from the host on the wired serial port.
+//
+// One command per line, words separated by spaces, e.g.
+//   get /s0001.vo2 0 65536
+// Replies and data go back as telemetry frames (TELEMETRY_REPLY, ...)
+// through the telemetry sink, so they never interleave with other output.
+// Every command ends with exactly one TELEMETRY_REPLY.
+
+#include <Arduino.h>
+
+#define COMMAND_LINE_MAX 80
+#define COMMAND_MAX_ARGS 6
+
+typedef void (*commandHandler)(int argc, char **argv);
+
+struct SerialCommand
+{
+    const char *name;
+    commandHandler handler; // argv[0] is the command name
+    const char *help;
+};
+
+class SerialCommands
+{
+public:
+    void begin(Stream *in, const SerialCommand *table, size_t count);
+    // reads what has arrived and runs complete lines, never blocks
+    void poll();
+    bool reply(uint8_t status, const char *format, ...) __attribute__((format(printf, 3, 4)));
+    // millis() of the last recognised command
+    uint32_t lastCommandMs() const { return _lastCommandMs; }
+
+private:
+    void execute();
+
+    Stream *_in = nullptr;
+    const SerialCommand *_table = nullptr;
+    size_t _count = 0;
+    char _line[COMMAND_LINE_MAX];
+    size_t _len = 0;
+    bool _overflow = false;
+    volatile uint32_t _lastCommandMs = 0;
+};
+
+extern SerialCommands serialCommands;
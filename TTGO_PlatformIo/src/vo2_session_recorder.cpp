@@ -0,0 +1,185 @@
+#include "vo2_session_recorder.h"
+
+#include <LittleFS.h>
+
+static const uint8_t STREAM_BLOCK_TYPES[SESSION_STREAM_COUNT] = {
+    SESSION_BLOCK_BREATHS, SESSION_BLOCK_PRESSURE, SESSION_BLOCK_GAS};
+
+// next free "/sNNNN.vo2"
+static uint16_t nextSessionNumber() {
+    uint16_t last = 0;
+    File root = LittleFS.open("/");
+    for (File f = root.openNextFile(); f; f = root.openNextFile()) {
+        const char *name = strrchr(f.name(), '/');
+        name = name ? name + 1 : f.name();
+        if (name[0] == 's') {
+            uint16_t n = strtoul(name + 1, nullptr, 10);
+            if (n > last)
+                last = n;
+        }
+    }
+    return last + 1;
+}
+
+bool SessionRecorder::begin(const SessionInfo &info) {
+    if (_recording)
+        return true;
+    if (!LittleFS.begin(true))
+        return false;
+    snprintf(_name, sizeof(_name), "/s%04u.vo2", (unsigned)nextSessionNumber());
+    _file = LittleFS.open(_name, FILE_WRITE);
+    if (!_file)
+        return false;
+
+    static SessionBlock header;
+    sessionBlockStart(header, SESSION_BLOCK_INFO, _blockSeq++);
+    sessionBlockInfo(header, info);
+    sessionBlockFinish(header);
+    if (!writeBlock(header.data, SESSION_MIN_FREE))
+        return false;
+
+    _recording = true;
+    if (_task)
+        return true;
+    // lowest priority above idle, away from the loop() core
+    return xTaskCreatePinnedToCore(writerTask, "session", SESSION_STACK, this,
+                                   tskIDLE_PRIORITY + 1, &_task, 0) == pdPASS;
+}
+
+bool SessionRecorder::record(const BreathRecord &rec) {
+    if (!_recording)
+        return false;
+    portENTER_CRITICAL(&_lock);
+    bool added = sessionBlockAddBreath(*fillBlock(SESSION_STREAM_BREATHS), rec);
+    bool sealed = false;
+    if (!added || _fill[SESSION_STREAM_BREATHS].count == SESSION_RECORDS_PER_BLOCK)
+        sealed = seal(SESSION_STREAM_BREATHS);
+    if (!added)
+        added = sessionBlockAddBreath(*fillBlock(SESSION_STREAM_BREATHS), rec);
+    portEXIT_CRITICAL(&_lock);
+
+    if (sealed)
+        xTaskNotifyGive(_task);
+    return added;
+}
+
+bool SessionRecorder::recordPressure(uint64_t timeUs, uint16_t code) {
+    if (!_recording || _rawFull)
+        return false;
+    portENTER_CRITICAL(&_lock);
+    bool sealed = false;
+    bool added = sessionBlockAddPressure(*fillBlock(SESSION_STREAM_PRESSURE), timeUs, code);
+    if (!added) {
+        sealed = seal(SESSION_STREAM_PRESSURE);
+        added = sessionBlockAddPressure(*fillBlock(SESSION_STREAM_PRESSURE), timeUs, code);
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    if (sealed)
+        xTaskNotifyGive(_task);
+    return added;
+}
+
+bool SessionRecorder::recordGas(uint64_t timeUs, float o2, float co2ppm) {
+    if (!_recording || _rawFull)
+        return false;
+    portENTER_CRITICAL(&_lock);
+    bool sealed = false;
+    bool added = sessionBlockAddGas(*fillBlock(SESSION_STREAM_GAS), timeUs, o2, co2ppm);
+    if (!added) {
+        sealed = seal(SESSION_STREAM_GAS);
+        added = sessionBlockAddGas(*fillBlock(SESSION_STREAM_GAS), timeUs, o2, co2ppm);
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    if (sealed)
+        xTaskNotifyGive(_task);
+    return added;
+}
+
+// called with _lock held, starts the stream's block on its first entry
+SessionBlock *SessionRecorder::fillBlock(sessionStreams stream) {
+    SessionBlock &block = _fill[stream];
+    if (block.count == 0) {
+        sessionBlockStart(block, STREAM_BLOCK_TYPES[stream], _blockSeq++);
+        _fillStartMs[stream] = millis();
+    }
+    return &block;
+}
+
+// called with _lock held, hands the stream's block to the writer,
+// false if the writer is behind and the block is lost
+bool SessionRecorder::seal(sessionStreams stream) {
+    SessionBlock &block = _fill[stream];
+    if (_sealed == SESSION_BUFFER_BLOCKS) {
+        _dropped++;
+        block.count = 0;
+        return false;
+    }
+    _sealedBlocks[(_writeIdx + _sealed) % SESSION_BUFFER_BLOCKS] = block;
+    _sealed++;
+    block.count = 0;
+    return true;
+}
+
+// appends the block and syncs it to flash
+bool SessionRecorder::writeBlock(uint8_t *data, size_t minFree) {
+    if (LittleFS.totalBytes() - LittleFS.usedBytes() < minFree)
+        return false;
+    if (_file.write(data, SESSION_BLOCK_SIZE) != SESSION_BLOCK_SIZE)
+        return false;
+    _file.flush();
+    _written++;
+    return true;
+}
+
+void SessionRecorder::writerTask(void *arg) {
+    static_cast<SessionRecorder *>(arg)->writer();
+}
+
+void SessionRecorder::writer() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+
+        // don't keep a slow stream in RAM for long
+        portENTER_CRITICAL(&_lock);
+        for (uint8_t s = 0; s < SESSION_STREAM_COUNT; s++) {
+            if (_fill[s].count > 0 && millis() - _fillStartMs[s] >= SESSION_FLUSH_MS)
+                seal((sessionStreams)s);
+        }
+        portEXIT_CRITICAL(&_lock);
+
+        while (true) {
+            portENTER_CRITICAL(&_lock);
+            bool empty = _sealed == 0;
+            size_t idx = _writeIdx;
+            portEXIT_CRITICAL(&_lock);
+            if (empty)
+                break;
+
+            // sealed blocks are not touched by the record functions
+            SessionBlock &block = _sealedBlocks[idx];
+            sessionBlockFinish(block); // the CRC is computed here, not with _lock held
+            bool raw = block.data[5] != SESSION_BLOCK_BREATHS;
+            bool written = false;
+            if (_recording && !(raw && _rawFull)) {
+                written = writeBlock(block.data, raw ? SESSION_RAW_MIN_FREE : SESSION_MIN_FREE);
+                if (!written && raw) {
+                    _rawFull = true; // leave the rest of the space to the breaths
+                } else if (!written) {
+                    _recording = false; // file system full or failing, the file stays valid
+                    _file.close();
+                }
+            }
+
+            portENTER_CRITICAL(&_lock);
+            if (!written)
+                _dropped++;
+            _writeIdx = (_writeIdx + 1) % SESSION_BUFFER_BLOCKS;
+            _sealed--;
+            portEXIT_CRITICAL(&_lock);
+        }
+    }
+}
+
+SessionRecorder sessionRecorder;
@@ -0,0 +1,76 @@
+#pragma once
+
+// On-device session recorder.
+//
+// Every breath is appended to a file on the LittleFS partition ("spiffs"
+// in the default 4MB partition table), one file per power-on session.
+// The file is a sequence of fixed size blocks, each carrying its own CRC,
+// so after a power loss everything up to the last complete block is still
+// readable. See vo2_session_block.h for the layout.
+//
+// Optionally (RAW_LOG builds) every pressure code and O2 / CO2 reading is
+// logged into the same file, delta encoded in their own blocks. Raw blocks
+// stop SESSION_RAW_MIN_FREE before the file system is full, so the breaths
+// keep being recorded.
+//
+// The record functions only add to a block in RAM (write-behind); a low
+// priority task writes sealed blocks and syncs the file. A block is sealed
+// when it is full or SESSION_FLUSH_MS after its first entry.
+
+#include <Arduino.h>
+#include <FS.h>
+#include "vo2_session_block.h"
+
+#define SESSION_BUFFER_BLOCKS 8  // sealed blocks waiting for the writer
+#define SESSION_FLUSH_MS 30000   // longest an entry waits in RAM
+#define SESSION_MIN_FREE (2 * SESSION_BLOCK_SIZE)  // stop before the file system is full
+#define SESSION_RAW_MIN_FREE (64 * 1024)           // keep room for the breaths
+#define SESSION_STACK 4096
+
+enum sessionStreams
+{
+    SESSION_STREAM_BREATHS,
+    SESSION_STREAM_PRESSURE,
+    SESSION_STREAM_GAS,
+    SESSION_STREAM_COUNT
+};
+
+class SessionRecorder
+{
+public:
+    // mounts the file system (formats it if it can't be mounted) and
+    // starts a new session file
+    bool begin(const SessionInfo &info);
+    bool record(const BreathRecord &rec);
+    bool recordPressure(uint64_t timeUs, uint16_t code);
+    bool recordGas(uint64_t timeUs, float o2, float co2ppm);
+    bool isRecording() const { return _recording; }
+    const char *fileName() const { return _name; }
+    uint32_t writtenBlocks() const { return _written; }
+    uint32_t droppedBlocks() const { return _dropped; }
+
+private:
+    static void writerTask(void *arg);
+    void writer();
+    bool writeBlock(uint8_t *data, size_t minFree);
+    SessionBlock *fillBlock(sessionStreams stream);
+    bool seal(sessionStreams stream);
+
+    File _file;
+    char _name[16] = "";
+    volatile bool _recording = false;
+    volatile bool _rawFull = false;
+    // blocks being filled, one per stream, and the sealed ones
+    SessionBlock _fill[SESSION_STREAM_COUNT];
+    uint32_t _fillStartMs[SESSION_STREAM_COUNT];
+    SessionBlock _sealedBlocks[SESSION_BUFFER_BLOCKS];
+    size_t _writeIdx = 0; // oldest sealed block
+    size_t _sealed = 0;
+    uint16_t _blockSeq = 0;
+    TaskHandle_t _task = nullptr;
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+    volatile uint32_t _written = 0;
+    volatile uint32_t _dropped = 0;
+};
+
+extern SessionRecorder sessionRecorder;
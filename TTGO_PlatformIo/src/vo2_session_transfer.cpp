@@ -0,0 +1,201 @@
+#include "vo2_session_transfer.h"
+#include "vo2_serial_commands.h"
+#include "vo2_session_recorder.h"
+#include "vo2_telemetry_sink.h"
+
+#include <LittleFS.h>
+#include <stdarg.h>
+
+// "/name" in out, false for anything that isn't a plain file name
+static bool fileName(const char *arg, char *out) {
+    if (*arg == '/')
+        arg++;
+    size_t len = strlen(arg);
+    if (len == 0 || len + 1 > FILE_NAME_MAX || strchr(arg, '/'))
+        return false;
+    out[0] = '/';
+    memcpy(&out[1], arg, len + 1);
+    return true;
+}
+
+bool SessionTransfer::begin(HardwareSerial *port, uint32_t defaultBaud) {
+    _port = port;
+    _defaultBaud = defaultBaud;
+    if (_task)
+        return true;
+    _queue = xQueueCreate(1, sizeof(TransferRequest));
+    if (!_queue)
+        return false;
+    return xTaskCreatePinnedToCore(transferTask, "transfer", TRANSFER_STACK, this,
+                                   tskIDLE_PRIORITY + 1, &_task, 0) == pdPASS;
+}
+
+bool SessionTransfer::request(const TransferRequest &req) {
+    if (!_queue)
+        return false;
+    _abort = true; // the task clears it when it takes the request
+    return xQueueOverwrite(_queue, &req) == pdPASS;
+}
+
+void SessionTransfer::transferTask(void *arg) {
+    static_cast<SessionTransfer *>(arg)->run();
+}
+
+void SessionTransfer::run() {
+    TransferRequest req;
+    while (true) {
+        if (xQueueReceive(_queue, &req, portMAX_DELAY) != pdPASS)
+            continue;
+        _abort = false;
+        switch (req.op) {
+        case TRANSFER_LIST:
+            list();
+            break;
+        case TRANSFER_GET:
+            get(req);
+            break;
+        case TRANSFER_REMOVE:
+            remove(req);
+            break;
+        case TRANSFER_BAUD:
+            setBaud(req.length);
+            break;
+        }
+    }
+}
+
+// waits for room in the sink rather than let it drop file data
+bool SessionTransfer::send(const uint8_t *frame, size_t len) {
+    uint32_t start = millis();
+    while (telemetrySink.freeSpace() < len + TELEMETRY_SINK_MAX_RECORD) {
+        if (millis() - start > TRANSFER_SINK_WAIT_MS)
+            return false;
+        vTaskDelay(1);
+    }
+    return telemetrySink.enqueue(frame, len);
+}
+
+bool SessionTransfer::reply(uint8_t status, const char *format, ...) {
+    char text[REPLY_MAX_TEXT + 1];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    uint8_t frame[TELEMETRY_FRAME_SIZE(1 + REPLY_MAX_TEXT)];
+    return send(frame, telemetryReplyFrame(status, text, frame));
+}
+
+void SessionTransfer::list() {
+    uint8_t frame[TELEMETRY_FRAME_SIZE(5 + FILE_NAME_MAX)];
+    char name[FILE_NAME_MAX + 1];
+    unsigned count = 0;
+    File root = LittleFS.open("/");
+    for (File f = root.openNextFile(); f && !_abort; f = root.openNextFile()) {
+        if (f.isDirectory() || !fileName(f.name(), name))
+            continue;
+        uint8_t flags = strcmp(name, sessionRecorder.fileName()) == 0 ? FILE_FLAG_RECORDING : 0;
+        send(frame, telemetryFileInfoFrame(f.size(), flags, name, frame));
+        count++;
+    }
+    reply(REPLY_OK, "%u files, %u bytes free", count,
+          (unsigned)(LittleFS.totalBytes() - LittleFS.usedBytes()));
+}
+
+void SessionTransfer::get(const TransferRequest &req) {
+    File f = LittleFS.open(req.name, FILE_READ);
+    if (!f || f.isDirectory()) {
+        reply(REPLY_ERROR, "no file %s", req.name);
+        return;
+    }
+    uint32_t size = f.size();
+    uint32_t offset = req.offset < size ? req.offset : size;
+    uint32_t end = req.length && req.length < size - offset ? offset + req.length : size;
+    if (!f.seek(offset)) {
+        reply(REPLY_ERROR, "seek %u", (unsigned)offset);
+        return;
+    }
+    uint8_t chunk[FILE_CHUNK_MAX];
+    uint8_t frame[TELEMETRY_FRAME_SIZE(4 + FILE_CHUNK_MAX)];
+    while (offset < end && !_abort) {
+        size_t len = f.read(chunk, min((uint32_t)sizeof(chunk), end - offset));
+        if (len == 0)
+            break;
+        if (!send(frame, telemetryFileChunkFrame(offset, chunk, len, frame)))
+            break; // the host asks again from the first missing offset
+        offset += len;
+    }
+    if (_abort)
+        return; // the next command has its own reply
+    if (offset >= size)
+        reply(REPLY_OK, "eof %u", (unsigned)size);
+    else
+        reply(REPLY_OK, "more %u", (unsigned)offset);
+}
+
+void SessionTransfer::remove(const TransferRequest &req) {
+    if (strcmp(req.name, sessionRecorder.fileName()) == 0) {
+        reply(REPLY_ERROR, "%s is being recorded", req.name);
+        return;
+    }
+    if (LittleFS.remove(req.name))
+        reply(REPLY_OK, "removed %s", req.name);
+    else
+        reply(REPLY_ERROR, "no file %s", req.name);
+}
+
+void SessionTransfer::setBaud(uint32_t baud) {
+    reply(REPLY_OK, "baud %u", (unsigned)baud);
+    // let the reply go out at the old rate
+    uint32_t start = millis();
+    while (telemetrySink.freeSpace() < TELEMETRY_SINK_SIZE && millis() - start < TRANSFER_SINK_WAIT_MS)
+        vTaskDelay(1);
+    vTaskDelay(pdMS_TO_TICKS(20)); // the drain task may still be writing it
+    _port->flush();
+    _port->updateBaudRate(baud);
+
+    // the host confirms with any command at the new rate
+    uint32_t switched = millis();
+    vTaskDelay(pdMS_TO_TICKS(TRANSFER_BAUD_CHECK_MS));
+    if ((int32_t)(serialCommands.lastCommandMs() - switched) < 0) {
+        _port->flush();
+        _port->updateBaudRate(_defaultBaud);
+    }
+}
+
+SessionTransfer sessionTransfer;
+
+//--------------------------------------------------
+void cmdSessionList(int argc, char **argv) {
+    TransferRequest req = {TRANSFER_LIST};
+    sessionTransfer.request(req);
+}
+
+void cmdSessionGet(int argc, char **argv) {
+    TransferRequest req = {TRANSFER_GET};
+    if (argc < 3 || !fileName(argv[1], req.name)) {
+        serialCommands.reply(REPLY_ERROR, "get <name> <offset> [length]");
+        return;
+    }
+    req.offset = strtoul(argv[2], nullptr, 10);
+    req.length = argc > 3 ? strtoul(argv[3], nullptr, 10) : 0;
+    sessionTransfer.request(req);
+}
+
+void cmdSessionRemove(int argc, char **argv) {
+    TransferRequest req = {TRANSFER_REMOVE};
+    if (argc < 2 || !fileName(argv[1], req.name)) {
+        serialCommands.reply(REPLY_ERROR, "rm <name>");
+        return;
+    }
+    sessionTransfer.request(req);
+}
+
+void cmdBaud(int argc, char **argv) {
+    TransferRequest req = {TRANSFER_BAUD};
+    req.length = argc > 1 ? strtoul(argv[1], nullptr, 10) : 0;
+    if (req.length < 9600 || req.length > 5000000) {
+        serialCommands.reply(REPLY_ERROR, "baud <9600..5000000>");
+        return;
+    }
+    sessionTransfer.request(req);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+// Bulk download of the recorded session files over the wired serial port.
+//
+// Serial commands (see vo2_serial_commands.h):
+//   ls                        TELEMETRY_FILE_INFO per file, then the reply
+//   get <name> <offset> [len] TELEMETRY_FILE_CHUNK frames from offset on,
+//                             then the reply "eof <size>" or "more <next>"
+//   rm <name>                 deletes a file, not the one being recorded
+//   baud <rate>               replies at the old rate, then switches; goes
+//                             back to the default rate unless a command
+//                             arrives within TRANSFER_BAUD_CHECK_MS
+// The work is done by a task on core 0, so loop() keeps measuring. A new
+// command stops a running transfer, so the host can re-request from the
+// first missing offset whenever a chunk was lost.
+// The host side is tools/session_download.py.
+
+#include <Arduino.h>
+#include "vo2_telemetry.h"
+
+#define TRANSFER_STACK 4096
+#define TRANSFER_BAUD_CHECK_MS 1500
+#define TRANSFER_SINK_WAIT_MS 1000 // give up if the sink doesn't drain
+
+enum transferOps
+{
+    TRANSFER_LIST,
+    TRANSFER_GET,
+    TRANSFER_REMOVE,
+    TRANSFER_BAUD,
+};
+
+struct TransferRequest
+{
+    uint8_t op; // transferOps
+    char name[FILE_NAME_MAX + 1];
+    uint32_t offset;
+    uint32_t length; // TRANSFER_GET bytes, TRANSFER_BAUD rate
+};
+
+class SessionTransfer
+{
+public:
+    bool begin(HardwareSerial *port, uint32_t defaultBaud);
+    // replaces a waiting request and stops a running one
+    bool request(const TransferRequest &req);
+
+private:
+    static void transferTask(void *arg);
+    void run();
+    void list();
+    void get(const TransferRequest &req);
+    void remove(const TransferRequest &req);
+    void setBaud(uint32_t baud);
+    bool send(const uint8_t *frame, size_t len);
+    bool reply(uint8_t status, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+    HardwareSerial *_port = nullptr;
+    uint32_t _defaultBaud;
+    QueueHandle_t _queue = nullptr;
+    TaskHandle_t _task = nullptr;
+    volatile bool _abort = false;
+};
+
+extern SessionTransfer sessionTransfer;
+
+// handlers for the serial command table
+void cmdSessionList(int argc, char **argv);
+void cmdSessionGet(int argc, char **argv);
+void cmdSessionRemove(int argc, char **argv);
+void cmdBaud(int argc, char **argv);
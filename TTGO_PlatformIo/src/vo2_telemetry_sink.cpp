@@ -0,0 +1,147 @@
+#include "vo2_telemetry_sink.h"
+#include "vo2_profiler.h"
+
+#include <stdarg.h>
+
+// every record is stored as [len lo][len hi][outputs][data ...]
+static const size_t RECORD_HEADER = 3;
+
+bool TelemetrySink::begin(Print *uart, Print *spp, sinkPolicies policy) {
+    _uart = uart;
+    _spp = spp;
+    _policy = policy;
+    if (_task)
+        return true;
+    // lowest priority above idle, away from the loop() core
+    return xTaskCreatePinnedToCore(drainTask, "telemetry", TELEMETRY_SINK_STACK, this,
+                                   tskIDLE_PRIORITY + 1, &_task, 0) == pdPASS;
+}
+
+void TelemetrySink::setPolicy(sinkPolicies policy) {
+    _policy = policy;
+}
+
+size_t TelemetrySink::freeSpace() const {
+    portENTER_CRITICAL(&_lock);
+    size_t used = _used;
+    portEXIT_CRITICAL(&_lock);
+    return TELEMETRY_SINK_SIZE - used;
+}
+
+bool TelemetrySink::enqueue(const uint8_t *data, size_t len, uint8_t outputs) {
+    if (len == 0)
+        return true;
+    if (len > TELEMETRY_SINK_MAX_RECORD) {
+        portENTER_CRITICAL(&_lock); // the drain task reads the counter
+        _dropped++;
+        portEXIT_CRITICAL(&_lock);
+        return false;
+    }
+    size_t needed = len + RECORD_HEADER;
+    uint8_t header[RECORD_HEADER] = {(uint8_t)len, (uint8_t)(len >> 8), outputs};
+
+    portENTER_CRITICAL(&_lock);
+    if (TELEMETRY_SINK_SIZE - _used < needed) {
+        if (_policy == SINK_DROP_NEWEST) {
+            _dropped++;
+            portEXIT_CRITICAL(&_lock);
+            return false;
+        }
+        while (TELEMETRY_SINK_SIZE - _used < needed)
+            dropOldest();
+    }
+    copyIn(header, RECORD_HEADER);
+    copyIn(data, len);
+    _enqueued++;
+    portEXIT_CRITICAL(&_lock);
+
+    if (_task)
+        xTaskNotifyGive(_task);
+    return true;
+}
+
+bool TelemetrySink::print(const char *text, uint8_t outputs) {
+    return enqueue((const uint8_t *)text, strlen(text), outputs);
+}
+
+bool TelemetrySink::printf(uint8_t outputs, const char *format, ...) {
+    char line[TELEMETRY_SINK_MAX_RECORD];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len < 0)
+        return false;
+    if ((size_t)len >= sizeof(line))
+        len = sizeof(line) - 1; // truncated
+    return enqueue((const uint8_t *)line, len, outputs);
+}
+
+// called with _lock held
+void TelemetrySink::copyIn(const uint8_t *data, size_t len) {
+    size_t tail = (_head + _used) % TELEMETRY_SINK_SIZE;
+    size_t first = min(len, TELEMETRY_SINK_SIZE - tail);
+    memcpy(&_buffer[tail], data, first);
+    memcpy(&_buffer[0], data + first, len - first);
+    _used += len;
+}
+
+// called with _lock held
+void TelemetrySink::copyOut(size_t from, uint8_t *data, size_t len) const {
+    size_t first = min(len, TELEMETRY_SINK_SIZE - from);
+    memcpy(data, &_buffer[from], first);
+    memcpy(data + first, &_buffer[0], len - first);
+}
+
+// called with _lock held
+void TelemetrySink::dropOldest() {
+    uint8_t header[RECORD_HEADER];
+    copyOut(_head, header, RECORD_HEADER);
+    size_t len = header[0] | (header[1] << 8);
+    _head = (_head + RECORD_HEADER + len) % TELEMETRY_SINK_SIZE;
+    _used -= RECORD_HEADER + len;
+    _dropped++;
+}
+
+bool TelemetrySink::pop(uint8_t *data, size_t *len, uint8_t *outputs) {
+    portENTER_CRITICAL(&_lock);
+    if (_used == 0) {
+        portEXIT_CRITICAL(&_lock);
+        return false;
+    }
+    uint8_t header[RECORD_HEADER];
+    copyOut(_head, header, RECORD_HEADER);
+    *len = header[0] | (header[1] << 8);
+    *outputs = header[2];
+    copyOut((_head + RECORD_HEADER) % TELEMETRY_SINK_SIZE, data, *len);
+    _head = (_head + RECORD_HEADER + *len) % TELEMETRY_SINK_SIZE;
+    _used -= RECORD_HEADER + *len;
+    portEXIT_CRITICAL(&_lock);
+    return true;
+}
+
+void TelemetrySink::drainTask(void *arg) {
+    static_cast<TelemetrySink *>(arg)->drain();
+}
+
+void TelemetrySink::drain() {
+    static uint8_t record[TELEMETRY_SINK_MAX_RECORD];
+    size_t len;
+    uint8_t outputs;
+    while (true) {
+        if (!pop(record, &len, &outputs)) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+            continue;
+        }
+        // blocking writes are fine here, this task only competes with idle
+        if ((outputs & SINK_UART) && _uart) {
+            PROFILE_SCOPE(PROF_SERIAL);
+            _uart->write(record, len);
+        }
+        if ((outputs & SINK_SPP) && _spp)
+            _spp->write(record, len);
+        _written++;
+    }
+}
+
+TelemetrySink telemetrySink;
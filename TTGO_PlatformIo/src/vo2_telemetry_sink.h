@@ -0,0 +1,63 @@
+#pragma once
+
+// Non-blocking telemetry output.
+//
+// Producers (loop(), measurement code) enqueue complete records into a
+// static ring buffer without ever waiting on the UART or the Bluetooth SPP
+// link. A low priority task drains the buffer to the selected outputs.
+// When the buffer is full the configured policy decides which record is
+// lost, and every lost record is counted.
+
+#include <Arduino.h>
+
+#define TELEMETRY_SINK_SIZE 8192      // bytes of ring buffer
+#define TELEMETRY_SINK_MAX_RECORD 512 // largest single record
+#define TELEMETRY_SINK_STACK 3072
+
+enum sinkOutputs
+{
+    SINK_UART = 0x01, // wired serial port
+    SINK_SPP = 0x02,  // Bluetooth serial port
+};
+
+enum sinkPolicies
+{
+    SINK_DROP_NEWEST, // keep what is queued, reject the new record
+    SINK_DROP_OLDEST, // discard queued records until the new one fits
+};
+
+class TelemetrySink
+{
+public:
+    bool begin(Print *uart, Print *spp = nullptr, sinkPolicies policy = SINK_DROP_OLDEST);
+    bool enqueue(const uint8_t *data, size_t len, uint8_t outputs = SINK_UART);
+    bool print(const char *text, uint8_t outputs = SINK_UART);
+    bool printf(uint8_t outputs, const char *format, ...) __attribute__((format(printf, 3, 4)));
+    void setPolicy(sinkPolicies policy);
+    size_t freeSpace() const;
+    uint32_t enqueuedRecords() const { return _enqueued; }
+    uint32_t writtenRecords() const { return _written; }
+    uint32_t droppedRecords() const { return _dropped; }
+
+private:
+    static void drainTask(void *arg);
+    void drain();
+    bool pop(uint8_t *data, size_t *len, uint8_t *outputs);
+    void copyIn(const uint8_t *data, size_t len);
+    void copyOut(size_t from, uint8_t *data, size_t len) const;
+    void dropOldest();
+
+    uint8_t _buffer[TELEMETRY_SINK_SIZE];
+    size_t _head = 0; // next byte to read
+    size_t _used = 0;
+    sinkPolicies _policy = SINK_DROP_OLDEST;
+    Print *_uart = nullptr;
+    Print *_spp = nullptr;
+    TaskHandle_t _task = nullptr;
+    mutable portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+    volatile uint32_t _enqueued = 0;
+    volatile uint32_t _written = 0;
+    volatile uint32_t _dropped = 0;
+};
+
+extern TelemetrySink telemetrySink;
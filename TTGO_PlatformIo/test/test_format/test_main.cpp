@@ -0,0 +1,220 @@
+#include <unity.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "vo2_format.h"
+#include "vo2_format_lines.h"
+#ifdef ARDUINO
+#include <Arduino.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// every C++ allocation in this binary is counted
+static volatile size_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size);
+    if (!p)
+        abort();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+// bytes currently allocated from the C heap, 0 if the platform can't tell
+static size_t heapUsed() {
+#ifdef ARDUINO
+    return ESP.getHeapSize() - ESP.getFreeHeap();
+#elif defined(__GLIBC__)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_format_time(void) {
+    char text[FORMAT_TIME_SIZE];
+    formatTime(text, sizeof(text), 0);
+    TEST_ASSERT_EQUAL_STRING("00:00:00", text);
+    formatTime(text, sizeof(text), 3723999);
+    TEST_ASSERT_EQUAL_STRING("01:02:03", text);
+    formatTime(text, sizeof(text), 25 * 3600000UL + 59000);
+    TEST_ASSERT_EQUAL_STRING("01:00:59", text);
+}
+
+void test_format_fixed(void) {
+    struct {
+        float value;
+        uint8_t decimals;
+        const char *text;
+    } cases[] = {
+        {0.0f, 2, "0.00"},       {1.0f, 0, "1"},         {-1.0f, 1, "-1.0"},
+        {0.004f, 2, "0.00"},     {0.006f, 2, "0.01"},    {20.9f, 2, "20.90"},
+        {1234.5678f, 3, "1234.568"}, {-0.25f, 1, "-0.3"}, {39999.0f, 0, "39999"},
+        {2.5f, 0, "3"},          {-0.001f, 2, "0.00"},   {16.43f, 2, "16.43"},
+    };
+    char text[32];
+    for (auto &c : cases) {
+        formatFixed(text, sizeof(text), c.value, c.decimals);
+        TEST_ASSERT_EQUAL_STRING(c.text, text);
+    }
+    formatFixed(text, sizeof(text), NAN, 2);
+    TEST_ASSERT_EQUAL_STRING("nan", text);
+    formatFixed(text, sizeof(text), -INFINITY, 2);
+    TEST_ASSERT_EQUAL_STRING("-inf", text);
+}
+
+void test_format_int(void) {
+    char text[12];
+    formatInt(text, sizeof(text), -2147483647 - 1);
+    TEST_ASSERT_EQUAL_STRING("-2147483648", text);
+    formatUInt(text, sizeof(text), 4294967295u);
+    TEST_ASSERT_EQUAL_STRING("4294967295", text);
+    char wide[21];
+    formatUInt(wide, sizeof(wide), 18446744073709551615ULL);
+    TEST_ASSERT_EQUAL_STRING("18446744073709551615", wide);
+}
+
+void test_format_buffer_truncates(void) {
+    FormatBuffer<8> small;
+    small.add("ab").add(1234.5f, 2);
+    TEST_ASSERT_EQUAL_STRING("ab1234.", small.c_str());
+    TEST_ASSERT_EQUAL(7, small.length());
+    TEST_ASSERT_TRUE(small.truncated());
+
+    char tiny[4];
+    TEST_ASSERT_EQUAL(8, formatTime(tiny, sizeof(tiny), 0));
+    TEST_ASSERT_EQUAL_STRING("00:", tiny);
+}
+
+void test_csv_line(void) {
+    CsvValues values = {3723, 2512.346f, 2600, 2100.5f, 0.84f, 1.5f, 30.25f, 20, 16.43f, 4.1234f};
+    FormatBuffer<CSV_LINE_SIZE> line;
+    formatCsvLine(line, values);
+    TEST_ASSERT_EQUAL_STRING("3723,2512.35,2600.00,2100.50,0.84,1.50,30.25,20.00,16.43,4.123\r\n", line.c_str());
+    FormatBuffer<BATTERY_LINE_SIZE> battery;
+    formatBatteryLine(battery, 3723, 4.126f);
+    TEST_ASSERT_EQUAL_STRING("3723,4.13\r\n", battery.c_str());
+}
+
+void test_breath_json(void) {
+    BreathRecord rec = {7, 123456789012ULL, 1500, 2000, BREATH_FLAG_DEMO,
+                        1.5f, 30, 29.5f, 20, 19.5f, 2500, 33.33f, 4.5f, 100, 200, 2100, 28, 0.84f};
+    FormatBuffer<BREATH_JSON_SIZE> json;
+    formatBreathJson(json, rec);
+    TEST_ASSERT_EQUAL_STRING("{\"breath\": {\"schema\": 1, \"seq\": 7, \"t_us\": 123456789012, \"insp_ms\": 1500, "
+                             "\"exp_ms\": 2000, \"flags\": 1, \"volumeExp\": 1.50, \"VE\": 30.00, \"VEmean\": 29.50, "
+                             "\"freqVE\": 20.0, \"freqVEmean\": 19.5, \"vo2Total\": 2500.00, \"vo2Rel\": 33.33, "
+                             "\"deltaO2_frac\": 4.50, \"vo2TotalIn\": 100.00, \"vo2TotalOut\": 200.00, "
+                             "\"vco2Total\": 2100.00, \"vco2Rel\": 28.00, \"respq\": 0.84}}\r\n",
+                             json.c_str());
+}
+
+void test_display_texts(void) {
+    FormatBuffer<DISPLAY_TEXT_SIZE> text;
+    formatVoltage(text, 4.126f);
+    TEST_ASSERT_EQUAL_STRING("4.13V", text.c_str());
+    formatSampleInterval(text, 10049, 420);
+    TEST_ASSERT_EQUAL_STRING("dt 10.0+-0.4ms", text.c_str());
+    formatSampleGaps(text, 3, 50000);
+    TEST_ASSERT_EQUAL_STRING("gaps 3 >50ms", text.c_str());
+}
+
+// A simulated eight hour session through the firmwares' text paths: every
+// second ConvertTime() and the display texts, every breath (2.5 s) the csv
+// lines of ExcelStream() / BatteryBT() and main_mini.cpp's JSON breath
+// record. Neither the allocation count nor the heap in use may grow; with
+// the String based code both climbed from the first breath.
+void test_format_session_does_not_allocate(void) {
+    char totalTimeMin[FORMAT_TIME_SIZE];
+    FormatBuffer<CSV_LINE_SIZE> csv;
+    FormatBuffer<BATTERY_LINE_SIZE> battery;
+    FormatBuffer<BREATH_JSON_SIZE> json;
+    FormatBuffer<DISPLAY_TEXT_SIZE> voltage, interval, gaps;
+    BreathRecord rec = {};
+    size_t checksum = 0;
+
+    // warm up anything the C library initialises lazily
+    formatCsvLine(csv, CsvValues{});
+
+    size_t startAllocations = allocations;
+    size_t startHeap = heapUsed();
+
+    const uint32_t sessionMs = 8UL * 3600000UL;
+    for (uint32_t t = 0; t < sessionMs; t += 500) {
+        float volts = 4.2f - t / (float)sessionMs;
+        if (t % 1000 == 0) {
+            formatTime(totalTimeMin, sizeof(totalTimeMin), t); // ConvertTime()
+            formatVoltage(voltage, volts);
+            formatSampleInterval(interval, 10000 + t % 97, 300 + t % 53);
+            formatSampleGaps(gaps, t / 60000, 50000);
+            checksum += strlen(totalTimeMin) + voltage.length() + interval.length() + gaps.length();
+        }
+        if (t % 2500 != 0)
+            continue;
+
+        float vo2 = 2500.0f + (t % 7000) / 10.0f;
+        CsvValues values = {t / 1000.0f, vo2, vo2 + 100, vo2 * 0.84f, 0.84f, 1.5f, 30.0f, 20.0f, 16.43f, 4.12f};
+        formatCsvLine(csv, values);
+        formatBatteryLine(battery, t / 1000.0f, volts);
+
+        rec.seq++;
+        rec.timeUs = (uint64_t)t * 1000;
+        rec.inspirationMs = 1500;
+        rec.expirationMs = 1000;
+        rec.vo2Total = vo2;
+        rec.vo2Rel = vo2 / 75;
+        rec.respq = 0.84f;
+        formatBreathJson(json, rec);
+
+        checksum += csv.length() + battery.length() + json.length();
+        TEST_ASSERT_FALSE(csv.truncated() || battery.truncated() || json.truncated());
+    }
+
+    TEST_ASSERT_EQUAL(startAllocations, allocations);
+    TEST_ASSERT_EQUAL(startHeap, heapUsed());
+    TEST_ASSERT_EQUAL_UINT32(sessionMs / 2500, rec.seq);
+    TEST_ASSERT_TRUE(checksum > 0);
+}
+
+int runUnityTests(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_format_time);
+    RUN_TEST(test_format_fixed);
+    RUN_TEST(test_format_int);
+    RUN_TEST(test_format_buffer_truncates);
+    RUN_TEST(test_csv_line);
+    RUN_TEST(test_breath_json);
+    RUN_TEST(test_display_texts);
+    RUN_TEST(test_format_session_does_not_allocate);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    delay(2000); // wait for the serial monitor
+    runUnityTests();
+}
+
+void loop() {
+}
+#else
+int main(void) {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,120 @@
+#include <unity.h>
+#include "vo2_i2c_stats.h"
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+void setUp(void) {
+    i2cStats.reset();
+}
+
+void tearDown(void) {
+}
+
+void test_counters(void) {
+    i2cStats.write(I2C_CO2, I2C_OK, 120);
+    i2cStats.write(I2C_CO2, I2C_NACK_ADDRESS, 80);
+    i2cStats.write(I2C_CO2, I2C_NACK_DATA, 90);
+    i2cStats.write(I2C_CO2, I2C_TIMEOUT, 50000);
+    i2cStats.read(I2C_CO2, 18, 12, 400);
+    i2cStats.crcError(I2C_CO2);
+    i2cStats.retry(I2C_CO2);
+
+    const I2CDeviceStats &d = i2cStats.device(I2C_CO2);
+    TEST_ASSERT_EQUAL_UINT32(5, d.attempts);
+    TEST_ASSERT_EQUAL_UINT32(2, d.nacks);
+    TEST_ASSERT_EQUAL_UINT32(1, d.busErrors);
+    TEST_ASSERT_EQUAL_UINT32(1, d.shortReads);
+    TEST_ASSERT_EQUAL_UINT32(1, d.crcErrors);
+    TEST_ASSERT_EQUAL_UINT32(1, d.retries);
+    TEST_ASSERT_EQUAL_UINT32(5, d.latency.count);
+    TEST_ASSERT_EQUAL_UINT32(50000, d.latency.max);
+    TEST_ASSERT_EQUAL_UINT32(0, i2cStats.device(I2C_O2).attempts);
+}
+
+void test_recovery(void) {
+    // an absent sensor: NACKs and empty reads never reset the bus
+    for (int i = 0; i < 3 * I2C_RECOVERY_FAILURES; i++) {
+        i2cStats.write(I2C_PRESSURE, I2C_NACK_ADDRESS, 100);
+        i2cStats.read(I2C_PRESSURE, 2, 0, 100);
+    }
+    TEST_ASSERT_FALSE(i2cStats.recoveryNeeded(I2C_PRESSURE, 0));
+    TEST_ASSERT_EQUAL_UINT32(0, i2cStats.device(I2C_PRESSURE).failStreak);
+
+    for (int i = 0; i < I2C_RECOVERY_FAILURES - 1; i++)
+        i2cStats.write(I2C_PRESSURE, I2C_BUS_ERROR, 100);
+    TEST_ASSERT_FALSE(i2cStats.recoveryNeeded(I2C_PRESSURE, 0));
+    // a complete read ends the streak
+    i2cStats.read(I2C_PRESSURE, 2, 2, 100);
+    i2cStats.write(I2C_PRESSURE, I2C_TIMEOUT, 100);
+    TEST_ASSERT_FALSE(i2cStats.recoveryNeeded(I2C_PRESSURE, 0));
+
+    for (int i = 0; i < I2C_RECOVERY_FAILURES; i++)
+        i2cStats.write(I2C_PRESSURE, I2C_TIMEOUT, 100);
+    TEST_ASSERT_TRUE(i2cStats.recoveryNeeded(I2C_PRESSURE, 0));
+    i2cStats.recovered(I2C_PRESSURE, 0);
+    TEST_ASSERT_FALSE(i2cStats.recoveryNeeded(I2C_PRESSURE, 0));
+    TEST_ASSERT_EQUAL_UINT32(1, i2cStats.device(I2C_PRESSURE).recoveries);
+}
+
+// a reset that did not help: the next one waits, and after
+// I2C_RECOVERY_ATTEMPTS the device asks for none until it reads again
+void test_recovery_backoff(void) {
+    uint32_t now = 1000;
+    for (int attempt = 0; attempt < I2C_RECOVERY_ATTEMPTS; attempt++) {
+        for (int i = 0; i < I2C_RECOVERY_FAILURES; i++)
+            i2cStats.write(I2C_CO2, I2C_BUS_ERROR, 100);
+        if (attempt > 0) {
+            TEST_ASSERT_FALSE(i2cStats.recoveryNeeded(I2C_CO2, now + I2C_RECOVERY_INTERVAL_MS - 1));
+            now += I2C_RECOVERY_INTERVAL_MS;
+        }
+        TEST_ASSERT_TRUE(i2cStats.recoveryNeeded(I2C_CO2, now));
+        i2cStats.recovered(I2C_CO2, now);
+    }
+    for (int i = 0; i < I2C_RECOVERY_FAILURES; i++)
+        i2cStats.write(I2C_CO2, I2C_BUS_ERROR, 100);
+    TEST_ASSERT_FALSE(i2cStats.recoveryNeeded(I2C_CO2, now + 100 * I2C_RECOVERY_INTERVAL_MS));
+    TEST_ASSERT_EQUAL_UINT32(I2C_RECOVERY_ATTEMPTS, i2cStats.device(I2C_CO2).recoveries);
+
+    // back on the bus, the next streak resets it again
+    i2cStats.read(I2C_CO2, 18, 18, 400);
+    for (int i = 0; i < I2C_RECOVERY_FAILURES; i++)
+        i2cStats.write(I2C_CO2, I2C_BUS_ERROR, 100);
+    TEST_ASSERT_TRUE(i2cStats.recoveryNeeded(I2C_CO2, now + I2C_RECOVERY_INTERVAL_MS));
+}
+
+void test_pack(void) {
+    i2cStats.write(I2C_O2, I2C_OK, 300);
+    i2cStats.read(I2C_O2, 3, 3, 70000); // saturates the u16 max
+    uint8_t out[I2C_STATS_PACKED_SIZE];
+    TEST_ASSERT_EQUAL(I2C_STATS_PACKED_SIZE, i2cStatsPack(i2cStats, out));
+
+    const uint8_t *o2 = out + I2C_O2 * I2C_STATS_PACKED_DEVICE;
+    TEST_ASSERT_EQUAL(I2C_O2, o2[0]);
+    TEST_ASSERT_EQUAL(2, o2[1] | (o2[2] << 8) | (o2[3] << 16) | (o2[4] << 24));
+    const uint8_t *maxUs = o2 + I2C_STATS_PACKED_DEVICE - 2;
+    TEST_ASSERT_EQUAL(0xFFFF, maxUs[0] | (maxUs[1] << 8));
+}
+
+int runUnityTests(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_counters);
+    RUN_TEST(test_recovery);
+    RUN_TEST(test_recovery_backoff);
+    RUN_TEST(test_pack);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    delay(2000); // wait for the serial monitor
+    runUnityTests();
+}
+
+void loop() {
+}
+#else
+int main(void) {
+    return runUnityTests();
+}
+#endif
@@ -0,0 +1,120 @@
+#include <unity.h>
+#include <math.h>
+#include "vo2_profiler.h"
+#include "vo2_sample_timing.h"
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+void setUp(void) {
+    profiler.reset();
+}
+
+void tearDown(void) {
+}
+
+void test_buckets(void) {
+    StageHistogram h = {};
+    h.add(0);
+    h.add(1);
+    h.add(2);
+    h.add(3);
+    h.add(1024);
+    h.add(0xFFFFFFFF);
+    TEST_ASSERT_EQUAL_UINT32(1, h.buckets[0]);
+    TEST_ASSERT_EQUAL_UINT32(1, h.buckets[1]);
+    TEST_ASSERT_EQUAL_UINT32(2, h.buckets[2]); // 2 and 3
+    TEST_ASSERT_EQUAL_UINT32(1, h.buckets[11]);
+    TEST_ASSERT_EQUAL_UINT32(1, h.buckets[32]);
+    TEST_ASSERT_EQUAL_UINT32(6, h.count);
+    TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFF, h.max);
+}
+
+void test_percentiles(void) {
+    StageHistogram h = {};
+    TEST_ASSERT_EQUAL_UINT32(0, h.percentile(50));
+    // 90 fast samples, 9 slow ones and one outlier
+    for (int i = 0; i < 90; i++)
+        h.add(1000);
+    for (int i = 0; i < 9; i++)
+        h.add(50000);
+    h.add(2000000);
+
+    // within the bucket of the true value, never above the maximum
+    uint32_t p50 = h.percentile(50);
+    TEST_ASSERT_TRUE(p50 >= 512 && p50 < 1024 * 2);
+    uint32_t p95 = h.percentile(95);
+    TEST_ASSERT_TRUE(p95 >= 32768 && p95 < 65536);
+    TEST_ASSERT_EQUAL_UINT32(2000000, h.percentile(100));
+    TEST_ASSERT_TRUE(h.percentile(99) <= h.percentile(100));
+    TEST_ASSERT_TRUE(h.percentile(50) <= h.percentile(95));
+}
+
+void test_scope(void) {
+    {
+        PROFILE_SCOPE(PROF_O2);
+        volatile uint32_t sum = 0;
+        for (uint32_t i = 0; i < 10000; i++)
+            sum += i;
+    }
+    { PROFILE_SCOPE(PROF_O2); }
+    TEST_ASSERT_EQUAL_UINT32(2, profiler.stage(PROF_O2).count);
+    TEST_ASSERT_EQUAL_UINT32(0, profiler.stage(PROF_CO2).count);
+    TEST_ASSERT_TRUE(profiler.stage(PROF_O2).max > 0);
+    profiler.reset();
+    TEST_ASSERT_EQUAL_UINT32(0, profiler.stage(PROF_O2).count);
+}
+
+void test_sample_timing(void) {
+    SampleTiming timing(100000);
+    uint64_t t = 5000000;
+    timing.sample(t); // only the start
+    TEST_ASSERT_EQUAL_UINT32(0, timing.count());
+    // 40 ms +- 2 ms, then one 300 ms gap
+    for (int i = 0; i < 100; i++) {
+        t += i % 2 ? 42000 : 38000;
+        timing.sample(t);
+    }
+    t += 300000;
+    timing.sample(t);
+
+    double mean = (100 * 40000.0 + 300000) / 101;
+    double var = 0;
+    for (int i = 0; i < 100; i++)
+        var += pow((i % 2 ? 42000 : 38000) - mean, 2);
+    var = (var + pow(300000 - mean, 2)) / 100;
+    TEST_ASSERT_EQUAL_UINT32(101, timing.count());
+    TEST_ASSERT_FLOAT_WITHIN(0.1, mean, timing.meanUs());
+    TEST_ASSERT_FLOAT_WITHIN(0.1, sqrt(var), timing.stdUs());
+    TEST_ASSERT_EQUAL_UINT32(1, timing.gaps);
+    TEST_ASSERT_EQUAL_UINT32(300000, timing.intervals.max);
+    TEST_ASSERT_TRUE(timing.intervals.percentile(50) >= 32768 && timing.intervals.percentile(50) < 65536);
+
+    timing.reset();
+    TEST_ASSERT_EQUAL_UINT32(0, timing.count());
+    TEST_ASSERT_EQUAL_UINT32(0, timing.gaps);
+    TEST_ASSERT_EQUAL_UINT32(100000, timing.gapUs);
+}
+
+int runUnityTests(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_buckets);
+    RUN_TEST(test_percentiles);
+    RUN_TEST(test_scope);
+    RUN_TEST(test_sample_timing);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    delay(2000); // wait for the serial monitor
+    runUnityTests();
+}
+
+void loop() {
+}
+#else
+int main(void) {
+    return runUnityTests();
+}
+#endif
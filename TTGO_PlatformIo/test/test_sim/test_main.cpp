@@ -0,0 +1,205 @@
+// The measurement path of main_mini.cpp's loop() on the real sensor drivers
+// and lib/VO2Calc, against the simulated sensors of lib/ArduinoSim. Native
+// only: the bus and the clock are simulated.
+#include <unity.h>
+#include <chrono>
+#include "DFRobot_OxygenSensor.h"
+#include "Omron_D6FPH.h"
+#include "SCD30.h"
+#include "vo2_calc.h"
+#include "vo2_i2c_stats.h"
+#include "vo2_sample_timing.h"
+#include "vo2_sim_sensors.h"
+
+#define DIAMETER 18
+#define COLLECT_NUMBER 10
+#define WEIGHT_KG 75
+
+// Known bias of the firmware's volume integral: VE (and with it VO2) comes
+// out about 8 % high at 20 breaths/min, because the first sample of an
+// expiration is taken ~300 ms after the one before (the gas reads of the
+// inspiration) and its flow is integrated over that whole interval. The
+// test pins it, so a fix or a regression shows up here; set it to 1.0 once
+// the integral is fixed.
+#define KNOWN_VE_BIAS 1.083
+#define VE_TOLERANCE 0.02 // relative
+
+static SimBreathing model;
+static SimD6FPH *simPressure;
+static SimOxygen *simOxygen;
+static SimSCD30 *simCO2;
+
+static Omron_D6FPH presSensor;
+static DFRobot_OxygenSensor *Oxygen;
+static VO2Calc *calc;
+static uint32_t breaths;
+static SampleTiming sampleTiming;
+
+// a fresh bus, sensors and firmware state at time 0 for every test
+void setUp(void) {
+    simSetTimeUs(0);
+    model = SimBreathing();
+    model.params.startS = 10; // room air while setup() reads the initial values
+    simPressure = new SimD6FPH(model);
+    simOxygen = new SimOxygen(model);
+    simCO2 = new SimSCD30(model);
+    simAttachSensors(*simPressure, *simOxygen, *simCO2);
+    i2cStats.reset();
+    Oxygen = new DFRobot_OxygenSensor();
+    calc = new VO2Calc(VO2_AREA_26MM, vo2VenturiArea(DIAMETER));
+    breaths = 0;
+    sampleTiming = SampleTiming();
+}
+
+void tearDown(void) {
+    Wire.detachAll();
+    delete simPressure;
+    delete simOxygen;
+    delete simCO2;
+    delete Oxygen;
+    delete calc;
+}
+
+// setup() of main_mini.cpp: sensors and the initial gas values
+static void setupSensors() {
+    TEST_ASSERT_TRUE(Oxygen->begin(ADDRESS_3));
+    TEST_ASSERT_TRUE(scd30.initialize());
+    scd30.setAutoSelfCalibration(0);
+    while (!scd30.isAvailable())
+        delay(500);
+    TEST_ASSERT_TRUE(presSensor.begin(MODEL_0025AMD2));
+    calc->initialO2 = Oxygen->ReadOxygenData(COLLECT_NUMBER);
+    float result[3];
+    TEST_ASSERT_TRUE(scd30.getCarbonDioxideConcentration(result));
+    calc->initialCO2 = result[0];
+    calc->begin(simTimeUs());
+}
+
+static void readGas() {
+    calc->o2Sample(Oxygen->ReadOxygenData(COLLECT_NUMBER));
+    float result[3];
+    if (scd30.isAvailable() && scd30.getCarbonDioxideConcentration(result))
+        calc->co2Sample(result[0], result[1], WEIGHT_KG);
+}
+
+// one loop(): volumeCalc(), the gas readings, vo2maxCalc() after a breath
+static void loopOnce() {
+    uint16_t code;
+    float pressure = NAN;
+    uint64_t nowUs = simTimeUs();
+    if (presSensor.getPressureCode(&code)) {
+        sampleTiming.sample(nowUs);
+        pressure = presSensor.codeToPressure(code);
+    }
+    calc->flowSample(nowUs, pressure, 1.0);
+    if (calc->ventilationState == INSPIRATION) {
+        readGas();
+        delay(100);
+    }
+    if (calc->ventilationState == EXPIRATION_DONE) {
+        calc->startInspiration(simTimeUs());
+        readGas();
+        calc->breathCalc(WEIGHT_KG);
+        breaths++;
+    }
+}
+
+static void runFor(uint32_t seconds) {
+    uint64_t end = simTimeUs() + (uint64_t)seconds * 1000000;
+    while (simTimeUs() < end)
+        loopOnce();
+}
+
+void test_pressure_codes(void) {
+    model.params.tempC = 24;
+    TEST_ASSERT_TRUE(presSensor.begin(MODEL_0025AMD2));
+    TEST_ASSERT_FLOAT_WITHIN(0.05, 24, presSensor.getTemperature());
+    // at the peak of the first expiration
+    float period = 60 / model.params.rate;
+    simSetTimeUs((uint64_t)((model.params.startS + period * (1 - model.params.expiration / 2)) * 1e6) - 33000);
+    float pa = presSensor.getPressure();
+    TEST_ASSERT_TRUE(pa > 10);
+    TEST_ASSERT_FLOAT_WITHIN(presSensor.getPressureScale(), model.pressure(simTimeUs()), pa);
+    // and back through Bernoulli to the model's flow
+    VO2Calc flow(VO2_AREA_26MM, vo2VenturiArea(DIAMETER));
+    flow.co2temp = 24;
+    flow.breathCalc(WEIGHT_KG); // air density
+    float volFlow = 1000 * vo2MassFlow(pa, flow.rho, flow.area_1, flow.area_2) / flow.rho;
+    TEST_ASSERT_FLOAT_WITHIN(0.01, model.flow(simTimeUs()), volFlow);
+}
+
+void test_breathing_end_to_end(void) {
+    model.params.rate = 20;
+    model.params.tidalVolume = 2.0;
+    model.params.vo2 = 2500;
+    model.params.rq = 0.95;
+    setupSensors();
+    TEST_ASSERT_FLOAT_WITHIN(0.02, model.params.fio2, calc->initialO2);
+    TEST_ASSERT_FLOAT_WITHIN(1, model.params.inspiredCO2, calc->initialCO2);
+
+    auto start = std::chrono::steady_clock::now();
+    runFor(300);
+    double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // 5 minutes, every breath found
+    float breathing = simTimeUs() / 1e6 - model.params.startS;
+    TEST_ASSERT_UINT32_WITHIN(1, (uint32_t)(breathing * model.params.rate / 60), breaths);
+    TEST_ASSERT_FLOAT_WITHIN(0.5, model.params.rate, calc->freqVEmean);
+    float ve = model.ventilation() * KNOWN_VE_BIAS;
+    TEST_ASSERT_FLOAT_WITHIN(ve * VE_TOLERANCE, ve, calc->volumeVEmean);
+    float vo2 = model.params.vo2 * KNOWN_VE_BIAS;
+    TEST_ASSERT_FLOAT_WITHIN(vo2 * VE_TOLERANCE, vo2, calc->vo2Total);
+    TEST_ASSERT_FLOAT_WITHIN(0.03, model.params.rq, calc->respq); // the bias cancels
+    char message[64];
+    snprintf(message, sizeof(message), "300 s of device time in %.3f s", wallS);
+    TEST_MESSAGE(message);
+
+    // the inspiration's gas reads and delay(100) are not gaps
+    TEST_ASSERT_TRUE(sampleTiming.count() > 1000);
+    TEST_ASSERT_EQUAL_UINT32(0, sampleTiming.gaps);
+
+    // the drivers did not see a single failure
+    TEST_ASSERT_EQUAL_UINT32(0, i2cStats.device(I2C_PRESSURE).nacks);
+    TEST_ASSERT_EQUAL_UINT32(0, i2cStats.device(I2C_O2).shortReads);
+    TEST_ASSERT_EQUAL_UINT32(0, i2cStats.device(I2C_CO2).crcErrors);
+
+    // a step in VO2 shows up after the mixing chamber has caught up
+    model.params.vo2 = 3500;
+    runFor(60);
+    vo2 = 3500 * KNOWN_VE_BIAS;
+    TEST_ASSERT_FLOAT_WITHIN(vo2 * VE_TOLERANCE, vo2, calc->vo2Total);
+}
+
+void test_bus_errors(void) {
+    setupSensors();
+    // every 7th O2 transaction is not acknowledged, the driver retries
+    simOxygen->nackEvery = 7;
+    runFor(60);
+    TEST_ASSERT_TRUE(i2cStats.device(I2C_O2).nacks > 0);
+    TEST_ASSERT_TRUE(i2cStats.device(I2C_O2).retries > 0);
+    // a failed read must not put a 0 into the 10 reading average
+    TEST_ASSERT_FLOAT_WITHIN(0.3, model.o2(simTimeUs()), calc->lastO2);
+    TEST_ASSERT_TRUE(breaths > 15);
+
+    // the pressure sensor drops off the bus: no flow, NAN pressure, and
+    // its NACKs do not ask for bus resets that can't bring it back
+    simPressure->present = false;
+    uint32_t before = breaths;
+    runFor(10);
+    TEST_ASSERT_EQUAL_UINT32(before, breaths);
+    TEST_ASSERT_TRUE(isnan(calc->pressure));
+    TEST_ASSERT_TRUE(i2cStats.device(I2C_PRESSURE).nacks > I2C_RECOVERY_FAILURES);
+    TEST_ASSERT_FALSE(i2cStats.recoveryNeeded(I2C_PRESSURE, simTimeUs() / 1000));
+}
+
+int runUnityTests(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_pressure_codes);
+    RUN_TEST(test_breathing_end_to_end);
+    RUN_TEST(test_bus_errors);
+    return UNITY_END();
+}
+
+int main(void) {
+    return runUnityTests();
+}
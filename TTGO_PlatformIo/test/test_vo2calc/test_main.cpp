@@ -0,0 +1,105 @@
+#include <unity.h>
+#include <math.h>
+#include "vo2_calc.h"
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#define SAMPLE_US 10000
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// one breath: flow of pressurePa for expMs, then nothing for pauseMs
+static uint64_t breathe(VO2Calc &calc, uint64_t t, float pressurePa, uint32_t expMs, uint32_t pauseMs) {
+    for (uint32_t ms = 0; ms < expMs; ms += SAMPLE_US / 1000) {
+        t += SAMPLE_US;
+        calc.flowSample(t, pressurePa, 1.0);
+    }
+    for (uint32_t ms = 0; ms < pauseMs; ms += SAMPLE_US / 1000) {
+        t += SAMPLE_US;
+        calc.flowSample(t, 0, 1.0);
+        if (calc.ventilationState == EXPIRATION_DONE)
+            calc.startInspiration(t);
+    }
+    return t;
+}
+
+void test_venturi_area(void) {
+    TEST_ASSERT_EQUAL_FLOAT(0.000254, vo2VenturiArea(18));
+    TEST_ASSERT_EQUAL_FLOAT(0.000201, vo2VenturiArea(16));
+    // D6F-PH0025AD2: 250 Pa over 60000 codes
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 100.0, vo2CodeToPressure(1024 + 24000, 250.0 / 60000, 0));
+}
+
+void test_breath_volume(void) {
+    VO2Calc calc(VO2_AREA_26MM, vo2VenturiArea(18));
+    uint64_t t = 1000000;
+    calc.begin(t);
+    t = breathe(calc, t, 50, 1000, 2000);
+    t = breathe(calc, t, 50, 1000, 2000);
+
+    // Bernoulli flow through the venturi, 1 s of expiration
+    double flow = 1000 * sqrt(2 * 1.225 * 50 / (1 / pow(0.000254, 2) - 1 / pow(0.000531, 2))) / 1.225;
+    TEST_ASSERT_EQUAL(INSPIRATION, calc.ventilationState);
+    TEST_ASSERT_FLOAT_WITHIN(flow * 0.02, flow, calc.volumeExp);
+    // ends once the filtered pressure has decayed below the threshold
+    TEST_ASSERT_UINT32_WITHIN(100, 1000, (uint32_t)calc.expirationTime);
+    TEST_ASSERT_FLOAT_WITHIN(0.5, 20.0, calc.freqVE); // one breath every 3 s
+    TEST_ASSERT_FLOAT_WITHIN(0.5, calc.volumeExp * 20, calc.volumeVE);
+}
+
+void test_no_flow_no_breath(void) {
+    VO2Calc calc(VO2_AREA_26MM, vo2VenturiArea(18));
+    calc.begin(0);
+    breathe(calc, 0, 0.05, 1000, 1000); // below the threshold
+    TEST_ASSERT_EQUAL_FLOAT(0, calc.volumeExp);
+    TEST_ASSERT_EQUAL(WAITING_PRESSURE, calc.ventilationState);
+}
+
+void test_gas_exchange(void) {
+    VO2Calc calc(VO2_AREA_26MM, vo2VenturiArea(18));
+    calc.initialO2 = 20.9;
+    calc.initialCO2 = 400;
+    calc.volumeVEmean = 10; // L/min
+    calc.o2Sample(16.9);
+    calc.co2Sample(800, 20, 80); // the difference is taken as % like O2
+    calc.breathCalc(80);
+
+    float btps = calc.rhoBTPS / calc.rhoSTPD;
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, 0.04, calc.deltaO2_frac);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 400 * btps, calc.vo2Total); // 10 L/min * 4 %
+    TEST_ASSERT_FLOAT_WITHIN(0.01, calc.vo2Total / 80, calc.vo2Rel);
+    TEST_ASSERT_FLOAT_WITHIN(0.5, 400 * btps, calc.vco2Total); // density of the breath before
+    // a higher reading later raises the ambient O2 reference, a lower one doesn't
+    calc.o2Sample(21.0);
+    TEST_ASSERT_EQUAL_FLOAT(21.0, calc.initialO2);
+    calc.o2Sample(20.0);
+    TEST_ASSERT_EQUAL_FLOAT(21.0, calc.initialO2);
+}
+
+int runUnityTests(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_venturi_area);
+    RUN_TEST(test_breath_volume);
+    RUN_TEST(test_no_flow_no_breath);
+    RUN_TEST(test_gas_exchange);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    delay(2000); // wait for the serial monitor
+    runUnityTests();
+}
+
+void loop() {
+}
+#else
+int main(void) {
+    return runUnityTests();
+}
+#endif
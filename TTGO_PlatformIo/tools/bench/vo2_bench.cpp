@@ -0,0 +1,239 @@
+// Host benchmarks of the measurement hot path of the mini firmware.
+//
+//   vo2_bench [--filter TEXT] [--min-time S]
+//
+// Every benchmark runs the same library code the firmware runs (lib/VO2Calc,
+// lib/Telemetry, the O2 filter of lib/OxygenSensor) in batches until it has
+// taken --min-time seconds (0.5) and prints ns per operation and heap
+// allocations per operation (global operator new, which is what String and
+// the std containers use). The times are host times; compare them between
+// builds of the same machine, not with the ESP32.
+//
+//   bernoulli_flow       vo2MassFlow() of one pressure difference
+//   volume_integration   VO2Calc::flowSample() during an expiration
+//   breath_segmentation  one sample of a recorded breathing waveform (codes
+//                        to Pa, flowSample(), startInspiration())
+//   vo2_calc             o2Sample(), co2Sample() and breathCalc() of a breath
+//   telemetry_breath     breathRecord() and the COBS/CRC breath frame
+//   o2_average           the 10 reading moving average of the O2 sensor
+//
+// Build with pio run -e bench (binary in .pio/build/bench/program), or
+// without PlatformIO, from the project directory:
+//   g++ -O2 -std=gnu++17 -Ilib/Telemetry/src -Ilib/VO2Calc/src -Ilib/OxygenSensor/src
+//       -o vo2_bench tools/bench/vo2_bench.cpp lib/Telemetry/src/*.cpp lib/VO2Calc/src/*.cpp
+
+#include <chrono>
+#include <math.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "vo2_calc.h"
+#include "vo2_oxygen_average.h"
+#include "vo2_telemetry.h"
+
+#define BENCH_DIAMETER 18        // DIAMETER in main_mini.cpp
+#define BENCH_COLLECT_NUMBER 10  // COLLECT_NUMBER in main_mini.cpp
+#define BENCH_SAMPLE_US 10000    // pressure readings of the waveform, 100 Hz
+#define BENCH_BREATH_MS 3000     // 20 breaths/min
+#define BENCH_WAVEFORM_S 60
+#define BENCH_SCALE (250.0f / 60000) // D6F-PH0025AD2
+
+//--------------------------------------------------
+// heap allocations of the process
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+// keeps the compiler from dropping a result nobody reads
+template <typename T>
+static inline void keep(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+//--------------------------------------------------
+// benchmarks, each runs n operations
+
+// D6F-PH codes of a breathing waveform: a half sine of flow during the
+// expiration (the first 40 % of a breath), the zero code otherwise
+static std::vector<uint16_t> waveform;
+
+static void makeWaveform() {
+    size_t perBreath = BENCH_BREATH_MS * 1000 / BENCH_SAMPLE_US;
+    size_t expiration = perBreath * 2 / 5;
+    for (size_t i = 0; i < (size_t)BENCH_WAVEFORM_S * 1000000 / BENCH_SAMPLE_US; i++) {
+        size_t k = i % perBreath;
+        float pa = k < expiration ? 60 * sinf(M_PI * k / expiration) : 0;
+        // a little sensor noise, fixed so every run sees the same codes
+        pa += ((i * 7919) % 11 - 5) * 0.01f;
+        waveform.push_back((uint16_t)(1024 + lroundf(fmaxf(pa, 0) / BENCH_SCALE)));
+    }
+}
+
+static void benchBernoulli(size_t n) {
+    float area2 = vo2VenturiArea(BENCH_DIAMETER);
+    float sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += vo2MassFlow(0.5f + (i & 255), 1.225f, VO2_AREA_26MM, area2);
+    keep(sum);
+}
+
+static void benchVolume(size_t n) {
+    VO2Calc calc(VO2_AREA_26MM, vo2VenturiArea(BENCH_DIAMETER));
+    uint64_t t = 1000000;
+    calc.begin(t);
+    for (size_t i = 0; i < n; i++) {
+        t += BENCH_SAMPLE_US;
+        calc.flowSample(t, 40 + (i & 7), 1.0);
+    }
+    keep(calc.volumeTotal);
+}
+
+static void benchSegmentation(size_t n) {
+    VO2Calc calc(VO2_AREA_26MM, vo2VenturiArea(BENCH_DIAMETER));
+    uint64_t t = 1000000;
+    calc.begin(t);
+    size_t breaths = 0;
+    for (size_t i = 0; i < n; i++) {
+        t += BENCH_SAMPLE_US;
+        float pa = vo2CodeToPressure(waveform[i % waveform.size()], BENCH_SCALE, 0);
+        calc.flowSample(t, pa, 1.0);
+        if (calc.ventilationState == EXPIRATION_DONE) {
+            calc.startInspiration(t);
+            breaths++;
+        }
+    }
+    keep(breaths);
+    keep(calc.volumeVE);
+}
+
+static void benchVO2(size_t n) {
+    VO2Calc calc(VO2_AREA_26MM, vo2VenturiArea(BENCH_DIAMETER));
+    calc.initialO2 = 20.9;
+    calc.initialCO2 = 400;
+    calc.volumeVEmean = 30;
+    for (size_t i = 0; i < n; i++) {
+        calc.o2Sample(16.5f + (i & 15) * 0.01f);
+        calc.co2Sample(30000 + (i & 15), 24, 80);
+        calc.breathCalc(80);
+    }
+    keep(calc.vo2Total);
+    keep(calc.respq);
+}
+
+static void benchTelemetry(size_t n) {
+    VO2Calc calc(VO2_AREA_26MM, vo2VenturiArea(BENCH_DIAMETER));
+    calc.volumeExp = 2.1;
+    calc.vo2Total = 3100;
+    calc.respq = 0.93;
+    uint8_t frame[TELEMETRY_FRAME_SIZE(BREATH_PAYLOAD_SIZE)];
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+        calc.breathEndUs = i * 3000000ull; // different bytes every frame, zeros included
+        bytes += telemetryBreathFrame(calc.breathRecord(i, 0), frame);
+        keep(frame);
+    }
+    keep(bytes);
+}
+
+static void benchO2Average(size_t n) {
+    OxygenAverage average;
+    float sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += average.add(20.9f - (i & 31) * 0.1f, BENCH_COLLECT_NUMBER);
+    keep(sum);
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)(size_t n);
+};
+
+static const Benchmark benchmarks[] = {
+    {"bernoulli_flow", benchBernoulli},
+    {"volume_integration", benchVolume},
+    {"breath_segmentation", benchSegmentation},
+    {"vo2_calc", benchVO2},
+    {"telemetry_breath", benchTelemetry},
+    {"o2_average", benchO2Average},
+};
+
+//--------------------------------------------------
+
+static void usage() {
+    fprintf(stderr, "usage: vo2_bench [--filter TEXT] [--min-time S]\n");
+}
+
+int main(int argc, char **argv) {
+    const char *filter = nullptr;
+    double minTime = 0.5;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            minTime = atof(argv[++i]);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    makeWaveform();
+
+    printf("%-22s %12s %12s %14s\n", "benchmark", "ns/op", "allocs/op", "iterations");
+    for (const Benchmark &b : benchmarks) {
+        if (filter && !strstr(b.name, filter))
+            continue;
+        b.run(1000); // warm up
+        // grow the batch until it takes a tenth of the time, then repeat it
+        size_t batch = 1000;
+        double seconds = 0;
+        while (true) {
+            auto start = std::chrono::steady_clock::now();
+            b.run(batch);
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (seconds >= minTime / 10 || batch >= ((size_t)1 << 40))
+                break;
+            batch *= seconds > 0 ? (size_t)fmin(10, fmax(2, minTime / 10 / seconds * 1.2)) : 10;
+        }
+        size_t iterations = 0;
+        size_t allocated = allocations;
+        auto start = std::chrono::steady_clock::now();
+        do {
+            b.run(batch);
+            iterations += batch;
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } while (seconds < minTime);
+        printf("%-22s %12.2f %12.3f %14zu\n", b.name, seconds * 1e9 / iterations,
+               (double)(allocations - allocated) / iterations, iterations);
+    }
+    return 0;
+}
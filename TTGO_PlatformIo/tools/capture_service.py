@@ -0,0 +1,246 @@
+#!/usr/bin/env python3
+"""Capture several devices at once into per-device and merged JSON-lines files.
+
+Usage examples:
+  python scripts/capture_service.py --port COM6 --port COM7 --out-dir captures/lab1
+  python scripts/capture_service.py --port /dev/ttyUSB0=maskA --port /dev/ttyUSB1=maskB --binary --baud 921600
+  python scripts/capture_service.py --port COM6 --duration 600 --print
+
+Every port is read concurrently from one asyncio loop; the blocking pyserial
+reads run in a thread per port and return whatever arrived within
+READ_TIMEOUT (up to READ_CHUNK bytes), so a fast device costs a few reads a
+second rather than one per line. Records are decoded like serial_file_parser.py
+does (JSON lines, or --binary telemetry frames) and tagged with
+
+  "device": the id after "=" in --port (default: the port name)
+  "host_t": host receive time, Unix seconds, taken when the read returned
+
+They are written to OUT_DIR/<device>.jsonl as they arrive and to
+OUT_DIR/merged.jsonl ordered by host_t: the merge holds records for
+REORDER_S so a read that completed a little later on another port still
+lands in order. A port that fails (unplugged mask) is reopened every
+RETRY_S without stopping the others. Ctrl+C or --duration ends the capture.
+"""
+from __future__ import annotations
+
+import argparse
+import asyncio
+import heapq
+import itertools
+import json
+import os
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+from typing import Union
+
+from serial_file_parser import _json_default, parse_block, parse_line
+
+try:
+    import serial
+except Exception:  # pragma: no cover - optional dependency
+    serial = None
+
+READ_CHUNK = 65536   # bytes per read at most
+READ_TIMEOUT = 0.05  # s a read waits for data
+REORDER_S = 0.5      # s the merged stream waits for slower ports
+RETRY_S = 2.0        # s between attempts to reopen a failed port
+
+
+class StreamDecoder:
+    """split_blocks() / parse_block() and the line reader for chunks as they arrive."""
+
+    def __init__(self, binary: bool, encoding: str = "utf-8") -> None:
+        self.binary = binary
+        self.encoding = encoding
+        self._buf = bytearray()
+
+    def feed(self, data: bytes) -> list[Union[dict, str]]:
+        self._buf += data
+        sep = b"\x00" if self.binary else b"\n"
+        out = []
+        while True:
+            idx = self._buf.find(sep)
+            if idx < 0:
+                break
+            block = bytes(self._buf[:idx])
+            del self._buf[:idx + 1]
+            if self.binary:
+                records = parse_block(block, self.encoding)
+            else:
+                records = [parse_line(block.decode(self.encoding, errors="ignore"))]
+            out.extend(rec for rec in records if rec is not None)
+        return out
+
+
+def tag(record: Union[dict, str], device: str, host_t: float) -> dict:
+    if not isinstance(record, dict):
+        record = {"raw": record}
+    return {"device": device, "host_t": round(host_t, 6), **record}
+
+
+class MergedWriter:
+    """Writes tagged records in host_t order, REORDER_S behind the newest one."""
+
+    def __init__(self, path: str, echo: bool = False) -> None:
+        self.fh = open(path, "w", encoding="utf-8")
+        self.echo = echo
+        self._heap: list = []
+        self._seq = itertools.count()  # keeps arrival order for equal times
+        self.count = 0
+
+    def add(self, rec: dict) -> None:
+        heapq.heappush(self._heap, (rec["host_t"], next(self._seq), rec))
+
+    def flush(self, until: float | None = None) -> None:
+        while self._heap and (until is None or self._heap[0][0] <= until):
+            _, _, rec = heapq.heappop(self._heap)
+            line = json.dumps(rec, ensure_ascii=False, default=_json_default)
+            self.fh.write(line + "\n")
+            if self.echo:
+                print(line)
+            self.count += 1
+        self.fh.flush()
+
+    def close(self) -> None:
+        self.flush()
+        self.fh.close()
+
+
+class DeviceCapture:
+    """Reads one port until stopped, reopening it after errors."""
+
+    def __init__(self, device: str, port: str, baud: int, binary: bool, encoding: str, out_dir: str) -> None:
+        self.device = device
+        self.port = port
+        self.baud = baud
+        self.decoder = StreamDecoder(binary, encoding)
+        self.fh = open(os.path.join(out_dir, f"{device}.jsonl"), "w", encoding="utf-8")
+        self.ser = None
+        self.records = 0
+        self.bytes = 0
+        self.errors = 0
+
+    def _open(self) -> None:
+        self.ser = serial.Serial(self.port, baudrate=self.baud, timeout=READ_TIMEOUT)
+
+    def _read(self) -> tuple[float, bytes]:
+        data = self.ser.read(READ_CHUNK)
+        return time.time(), data
+
+    def _close(self) -> None:
+        if self.ser is not None:
+            try:
+                self.ser.close()
+            except Exception:
+                pass
+            self.ser = None
+
+    async def run(self, pool: ThreadPoolExecutor, merged: MergedWriter, stop: asyncio.Event) -> None:
+        loop = asyncio.get_running_loop()
+        try:
+            while not stop.is_set():
+                try:
+                    if self.ser is None:
+                        await loop.run_in_executor(pool, self._open)
+                    host_t, data = await loop.run_in_executor(pool, self._read)
+                except Exception as exc:
+                    self.errors += 1
+                    print(f"{self.device}: {exc}", file=sys.stderr)
+                    self._close()
+                    try:
+                        await asyncio.wait_for(stop.wait(), RETRY_S)
+                    except asyncio.TimeoutError:
+                        pass
+                    continue
+                if not data:
+                    continue
+                self.bytes += len(data)
+                for record in self.decoder.feed(data):
+                    rec = tag(record, self.device, host_t)
+                    self.fh.write(json.dumps(rec, ensure_ascii=False, default=_json_default) + "\n")
+                    merged.add(rec)
+                    self.records += 1
+                self.fh.flush()
+        finally:  # also when cancelled (Ctrl+C)
+            self._close()
+            self.fh.close()
+
+
+def parse_port(spec: str) -> tuple[str, str]:
+    """"COM6=maskA" -> ("maskA", "COM6"); "/dev/ttyUSB0" -> ("ttyUSB0", "/dev/ttyUSB0")."""
+    port, _, device = spec.partition("=")
+    return device or os.path.basename(port), port
+
+
+async def capture(ports: list[str], out_dir: str, baud: int = 115200, binary: bool = False,
+                  encoding: str = "utf-8", duration: float = 0, echo: bool = False,
+                  stop: asyncio.Event | None = None,
+                  devices: list[DeviceCapture] | None = None) -> list[DeviceCapture]:
+    """Capture until duration s have passed (0 = until stop is set or the task is cancelled).
+
+    The DeviceCapture of every port is appended to `devices` when given, so the
+    caller still has the counts when the capture is interrupted.
+    """
+    specs = [parse_port(spec) for spec in ports]
+    if len({device for device, _ in specs}) != len(specs):
+        raise ValueError("device ids must be unique")  # before any <device>.jsonl is opened
+    os.makedirs(out_dir, exist_ok=True)
+    devices = [] if devices is None else devices
+    for device, port in specs:
+        devices.append(DeviceCapture(device, port, baud, binary, encoding, out_dir))
+
+    stop = stop or asyncio.Event()
+    merged = MergedWriter(os.path.join(out_dir, "merged.jsonl"), echo=echo)
+    start = time.monotonic()
+    with ThreadPoolExecutor(max_workers=len(devices), thread_name_prefix="capture") as pool:
+        tasks = [asyncio.create_task(d.run(pool, merged, stop)) for d in devices]
+        try:
+            while not stop.is_set():
+                if duration and time.monotonic() - start >= duration:
+                    break
+                await asyncio.sleep(0.1)
+                merged.flush(time.time() - REORDER_S)
+        finally:
+            stop.set()
+            await asyncio.gather(*tasks, return_exceptions=True)
+            merged.close()
+    return devices
+
+
+def main(argv: list[str] | None = None) -> int:
+    parser = argparse.ArgumentParser(description="Capture several serial devices into per-device and merged files")
+    parser.add_argument("--port", "-p", action="append", required=True,
+                        help="Serial port, optionally with a device id: COM6=maskA (repeat per device)")
+    parser.add_argument("--baud", "-b", type=int, default=115200, help="Baud rate for all ports")
+    parser.add_argument("--binary", action="store_true", help="Devices send binary telemetry frames (firmware default)")
+    parser.add_argument("--encoding", "-e", default="utf-8", help="Text encoding to use")
+    parser.add_argument("--out-dir", "-o", default="captures", help="Directory for <device>.jsonl and merged.jsonl")
+    parser.add_argument("--duration", type=float, default=0, help="Stop after this many seconds (0 = until Ctrl+C)")
+    parser.add_argument("--print", dest="echo", action="store_true", help="Also print the merged stream")
+    args = parser.parse_args(argv)
+
+    if serial is None:
+        print("pyserial is required. Install with: pip install pyserial", file=sys.stderr)
+        return 2
+
+    start = time.monotonic()
+    devices: list[DeviceCapture] = []
+    try:
+        asyncio.run(capture(args.port, args.out_dir, baud=args.baud, binary=args.binary, encoding=args.encoding,
+                            duration=args.duration, echo=args.echo, devices=devices))
+    except KeyboardInterrupt:
+        pass  # the files are closed, print what was captured
+    except ValueError as exc:
+        print(f"Error: {exc}", file=sys.stderr)
+        return 2
+
+    elapsed = max(time.monotonic() - start, 1e-6)
+    for d in devices:
+        print(f"{d.device}: {d.records} records, {d.bytes} bytes ({d.bytes / elapsed / 1e3:.1f} kB/s), "
+              f"{d.errors} errors", file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
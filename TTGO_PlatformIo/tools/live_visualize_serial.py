@@ -10,12 +10,24 @@ subplots in real time:
 Usage:
   python tools/live_visualize_serial.py --port COM6 --baud 115200
   python tools/live_visualize_serial.py --port COM6 --baud 115200 --output data.json
+  python tools/live_visualize_serial.py --port COM6 --binary
+  python tools/live_visualize_serial.py --port COM6 --baud 921600 --raw --window 20
+
+--raw shows the sample stream of the raw stream firmware (lilygo-vo2mini-raw):
+venturi pressure and O2 / CO2 over the last --window seconds, redrawn at --fps
+with blitting. The history is a fixed size numpy ring buffer and each trace is
+min/max decimated to the pixel width of its axes, so 100+ Hz input costs the
+same per frame after ten minutes as after ten seconds. The last breath is shown
+in the title.
 
 Controls:
  - Close the plot window to exit.
  - Click the plot to pause/resume.
 
 Notes:
+ - Current firmware sends one {"breath": {...}} record per breath, which is
+   plotted as is; the event/volume/vo2/vco2 stitching is kept for old logs.
+ - --binary reads the firmware's default binary frames instead of JSON lines.
  - Requires `pyserial`, `pandas`, and `matplotlib` (already in tools/requirements.txt)
 """
 from __future__ import annotations
@@ -36,6 +48,9 @@ except Exception:  # helpful error message later
 
 import matplotlib.pyplot as plt
 import matplotlib.animation as animation
+import numpy as np
+
+from serial_file_parser import RawStreamReplay, flatten_breath, read_binary_from_serial
 
 
 def is_debug_line(line: str) -> bool:
@@ -48,6 +63,68 @@ def is_debug_line(line: str) -> bool:
     return s.startswith('[') and '][' in s and ']:' in s
 
 
+class RingBuffer:
+    """Last `capacity` (t, value) samples in preallocated numpy arrays.
+
+    The reader thread appends, the GUI takes copies of a time window; both
+    under a lock. Nothing is allocated per sample and old samples are
+    overwritten, so memory does not grow with the session.
+    """
+
+    def __init__(self, capacity: int):
+        self.capacity = capacity
+        self.t = np.zeros(capacity)
+        self.v = np.full(capacity, np.nan)
+        self.count = 0  # samples ever written
+        self.lock = threading.Lock()
+
+    def extend(self, t, v) -> None:
+        t = np.asarray(t, dtype=float)[-self.capacity:]
+        v = np.asarray(v, dtype=float)[-self.capacity:]
+        with self.lock:
+            idx = (self.count + np.arange(len(t))) % self.capacity
+            self.t[idx] = t
+            self.v[idx] = v
+            self.count += len(t)
+
+    def since(self, t_from: float) -> tuple[np.ndarray, np.ndarray]:
+        """Samples with t >= t_from, oldest first."""
+        with self.lock:
+            n = min(self.count, self.capacity)
+            start = (self.count - n) % self.capacity
+            order = (start + np.arange(n)) % self.capacity
+            t, v = self.t[order], self.v[order]
+        first = np.searchsorted(t, t_from)
+        return t[first:], v[first:]
+
+    def last_t(self) -> float | None:
+        with self.lock:
+            return self.t[(self.count - 1) % self.capacity] if self.count else None
+
+
+def minmax_decimate(t: np.ndarray, v: np.ndarray, width: int) -> tuple[np.ndarray, np.ndarray]:
+    """Reduce to the min and max of each of `width` buckets, in time order.
+
+    A line through these looks the same at `width` pixels as one through all
+    samples, peaks included, however many samples there are.
+    """
+    n = len(t)
+    if width <= 0 or n <= 2 * width:
+        return t, v
+    per = n // width
+    cut = per * width
+    tb = t[:cut].reshape(width, per)
+    vb = v[:cut].reshape(width, per)
+    lo = np.nanargmin(np.where(np.isnan(vb), np.inf, vb), axis=1)
+    hi = np.nanargmax(np.where(np.isnan(vb), -np.inf, vb), axis=1)
+    first = np.minimum(lo, hi)
+    second = np.maximum(lo, hi)
+    rows = np.arange(width)
+    ts = np.column_stack((tb[rows, first], tb[rows, second])).ravel()
+    vs = np.column_stack((vb[rows, first], vb[rows, second])).ravel()
+    return np.concatenate((ts, t[cut:])), np.concatenate((vs, v[cut:]))
+
+
 class SerialEventReader(threading.Thread):
     """Background thread that reads lines from serial and emits completed events.
 
@@ -55,12 +132,17 @@ class SerialEventReader(threading.Thread):
     appears in the stream (signalling end of an expiration cycle).
     """
 
-    def __init__(self, port: str, baud: int, out_q: queue.Queue, encoding: str = "utf-8"):
+    def __init__(self, port: str, baud: int, out_q: queue.Queue, encoding: str = "utf-8", binary: bool = False,
+                 samples: Dict[str, RingBuffer] | None = None):
         super().__init__(daemon=True)
         self.port = port
         self.baud = baud
         self.encoding = encoding
+        self.binary = binary
         self.out_q = out_q
+        # raw stream samples go straight into these ("pa", "o2", "co2ppm")
+        self.samples = samples
+        self._replay = RawStreamReplay()
         self._stop = threading.Event()
         self._ser = None
 
@@ -77,15 +159,27 @@ class SerialEventReader(threading.Thread):
             self.out_q.put({"__error": "pyserial not installed"})
             return
 
+        self._current: Dict[str, Any] = {}
+        self._event_index = 0
+
+        if self.binary:
+            try:
+                for rec in read_binary_from_serial(self.port, self.baud, self.encoding):
+                    if self._stop.is_set():
+                        break
+                    if isinstance(rec, dict):
+                        self.handle_record(rec)
+            except Exception as exc:
+                self.out_q.put({"__error": f"Failed reading serial port: {exc}"})
+            self.flush()
+            return
+
         try:
             self._ser = serial.Serial(self.port, baudrate=self.baud, timeout=1)
         except Exception as exc:
             self.out_q.put({"__error": f"Failed opening serial port: {exc}"})
             return
 
-        current: Dict[str, Any] = {}
-        event_index = 0
-
         while not self._stop.is_set():
             try:
                 raw = self._ser.readline()
@@ -108,39 +202,64 @@ class SerialEventReader(threading.Thread):
                 except Exception:
                     # not JSON; skip
                     continue
-
-                # If the record contains an "event" key we treat it as boundary
-                if "event" in rec:
-                    # attach time if present
-                    if 'time' in rec:
-                        current['time'] = rec.get('time')
-                    # if there's any accumulated data, emit it
-                    if current:
-                        current['event_idx'] = event_index
-                        self.out_q.put(current.copy())
-                        event_index += 1
-                        current.clear()
-                    # keep the event label if other data follows
-                    # optionally store event name
-                    if 'event' in rec:
-                        current['event_name'] = rec.get('event')
-                else:
-                    # merge inner dicts (volume, vo2, vco2) into flat keys
-                    for k, v in rec.items():
-                        if isinstance(v, dict):
-                            for fk, fv in v.items():
-                                current[f"{k}.{fk}"] = fv
-                        else:
-                            current[k] = v
+                if isinstance(rec, dict):
+                    self.handle_record(rec)
 
             except Exception:
                 # small sleep on unexpected errors to avoid tight loop
                 time.sleep(0.1)
 
+        self.flush()
+
+    def handle_record(self, rec: Dict[str, Any]) -> None:
+        current = self._current
+
+        if self.samples is not None and ('pressure_batch' in rec or 'gas_sample' in rec
+                                         or 'stream_info' in rec):
+            rows = list(self._replay.rows(rec))
+            if rows:
+                t = [row['t_us'] / 1e6 for row in rows]
+                for key, buf in self.samples.items():
+                    if key in rows[0]:
+                        buf.extend(t, [row[key] if row[key] is not None else np.nan for row in rows])
+            return
+
+        # a breath record is complete on its own
+        row = flatten_breath(rec)
+        if row is not None:
+            row['event_idx'] = row.get('seq', self._event_index)
+            self.out_q.put(row)
+            self._event_index += 1
+            return
+
+        # If the record contains an "event" key we treat it as boundary
+        if "event" in rec:
+            # attach time if present
+            if 'time' in rec:
+                current['time'] = rec.get('time')
+            # if there's any accumulated data, emit it
+            if current:
+                current['event_idx'] = self._event_index
+                self.out_q.put(current.copy())
+                self._event_index += 1
+                current.clear()
+            # keep the event label if other data follows
+            current['event_name'] = rec.get('event')
+        else:
+            # merge inner dicts (volume, vo2, vco2) into flat keys
+            for k, v in rec.items():
+                if isinstance(v, dict):
+                    for fk, fv in v.items():
+                        current[f"{k}.{fk}"] = fv
+                else:
+                    current[k] = v
+
+    def flush(self) -> None:
         # On exit, if a partial current exists push it
-        if current:
-            current['event_idx'] = event_index
-            self.out_q.put(current)
+        if self._current:
+            self._current['event_idx'] = self._event_index
+            self.out_q.put(self._current)
+            self._current = {}
 
 
 def flatten_event(event: Dict[str, Any]) -> Dict[str, float]:
@@ -161,9 +280,10 @@ def flatten_event(event: Dict[str, Any]) -> Dict[str, float]:
     return out
 
 
-def run_live_plot(port: str, baud: int, max_points: int = 200, output_file: str | None = None):
+def run_live_plot(port: str, baud: int, max_points: int = 200, output_file: str | None = None,
+                  binary: bool = False):
     q: queue.Queue = queue.Queue()
-    reader = SerialEventReader(port, baud, q)
+    reader = SerialEventReader(port, baud, q, binary=binary)
     reader.start()
 
     # open output file if specified
@@ -344,12 +464,148 @@ def run_live_plot(port: str, baud: int, max_points: int = 200, output_file: str
                 pass
 
 
+def run_raw_plot(port: str, baud: int, window_s: float = 20.0, fps: float = 30.0,
+                 output_file: str | None = None):
+    # 100 Hz pressure with room for faster firmware, gas is much slower
+    samples = {'pa': RingBuffer(int(window_s * 500)), 'o2': RingBuffer(int(window_s * 50)),
+               'co2ppm': RingBuffer(int(window_s * 50))}
+    q: queue.Queue = queue.Queue()
+    reader = SerialEventReader(port, baud, q, binary=True, samples=samples)
+    reader.start()
+
+    out_fh = None
+    if output_file:
+        try:
+            out_fh = open(output_file, 'w', encoding='utf-8')
+        except Exception as exc:
+            print(f'Warning: could not open output file {output_file}: {exc}')
+
+    fig, (ax1, ax2) = plt.subplots(2, 1, figsize=(10, 7), sharex=True)
+    ax3 = ax2.twinx()
+    line_pa, = ax1.plot([], [], '-', linewidth=1, label='pressure (Pa)', animated=True)
+    line_o2, = ax2.plot([], [], '-', color='tab:blue', linewidth=1.5, label='O2 (%)', animated=True)
+    line_co2, = ax3.plot([], [], '-', color='tab:red', linewidth=1.5, label='CO2 (ppm)', animated=True)
+    title = ax1.text(0.01, 1.02, 'waiting for samples', transform=ax1.transAxes, animated=True)
+    ax1.set_ylabel('Pa')
+    ax2.set_ylabel('O2 %')
+    ax3.set_ylabel('CO2 ppm')
+    ax2.set_xlabel('Time (s, 0 = newest sample)')
+    ax1.set_xlim(-window_s, 0)
+    ax1.grid(True)
+    ax2.grid(True)
+    ax1.legend(loc='upper left')
+    ax2.legend(handles=[line_o2, line_co2], loc='upper left')
+    traces = [(line_pa, ax1, samples['pa']), (line_o2, ax2, samples['o2']), (line_co2, ax3, samples['co2ppm'])]
+    artists = [line_pa, line_o2, line_co2]
+
+    # 'clean' is the figure without the animated artists, 'bg' adds the title:
+    # text is by far the slowest thing to draw, so it is drawn once per breath
+    state = {'clean': None, 'bg': None, 'paused': False, 'frames': 0, 'since': time.monotonic()}
+
+    def stamp_title():
+        fig.canvas.restore_region(state['clean'])
+        fig.draw_artist(title)
+        state['bg'] = fig.canvas.copy_from_bbox(fig.bbox)
+
+    def on_draw(event):
+        # a full redraw (start, resize, new limits) gives a new background
+        state['clean'] = fig.canvas.copy_from_bbox(fig.bbox)
+        stamp_title()
+        for artist in artists:
+            fig.draw_artist(artist)
+
+    def on_click(event):
+        state['paused'] = not state['paused']
+
+    fig.canvas.mpl_connect('draw_event', on_draw)
+    fig.canvas.mpl_connect('button_press_event', on_click)
+
+    def fit(ax, v) -> bool:
+        """Grow the y range at once, shrink it once the data uses less than a third of it."""
+        v = v[np.isfinite(v)]
+        if not len(v):
+            return False
+        lo, hi = ax.get_ylim()
+        mn, mx = float(v.min()), float(v.max())
+        # headroom so slow drift doesn't relimit (and fully redraw) every few frames
+        margin = max((mx - mn) * 0.25, max(abs(mn), abs(mx)) * 0.02, 0.5)
+        if mn >= lo and mx <= hi and (mx - mn + 2 * margin) * 3 >= hi - lo:
+            return False
+        ax.set_ylim(mn - margin, mx + margin)
+        return True
+
+    def frame():
+        titled = False
+        while True:
+            try:
+                ev = q.get_nowait()
+            except queue.Empty:
+                break
+            if ev.get('__error'):
+                print('Reader error:', ev.get('__error'))
+                reader.stop()
+                plt.close(fig)
+                return
+            if out_fh:
+                out_fh.write(json.dumps(ev, ensure_ascii=False) + '\n')
+            if 'seq' not in ev:
+                continue
+            title.set_text(f"breath {ev.get('seq', '')}: VE {ev.get('volume.VE', 0):.1f} L/min, "
+                           f"VO2 {ev.get('vo2.vo2Total', 0):.0f} ml/min, RQ {ev.get('vco2.respq', 0):.2f}")
+            titled = True
+        if state['paused'] or state['bg'] is None:
+            return
+        if titled:
+            stamp_title()
+        now = samples['pa'].last_t()
+        if now is None:
+            return
+        relimit = False
+        for line, ax, buf in traces:
+            t, v = buf.since(now - window_s)
+            width = int(ax.get_window_extent().width)
+            t, v = minmax_decimate(t - now, v, width)
+            line.set_data(t, v)
+            relimit |= fit(ax, v)
+        if relimit:
+            fig.canvas.draw_idle()  # on_draw takes a new background and draws the traces
+            return
+        fig.canvas.restore_region(state['bg'])
+        for artist in artists:
+            fig.draw_artist(artist)
+        fig.canvas.blit(fig.bbox)
+        state['frames'] += 1
+
+    timer = fig.canvas.new_timer(interval=int(1000 / fps))
+    timer.add_callback(frame)
+    timer.start()
+
+    try:
+        plt.tight_layout()
+        plt.show()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        timer.stop()
+        reader.stop()
+        elapsed = time.monotonic() - state['since']
+        print(f"{state['frames']} frames in {elapsed:.0f} s ({state['frames'] / max(elapsed, 1e-9):.1f} fps), "
+              f"{samples['pa'].count} pressure samples")
+        if out_fh:
+            out_fh.close()
+            print(f'Saved data to {output_file}')
+
+
 def main(argv: list[str] | None = None) -> int:
     parser = argparse.ArgumentParser(description='Live-visualize serial JSON-lines from device')
     parser.add_argument('--port', '-p', required=True, help='Serial port (e.g. COM6)')
     parser.add_argument('--baud', '-b', type=int, default=115200, help='Baud rate')
     parser.add_argument('--max-points', type=int, default=200, help='Number of events to keep visible')
     parser.add_argument('--output', '-o', help='Output JSON-lines file to save data')
+    parser.add_argument('--binary', action='store_true', help='Device sends binary telemetry frames (firmware default)')
+    parser.add_argument('--raw', action='store_true', help='Plot the raw sample stream (lilygo-vo2mini-raw firmware, implies --binary)')
+    parser.add_argument('--window', type=float, default=20.0, help='With --raw: seconds of history shown')
+    parser.add_argument('--fps', type=float, default=30.0, help='With --raw: redraw rate')
     args = parser.parse_args(argv)
 
     if serial is None:
@@ -357,7 +613,11 @@ def main(argv: list[str] | None = None) -> int:
         return 2
 
     try:
-        run_live_plot(args.port, args.baud, max_points=args.max_points, output_file=args.output)
+        if args.raw:
+            run_raw_plot(args.port, args.baud, window_s=args.window, fps=args.fps, output_file=args.output)
+        else:
+            run_live_plot(args.port, args.baud, max_points=args.max_points, output_file=args.output,
+                          binary=args.binary)
     except Exception as exc:
         print('Error running live plot:', exc)
         return 1
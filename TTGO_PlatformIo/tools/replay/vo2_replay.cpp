@@ -0,0 +1,639 @@
+// Replays recorded sensor data through the firmware's breath and VO2
+// calculations (lib/VO2Calc) and prints the recomputed breaths.
+//
+//   vo2_replay [options] FILE
+//
+// FILE is detected from its content:
+//   - a session file recorded with RAW_LOG (/sNNNN.vo2, see vo2_session_block.h)
+//   - a capture of the lilygo-vo2mini-raw stream (serial_file_parser.py --capture)
+//   - JSON lines written by serial_file_parser.py (--out-file) from either,
+//     or from the TELEMETRY_RAW_SAMPLES debug output
+// The samples are sorted by time and fed to VO2Calc in the order loop() in
+// main_mini.cpp takes them: pressure readings to flowSample(), O2 / CO2
+// readings to o2Sample() / co2Sample(), and breathCalc() once the readings
+// after the end of an expiration are in. Every breath is printed as one
+// {"breath": ...} JSON line like the firmware's TELEMETRY_JSON output, so
+// the Python tools read it unchanged. A summary goes to stderr, including
+// how well the breaths recorded in the input match the recomputed ones.
+//
+// Build with pio run -e replay (binary in .pio/build/replay/program), or
+// without PlatformIO, from the project directory:
+//   g++ -O2 -std=gnu++17 -Ilib/Telemetry/src -Ilib/VO2Calc/src -o vo2_replay
+//       tools/replay/vo2_replay.cpp lib/Telemetry/src/*.cpp lib/VO2Calc/src/*.cpp
+
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "vo2_calc.h"
+#include "vo2_session_block.h"
+#include "vo2_telemetry.h"
+#include "vo2_varint.h"
+
+#define REPLAY_DIAMETER 18    // DIAMETER in main_mini.cpp
+#define REPLAY_TEMP_C 20.0    // the CO2 sensor temperature isn't recorded
+#define REPLAY_MATCH_US 2000  // recorded and replayed breath end within this
+
+enum sampleKinds
+{
+    SAMPLE_CODE,     // D6F-PH output code
+    SAMPLE_PRESSURE, // Pa, TELEMETRY_RAW_SAMPLES
+    SAMPLE_GAS,      // O2 % and CO2 ppm
+};
+
+struct Sample
+{
+    uint64_t us;
+    uint8_t kind;
+    uint16_t code;
+    float a; // Pa or O2
+    float b; // CO2
+};
+
+struct Input
+{
+    std::vector<Sample> samples;
+    std::vector<BreathRecord> recorded; // breaths the device computed
+    bool haveInfo = false;
+    float scale = 0;
+    float offset = 0;
+    bool haveSession = false;
+    float correctionSensor = 1.0;
+    float weightkg = 80.0;
+    float initialO2 = 0;
+    float initialCO2 = 0;
+    unsigned badBlocks = 0;
+    unsigned badFrames = 0;
+};
+
+struct Options
+{
+    int diameter = REPLAY_DIAMETER;
+    float tempC = REPLAY_TEMP_C;
+    float correctionSensor = NAN; // NAN: from the session file, else 1.0
+    float weightkg = NAN;
+    float initialO2 = NAN;
+    float initialCO2 = NAN;
+    bool quiet = false;
+    const char *path = nullptr;
+};
+
+//--------------------------------------------------
+// little endian fields
+
+static uint16_t getU16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t getU64(const uint8_t *p) {
+    return getU32(p) | ((uint64_t)getU32(p + 4) << 32);
+}
+
+static float getF32(const uint8_t *p) {
+    uint32_t u = getU32(p);
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static bool decodeBreath(const uint8_t *p, size_t len, BreathRecord &rec) {
+    if (len != BREATH_PAYLOAD_SIZE || p[0] != BREATH_SCHEMA)
+        return false;
+    rec.seq = getU32(p + 1);
+    rec.timeUs = getU64(p + 5);
+    rec.inspirationMs = getU32(p + 13);
+    rec.expirationMs = getU32(p + 17);
+    rec.flags = p[21];
+    float *values[] = {&rec.volumeExp, &rec.VE, &rec.VEmean, &rec.freqVE, &rec.freqVEmean,
+                       &rec.vo2Total, &rec.vo2Rel, &rec.deltaO2_frac, &rec.vo2TotalIn, &rec.vo2TotalOut,
+                       &rec.vco2Total, &rec.vco2Rel, &rec.respq};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+        *values[i] = getF32(p + 22 + 4 * i);
+    return true;
+}
+
+// 32 bit micros() of the raw stream to a monotonic time, going by the
+// nearest 64 bit value since batches arrive after the gas samples in between
+struct Unwrap
+{
+    bool started = false;
+    uint64_t last = 0;
+
+    uint64_t operator()(uint32_t t) {
+        if (!started) {
+            started = true;
+            last = t;
+            return last;
+        }
+        int32_t delta = (int32_t)(t - (uint32_t)last);
+        last += delta;
+        return last;
+    }
+};
+
+//--------------------------------------------------
+// session files
+
+static bool readSessionFile(const std::vector<uint8_t> &data, Input &in) {
+    for (size_t pos = 0; pos + SESSION_BLOCK_SIZE <= data.size(); pos += SESSION_BLOCK_SIZE) {
+        const uint8_t *b = &data[pos];
+        if (getU32(b) != SESSION_MAGIC || b[4] != SESSION_FORMAT ||
+            telemetryCrc16(b, SESSION_BLOCK_END) != getU16(b + SESSION_BLOCK_END)) {
+            in.badBlocks++;
+            continue;
+        }
+        const uint8_t *p = b + SESSION_BLOCK_HEADER;
+        const uint8_t *end = b + SESSION_BLOCK_END;
+        switch (b[5]) {
+        case SESSION_BLOCK_INFO: {
+            // schema, block size, record size, firmware, start
+            p += 1 + 2 + 1 + SESSION_FIRMWARE_SIZE + 8;
+            in.haveSession = true;
+            in.correctionSensor = getF32(p);
+            in.weightkg = getF32(p + 4);
+            in.initialO2 = getF32(p + 8);
+            in.initialCO2 = getF32(p + 12);
+            in.haveInfo = true;
+            in.scale = getF32(p + 17);
+            in.offset = getF32(p + 21);
+            break;
+        }
+        case SESSION_BLOCK_BREATHS: {
+            uint8_t count = *p++;
+            BreathRecord rec;
+            for (uint8_t i = 0; i < count && p + BREATH_PAYLOAD_SIZE <= end; i++, p += BREATH_PAYLOAD_SIZE)
+                if (decodeBreath(p, BREATH_PAYLOAD_SIZE, rec))
+                    in.recorded.push_back(rec);
+            break;
+        }
+        case SESSION_BLOCK_PRESSURE: {
+            uint16_t count = getU16(p);
+            uint32_t tick = getU32(p + 2);
+            int32_t code = getU16(p + 6);
+            int32_t dt = 0;
+            p += 8;
+            for (uint16_t i = 0; i < count; i++) {
+                if (i > 0) {
+                    int32_t ddt, dc;
+                    if (p >= end)
+                        break;
+                    uint8_t nibbles = *p++;
+                    if ((nibbles & 0xF0) == SESSION_NIBBLE_ESCAPE) {
+                        if (!(p = getSVarint(p, end, &ddt)) || !(p = getSVarint(p, end, &dc)))
+                            break;
+                    } else {
+                        ddt = zigzagDecode(nibbles >> 4);
+                        dc = zigzagDecode(nibbles & 0x0F);
+                    }
+                    dt += ddt;
+                    tick += dt;
+                    code += dc;
+                }
+                in.samples.push_back({(uint64_t)tick * SESSION_TICK_US, SAMPLE_CODE, (uint16_t)code, 0, 0});
+            }
+            break;
+        }
+        case SESSION_BLOCK_GAS: {
+            uint16_t count = getU16(p);
+            uint32_t tick = getU32(p + 2);
+            int32_t o2 = getU16(p + 6);
+            int32_t co2 = getU16(p + 8);
+            p += 10;
+            for (uint16_t i = 0; i < count; i++) {
+                if (i > 0) {
+                    uint32_t dt;
+                    int32_t do2, dco2;
+                    if (!(p = getUVarint(p, end, &dt)) || !(p = getSVarint(p, end, &do2)) ||
+                        !(p = getSVarint(p, end, &dco2)))
+                        break;
+                    tick += dt;
+                    o2 += do2;
+                    co2 += dco2;
+                }
+                in.samples.push_back({(uint64_t)tick * SESSION_TICK_US, SAMPLE_GAS, 0, o2 / 1000.0f, (float)co2});
+            }
+            break;
+        }
+        }
+    }
+    return true;
+}
+
+//--------------------------------------------------
+// raw stream captures
+
+static size_t cobsDecode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t n = 0;
+    for (size_t i = 0; i < len;) {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > len)
+            return 0;
+        for (uint8_t j = 1; j < code; j++)
+            out[n++] = in[i++];
+        if (code < 0xFF && i < len)
+            out[n++] = 0;
+    }
+    return n;
+}
+
+static void readFrame(const uint8_t *block, size_t len, Input &in, Unwrap &unwrap) {
+    if (len < 5 || len > TELEMETRY_MAX_FRAME)
+        return;
+    uint8_t raw[TELEMETRY_MAX_FRAME];
+    size_t n = cobsDecode(block, len, raw);
+    if (n < 4 || telemetryCrc16(raw, n - 2) != getU16(raw + n - 2) || raw[0] != TELEMETRY_VERSION) {
+        in.badFrames++; // also ESP log text between the frames
+        return;
+    }
+    const uint8_t *p = raw + 2;
+    size_t plen = n - 4;
+    BreathRecord rec;
+    switch (raw[1]) {
+    case TELEMETRY_STREAM_INFO:
+        if (plen == 9) {
+            in.haveInfo = true;
+            in.scale = getF32(p + 1);
+            in.offset = getF32(p + 5);
+        }
+        break;
+    case TELEMETRY_PRESSURE_BATCH: {
+        if (plen < PRESSURE_BATCH_HEADER)
+            break;
+        const uint8_t *end = p + plen;
+        uint32_t t = getU32(p);
+        uint16_t code = getU16(p + 4);
+        uint8_t count = p[6];
+        p += PRESSURE_BATCH_HEADER;
+        for (uint8_t i = 0; i < count; i++) {
+            if (i > 0) {
+                uint32_t dt;
+                int32_t dc;
+                if (!(p = getUVarint(p, end, &dt)) || !(p = getSVarint(p, end, &dc)))
+                    break;
+                t += dt;
+                code += dc;
+            }
+            in.samples.push_back({unwrap(t), SAMPLE_CODE, code, 0, 0});
+        }
+        break;
+    }
+    case TELEMETRY_GAS_SAMPLE:
+        if (plen == 12)
+            in.samples.push_back({unwrap(getU32(p)), SAMPLE_GAS, 0, getF32(p + 4), getF32(p + 8)});
+        break;
+    case TELEMETRY_RAW_SAMPLE:
+        if (plen == 16) {
+            uint64_t us = (uint64_t)getU32(p) * 1000;
+            in.samples.push_back({us, SAMPLE_GAS, 0, getF32(p + 8), getF32(p + 12)});
+            in.samples.push_back({us, SAMPLE_PRESSURE, 0, getF32(p + 4), 0});
+        }
+        break;
+    case TELEMETRY_BREATH:
+        if (decodeBreath(p, plen, rec))
+            in.recorded.push_back(rec);
+        break;
+    }
+}
+
+static bool readCapture(const std::vector<uint8_t> &data, Input &in) {
+    Unwrap unwrap;
+    size_t start = 0;
+    for (size_t i = 0; i <= data.size(); i++) {
+        if (i == data.size() || data[i] == 0) {
+            if (i > start)
+                readFrame(&data[start], i - start, in, unwrap);
+            start = i + 1;
+        }
+    }
+    return true;
+}
+
+//--------------------------------------------------
+// JSON lines, just enough of JSON for serial_file_parser.py's records
+
+struct Json
+{
+    enum { NUL, NUM, STR, ARR, OBJ } type = NUL;
+    double num = 0;
+    std::string str;
+    std::vector<Json> items;
+    std::vector<std::string> keys; // OBJ: items[i] is the value of keys[i]
+
+    const Json *get(const char *key) const {
+        for (size_t i = 0; i < keys.size(); i++)
+            if (keys[i] == key)
+                return &items[i];
+        return nullptr;
+    }
+    double number(const char *key, double fallback = NAN) const {
+        const Json *v = get(key);
+        return v && v->type == NUM ? v->num : fallback;
+    }
+};
+
+static const char *skipSpace(const char *p) {
+    while (isspace((unsigned char)*p))
+        p++;
+    return p;
+}
+
+// returns nullptr on a syntax error
+static const char *parseJson(const char *p, Json &v, int depth = 0) {
+    p = skipSpace(p);
+    if (depth > 16)
+        return nullptr;
+    if (*p == '{' || *p == '[') {
+        bool object = *p == '{';
+        char close = object ? '}' : ']';
+        v.type = object ? Json::OBJ : Json::ARR;
+        p = skipSpace(p + 1);
+        if (*p == close)
+            return p + 1;
+        while (true) {
+            if (object) {
+                Json key;
+                if (!(p = parseJson(p, key, depth + 1)) || key.type != Json::STR)
+                    return nullptr;
+                p = skipSpace(p);
+                if (*p++ != ':')
+                    return nullptr;
+                v.keys.push_back(key.str);
+            }
+            v.items.emplace_back();
+            if (!(p = parseJson(p, v.items.back(), depth + 1)))
+                return nullptr;
+            p = skipSpace(p);
+            if (*p == close)
+                return p + 1;
+            if (*p++ != ',')
+                return nullptr;
+        }
+    }
+    if (*p == '"') {
+        v.type = Json::STR;
+        for (p++; *p && *p != '"'; p++) {
+            if (*p == '\\' && p[1])
+                p++; // escapes are kept as the plain character, names don't use them
+            v.str += *p;
+        }
+        return *p == '"' ? p + 1 : nullptr;
+    }
+    if (strncmp(p, "null", 4) == 0 || strncmp(p, "true", 4) == 0)
+        return v.type = Json::NUL, p + 4;
+    if (strncmp(p, "false", 5) == 0)
+        return v.type = Json::NUL, p + 5;
+    char *end;
+    v.num = strtod(p, &end);
+    if (end == p)
+        return nullptr;
+    v.type = Json::NUM;
+    return end;
+}
+
+static void readJsonRecord(const Json &rec, Input &in, Unwrap &unwrap) {
+    const Json *v;
+    if ((v = rec.get("stream_info"))) {
+        in.haveInfo = true;
+        in.scale = v->number("scale", 0);
+        in.offset = v->number("offset", 0);
+    } else if ((v = rec.get("session"))) {
+        in.haveSession = true;
+        in.correctionSensor = v->number("correctionSensor", 1.0);
+        in.weightkg = v->number("weightkg", 80.0);
+        in.initialO2 = v->number("initialO2", 0);
+        in.initialCO2 = v->number("initialCO2", 0);
+    } else if ((v = rec.get("pressure_batch"))) {
+        const Json *t = v->get("t_us"), *code = v->get("code");
+        if (!t || !code || t->items.size() != code->items.size())
+            return;
+        for (size_t i = 0; i < t->items.size(); i++) {
+            // session files give 64 bit times, the serial stream 32 bit micros()
+            double us = t->items[i].num;
+            uint64_t time = us >= 4294967296.0 ? (uint64_t)us : unwrap((uint32_t)us);
+            in.samples.push_back({time, SAMPLE_CODE, (uint16_t)code->items[i].num, 0, 0});
+        }
+    } else if ((v = rec.get("gas_sample"))) {
+        double us = v->number("t_us", 0);
+        uint64_t time = us >= 4294967296.0 ? (uint64_t)us : unwrap((uint32_t)us);
+        in.samples.push_back({time, SAMPLE_GAS, 0, (float)v->number("o2", 0), (float)v->number("co2ppm", 0)});
+    } else if ((v = rec.get("sample"))) {
+        uint64_t us = (uint64_t)v->number("time_ms", 0) * 1000;
+        in.samples.push_back({us, SAMPLE_GAS, 0, (float)v->number("o2", 0), (float)v->number("co2ppm", 0)});
+        in.samples.push_back({us, SAMPLE_PRESSURE, 0, (float)v->number("pressure"), 0});
+    } else if ((v = rec.get("breath"))) {
+        BreathRecord b = {};
+        b.seq = (uint32_t)v->number("seq", 0);
+        b.timeUs = (uint64_t)v->number("t_us", 0);
+        b.VE = v->number("VE", 0);
+        b.vo2Total = v->number("vo2Total", 0);
+        b.vco2Total = v->number("vco2Total", 0);
+        in.recorded.push_back(b);
+    }
+}
+
+static bool readJsonLines(const std::vector<uint8_t> &data, Input &in) {
+    Unwrap unwrap;
+    std::string line;
+    for (size_t i = 0; i <= data.size(); i++) {
+        if (i < data.size() && data[i] != '\n') {
+            line += (char)data[i];
+            continue;
+        }
+        Json rec;
+        const char *start = skipSpace(line.c_str());
+        if (*start == '{' && parseJson(start, rec) && rec.type == Json::OBJ)
+            readJsonRecord(rec, in, unwrap);
+        line.clear();
+    }
+    return true;
+}
+
+//--------------------------------------------------
+
+static void printBreath(const BreathRecord &rec) {
+    printf("{\"breath\": {\"schema\": %u, \"seq\": %u, \"t_us\": %llu, \"insp_ms\": %u, \"exp_ms\": %u, \"flags\": %u, "
+           "\"volumeExp\": %.2f, \"VE\": %.2f, \"VEmean\": %.2f, \"freqVE\": %.1f, \"freqVEmean\": %.1f, "
+           "\"vo2Total\": %.2f, \"vo2Rel\": %.2f, \"deltaO2_frac\": %.2f, \"vo2TotalIn\": %.2f, \"vo2TotalOut\": %.2f, "
+           "\"vco2Total\": %.2f, \"vco2Rel\": %.2f, \"respq\": %.2f}}\n",
+           (unsigned)BREATH_SCHEMA, (unsigned)rec.seq, (unsigned long long)rec.timeUs, (unsigned)rec.inspirationMs,
+           (unsigned)rec.expirationMs, (unsigned)rec.flags, rec.volumeExp, rec.VE, rec.VEmean, rec.freqVE,
+           rec.freqVEmean, rec.vo2Total, rec.vo2Rel, rec.deltaO2_frac, rec.vo2TotalIn, rec.vo2TotalOut,
+           rec.vco2Total, rec.vco2Rel, rec.respq);
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: vo2_replay [options] FILE\n"
+            "  FILE: session file, raw stream capture or serial_file_parser.py JSON lines\n"
+            "  --diameter MM     venturi throat of the printed case (default %d)\n"
+            "  --temp C          CO2 sensor temperature for the air density (default %.0f)\n"
+            "  --correction F    flow correction (default: from the session file, else 1.0)\n"
+            "  --weight KG       body weight (default: from the session file, else 80)\n"
+            "  --initial-o2 P    O2 %% of ambient air (default: from the session file, else the readings)\n"
+            "  --initial-co2 PPM CO2 of ambient air (default: from the session file, else the first reading)\n"
+            "  --quiet           summary only\n",
+            REPLAY_DIAMETER, REPLAY_TEMP_C);
+}
+
+static bool parseArgs(int argc, char **argv, Options &opt) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "--quiet") == 0) {
+            opt.quiet = true;
+            continue;
+        }
+        if (arg[0] != '-') {
+            opt.path = arg;
+            continue;
+        }
+        if (!value)
+            return false;
+        i++;
+        if (strcmp(arg, "--diameter") == 0)
+            opt.diameter = atoi(value);
+        else if (strcmp(arg, "--temp") == 0)
+            opt.tempC = atof(value);
+        else if (strcmp(arg, "--correction") == 0)
+            opt.correctionSensor = atof(value);
+        else if (strcmp(arg, "--weight") == 0)
+            opt.weightkg = atof(value);
+        else if (strcmp(arg, "--initial-o2") == 0)
+            opt.initialO2 = atof(value);
+        else if (strcmp(arg, "--initial-co2") == 0)
+            opt.initialCO2 = atof(value);
+        else
+            return false;
+    }
+    return opt.path != nullptr;
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+    FILE *f = fopen(opt.path, "rb");
+    if (!f) {
+        perror(opt.path);
+        return 1;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) > 0;)
+        data.insert(data.end(), buf, buf + n);
+    fclose(f);
+
+    auto started = std::chrono::steady_clock::now();
+    Input in;
+    const char *format;
+    if (data.size() >= 4 && getU32(data.data()) == SESSION_MAGIC) {
+        format = "session file";
+        readSessionFile(data, in);
+    } else if (!data.empty() && data[0] == 0) {
+        format = "raw capture";
+        readCapture(data, in);
+    } else {
+        format = "JSON lines";
+        readJsonLines(data, in);
+    }
+    // blocks and batches of the different sensors overlap in time
+    std::stable_sort(in.samples.begin(), in.samples.end(),
+                     [](const Sample &a, const Sample &b) { return a.us < b.us; });
+    auto loaded = std::chrono::steady_clock::now();
+
+    bool needInfo = std::any_of(in.samples.begin(), in.samples.end(),
+                                [](const Sample &s) { return s.kind == SAMPLE_CODE; });
+    if (needInfo && !in.haveInfo) {
+        fprintf(stderr, "%s: pressure codes without the scaling (stream info)\n", opt.path);
+        return 1;
+    }
+    float correctionSensor = !isnan(opt.correctionSensor) ? opt.correctionSensor : in.correctionSensor;
+    float weightkg = !isnan(opt.weightkg) ? opt.weightkg : in.weightkg;
+
+    VO2Calc calc(VO2_AREA_26MM, vo2VenturiArea(opt.diameter));
+    calc.initialO2 = !isnan(opt.initialO2) ? opt.initialO2 : in.initialO2;
+    calc.initialCO2 = !isnan(opt.initialCO2) ? opt.initialCO2 : in.initialCO2;
+    if (!in.samples.empty())
+        calc.begin(in.samples.front().us);
+
+    std::vector<BreathRecord> breaths;
+    bool breathPending = false; // expiration done, waiting for its gas readings
+    bool lastWasO2 = false;
+    uint32_t seq = 0;
+    size_t pressureSamples = 0;
+    for (const Sample &s : in.samples) {
+        if (s.kind == SAMPLE_GAS) {
+            // each logged reading changed one of the two values, readO2() then readCO2()
+            bool co2 = s.b != calc.co2ppm || (s.a == calc.lastO2 && lastWasO2);
+            if (co2)
+                calc.co2Sample(s.b, opt.tempC, weightkg);
+            else
+                calc.o2Sample(s.a);
+            lastWasO2 = !co2;
+            continue;
+        }
+        if (breathPending) {
+            calc.breathCalc(weightkg);
+            breaths.push_back(calc.breathRecord(++seq, 0));
+            calc.sensorLimitBreath = false;
+            breathPending = false;
+        }
+        float pa = s.kind == SAMPLE_CODE ? vo2CodeToPressure(s.code, in.scale, in.offset) : s.a;
+        calc.flowSample(s.us, pa, correctionSensor);
+        pressureSamples++;
+        if (calc.ventilationState == EXPIRATION_DONE) {
+            calc.startInspiration(s.us);
+            breathPending = true;
+        }
+    }
+    if (breathPending) {
+        calc.breathCalc(weightkg);
+        breaths.push_back(calc.breathRecord(++seq, 0));
+    }
+    auto done = std::chrono::steady_clock::now();
+
+    if (!opt.quiet)
+        for (const BreathRecord &rec : breaths)
+            printBreath(rec);
+
+    double loadS = std::chrono::duration<double>(loaded - started).count();
+    double calcS = std::chrono::duration<double>(done - loaded).count();
+    double spanS = in.samples.empty() ? 0 : (in.samples.back().us - in.samples.front().us) / 1e6;
+    fprintf(stderr, "%s, %s: %zu samples (%zu pressure) over %.1f min, %zu breaths\n", opt.path, format,
+            in.samples.size(), pressureSamples, spanS / 60, breaths.size());
+    if (in.badBlocks || in.badFrames)
+        fprintf(stderr, "skipped %u bad blocks, %u undecodable frames or text blocks\n", in.badBlocks, in.badFrames);
+    fprintf(stderr, "load %.3f s, replay %.3f s (%.0fx real time)\n", loadS, calcS,
+            calcS > 0 ? spanS / calcS : 0.0);
+
+    // the breaths the device sent or recorded, matched by their end time
+    if (!in.recorded.empty()) {
+        size_t matched = 0;
+        float maxVE = 0, maxVO2 = 0;
+        size_t j = 0;
+        for (const BreathRecord &rec : in.recorded) {
+            while (j < breaths.size() && breaths[j].timeUs + REPLAY_MATCH_US < rec.timeUs)
+                j++;
+            if (j < breaths.size() && breaths[j].timeUs <= rec.timeUs + REPLAY_MATCH_US) {
+                matched++;
+                maxVE = std::max(maxVE, fabsf(breaths[j].VE - rec.VE));
+                maxVO2 = std::max(maxVO2, fabsf(breaths[j].vo2Total - rec.vo2Total));
+            }
+        }
+        fprintf(stderr, "recorded breaths: %zu, matched %zu, max |dVE| %.3f L/min, max |dVO2| %.2f ml/min\n",
+                in.recorded.size(), matched, maxVE, maxVO2);
+    }
+    return 0;
+}
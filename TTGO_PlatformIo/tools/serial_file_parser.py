@@ -4,14 +4,39 @@
 Usage examples:
   python scripts/serial_file_parser.py --file data.txt
   python scripts/serial_file_parser.py --port COM6 --baud 115200
+  python scripts/serial_file_parser.py --port COM6 --binary
+  python scripts/serial_file_parser.py --port COM6 --baud 921600 --capture run.bin
+  python scripts/serial_file_parser.py --file run.bin --binary --samples-csv run.csv
+  python scripts/serial_file_parser.py --file s0001.vo2 --session
+  python scripts/serial_file_parser.py --file s0001.vo2 --session -q --parquet captures
 
 The parser will try to parse each line as JSON; if that fails it returns the raw string.
+
+With --binary the input is the firmware's default binary telemetry: COBS encoded
+frames delimited by 0x00, each carrying [version][type][payload][crc16].
+Frames are decoded into the same dicts the JSON debug mode prints, so the
+other tools work with either format. See lib/Telemetry/src/vo2_telemetry.h.
+
+--capture stores the untouched serial bytes so a session recorded with the
+raw stream firmware (lilygo-vo2mini-raw) can be replayed later; --samples-csv
+expands its delta encoded pressure batches and gas samples into one CSV row
+per sample.
+
+--session reads a session file recorded on the device (/sNNNN.vo2 on its
+LittleFS partition): a header record with the calibration, then the breaths.
+
+--parquet DIR adds the breaths and raw samples to a columnar dataset with one
+directory per session (DIR/breaths/session=NAME/, DIR/samples/session=NAME/),
+typed and zstd compressed, for visualize_output.py and pandas.read_parquet()
+to load without parsing any JSON. Needs pyarrow.
 """
 from __future__ import annotations
 
 import argparse
+import csv
 import json
 import os
+import struct
 import sys
 import time
 from typing import Iterator, Union
@@ -21,6 +46,12 @@ try:
 except Exception:  # pragma: no cover - optional dependency
     serial = None
 
+try:
+    import pyarrow as pa
+    import pyarrow.parquet as pq
+except Exception:  # pragma: no cover - optional dependency
+    pa = pq = None
+
 
 def is_debug_line(line: str) -> bool:
     """Check if line is an ESP-IDF debug/log line.
@@ -45,6 +76,498 @@ def parse_line(line: str) -> Union[dict, str, None]:
         return s
 
 
+# --- binary telemetry frames ---------------------------------------------
+
+TELEMETRY_VERSION = 1
+
+TELEMETRY_BREATH_V0 = 0x01  # before the single breath record, old captures only
+TELEMETRY_RAW_SAMPLE = 0x02
+TELEMETRY_EVENT = 0x03
+TELEMETRY_STREAM_INFO = 0x04
+TELEMETRY_PRESSURE_BATCH = 0x05
+TELEMETRY_GAS_SAMPLE = 0x06
+TELEMETRY_BREATH = 0x07
+TELEMETRY_REPLY = 0x08
+TELEMETRY_FILE_INFO = 0x09
+TELEMETRY_FILE_CHUNK = 0x0A
+TELEMETRY_SAMPLE_TIMING = 0x0B
+
+REPLY_STATUS = {0: "ok", 1: "error", 2: "unknown", 3: "busy"}
+FILE_FLAG_RECORDING = 0x01
+
+BREATH_SCHEMA = 1
+BREATH_FLAGS = {0x01: "demo", 0x02: "dropped"}
+# breath record fields in payload order, after the header fields
+BREATH_VALUES = ["volumeExp", "VE", "VEmean", "freqVE", "freqVEmean",
+                 "vo2Total", "vo2Rel", "deltaO2_frac", "vo2TotalIn", "vo2TotalOut",
+                 "vco2Total", "vco2Rel", "respq"]
+# column names the visualisation tools always used ("volume.VE", ...)
+BREATH_GROUPS = {"volume": BREATH_VALUES[0:5], "vo2": BREATH_VALUES[5:10], "vco2": BREATH_VALUES[10:13]}
+
+PRESSURE_CODE_ZERO = 1024  # Pa = (code - 1024) * scale - offset
+
+EVENT_NAMES = {1: "INSPIRATION", 2: "EXPIRATION DONE"}
+
+# session files, see src/vo2_session_recorder.h
+SESSION_MAGIC = b"VO2S"
+SESSION_FORMAT = 1
+SESSION_BLOCK_INFO = 0x00
+SESSION_BLOCK_BREATHS = 0x01
+SESSION_BLOCK_PRESSURE = 0x02
+SESSION_BLOCK_GAS = 0x03
+SESSION_TICK_US = 100
+
+
+def crc16_ccitt(data: bytes, crc: int = 0xFFFF) -> int:
+    """CRC-16/CCITT-FALSE as computed by telemetryCrc16() in the firmware."""
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+    return crc
+
+
+def cobs_decode(data: bytes) -> bytes | None:
+    """Decode one COBS block (without delimiters). Returns None if malformed."""
+    out = bytearray()
+    i = 0
+    n = len(data)
+    while i < n:
+        code = data[i]
+        if code == 0 or i + code > n:
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < n:
+            out.append(0)
+    return bytes(out)
+
+
+def read_uvarint(data: bytes, pos: int) -> tuple[int, int]:
+    """LEB128 unsigned varint as written by putUVarint(). Returns (value, next pos)."""
+    value = shift = 0
+    while True:
+        if pos >= len(data) or shift > 28:
+            raise ValueError("truncated varint")
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return value, pos
+        shift += 7
+
+
+def read_svarint(data: bytes, pos: int) -> tuple[int, int]:
+    """Zigzag signed varint as written by putSVarint()."""
+    v, pos = read_uvarint(data, pos)
+    return (v >> 1) ^ -(v & 1), pos
+
+
+def decode_pressure_batch(payload: bytes) -> dict | None:
+    """Expand a delta encoded pressure batch into absolute timestamps and codes."""
+    if len(payload) < 7:
+        return None
+    t, code, count = struct.unpack_from("<IHB", payload)
+    times, codes = [t], [code]
+    pos = 7
+    try:
+        for _ in range(count - 1):
+            dt, pos = read_uvarint(payload, pos)
+            dc, pos = read_svarint(payload, pos)
+            t = (t + dt) & 0xFFFFFFFF
+            code = (code + dc) & 0xFFFF
+            times.append(t)
+            codes.append(code)
+    except ValueError:
+        return None
+    if pos != len(payload):
+        return None
+    return {"pressure_batch": {"t_us": times, "code": codes}}
+
+
+def format_ms(ms: int) -> str:
+    """Format milliseconds as HH:MM:SS like ConvertTime() on the device."""
+    s = ms // 1000
+    return f"{(s // 3600) % 24:02d}:{(s // 60) % 60:02d}:{s % 60:02d}"
+
+
+def _r(v: float) -> float:
+    return round(v, 4)
+
+
+def decode_breath_payload(payload: bytes) -> dict | None:
+    """Decode a TELEMETRY_BREATH payload (also the records of a session file)."""
+    if len(payload) != 74 or payload[0] != BREATH_SCHEMA:
+        return None
+    schema, seq, t_us, insp, exp, flags, *values = struct.unpack("<BIQIIB13f", payload)
+    breath = {"schema": schema, "seq": seq, "t_us": t_us,
+              "insp_ms": insp, "exp_ms": exp, "flags": flags}
+    breath.update({k: _r(v) for k, v in zip(BREATH_VALUES, values)})
+    return {"breath": breath}
+
+
+def decode_frame(block: bytes) -> dict | None:
+    """Decode one COBS block into a record dict, or None if it is not a valid frame."""
+    raw = cobs_decode(block)
+    if raw is None or len(raw) < 4:
+        return None
+    body, crc = raw[:-2], raw[-2] | (raw[-1] << 8)
+    if crc16_ccitt(body) != crc:
+        return None
+    version, rtype, payload = body[0], body[1], body[2:]
+    if version != TELEMETRY_VERSION:
+        return None
+
+    if rtype == TELEMETRY_BREATH:
+        rec = decode_breath_payload(payload)
+        if rec is not None:
+            return rec
+    if rtype == TELEMETRY_BREATH_V0 and len(payload) == 56:
+        v = struct.unpack("<I13f", payload)
+        return {
+            "time": format_ms(v[0]),
+            "volume": {"volumeExp": _r(v[1]), "VE": _r(v[2]), "VEmean": _r(v[3]),
+                       "freqVE": _r(v[4]), "freqVEmean": _r(v[5])},
+            "vo2": {"vo2Total": _r(v[6]), "vo2Rel": _r(v[7]), "deltaO2_frac": _r(v[8]),
+                    "vo2TotalIn": _r(v[9]), "vo2TotalOut": _r(v[10])},
+            "vco2": {"vco2Total": _r(v[11]), "vco2Rel": _r(v[12]), "respq": _r(v[13])},
+        }
+    if rtype == TELEMETRY_RAW_SAMPLE and len(payload) == 16:
+        t, pressure, o2, co2 = struct.unpack("<I3f", payload)
+        return {"sample": {"time_ms": t, "pressure": _r(pressure), "o2": _r(o2), "co2ppm": _r(co2)}}
+    if rtype == TELEMETRY_EVENT and len(payload) == 9:
+        event, t, duration = struct.unpack("<BII", payload)
+        return {"event": EVENT_NAMES.get(event, str(event)), "time": format_ms(t), "duration": format_ms(duration)}
+    if rtype == TELEMETRY_STREAM_INFO and len(payload) == 9:
+        model, scale, offset = struct.unpack("<Bff", payload)
+        return {"stream_info": {"sensor_model": model, "scale": scale, "offset": pressure_offset}}
+    if rtype == TELEMETRY_PRESSURE_BATCH:
+        rec = decode_pressure_batch(payload)
+        if rec is not None:
+            return rec
+    if rtype == TELEMETRY_GAS_SAMPLE and len(payload) == 12:
+        t, o2, co2 = struct.unpack("<I2f", payload)
+        return {"gas_sample": {"t_us": t, "o2": _r(o2), "co2ppm": _r(co2)}}
+    if rtype == TELEMETRY_SAMPLE_TIMING and len(payload) == 40:
+        t, count, mean, std, p50, p99, mx, gaps, total, gap_us = struct.unpack("<II2f6I", payload)
+        return {"sample_timing": {"time_ms": t, "count": count, "mean_us": _r(mean), "std_us": _r(std),
+                                  "p50_us": p50, "p99_us": p99, "max_us": mx, "gaps": gaps,
+                                  "total_gaps": total, "gap_us": gap_us}}
+    if rtype == TELEMETRY_REPLY and len(payload) >= 1:
+        status = REPLY_STATUS.get(payload[0], str(payload[0]))
+        return {"reply": {"status": status, "text": payload[1:].decode("utf-8", errors="replace")}}
+    if rtype == TELEMETRY_FILE_INFO and len(payload) >= 5:
+        size, flags = struct.unpack_from("<IB", payload)
+        return {"file_info": {"size": size, "flags": flags, "name": payload[5:].decode("utf-8", errors="replace")}}
+    if rtype == TELEMETRY_FILE_CHUNK and len(payload) >= 4:
+        (offset,) = struct.unpack_from("<I", payload)
+        return {"file_chunk": {"offset": offset, "data": payload[4:]}}
+    # valid frame of a type (or size) this decoder does not know
+    return {"unknown_frame": {"type": rtype, "length": len(payload)}}
+
+
+def flatten_breath(record: dict) -> dict | None:
+    """Map a {"breath": {...}} record to one flat row with the usual column names.
+
+    Works for the JSON line and the decoded binary frame alike, no state needed.
+    """
+    breath = record.get("breath") if isinstance(record, dict) else None
+    if not isinstance(breath, dict):
+        return None
+    row = {k: breath.get(k) for k in ("seq", "t_us", "insp_ms", "exp_ms", "flags")}
+    row["time"] = format_ms(int(breath.get("t_us", 0)) // 1000)
+    row["event"] = "EXPIRATION DONE"
+    for group, keys in BREATH_GROUPS.items():
+        for k in keys:
+            if k in breath:
+                row[f"{group}.{k}"] = breath[k]
+    return row
+
+
+def parse_block(block: bytes, encoding: str = "utf-8") -> Iterator[Union[dict, str, None]]:
+    """Decode a delimited block; text that is not a frame (ESP log output) is parsed line by line."""
+    if not block:
+        return
+    rec = decode_frame(block)
+    if rec is not None:
+        yield rec
+        return
+    for line in block.decode(encoding, errors="ignore").splitlines():
+        yield parse_line(line)
+
+
+def split_blocks(chunks: Iterator[bytes]) -> Iterator[bytes]:
+    """Split a byte stream on 0x00 delimiters."""
+    buf = bytearray()
+    for chunk in chunks:
+        buf += chunk
+        while True:
+            idx = buf.find(b"\x00")
+            if idx < 0:
+                break
+            yield bytes(buf[:idx])
+            del buf[:idx + 1]
+    if buf:
+        yield bytes(buf)
+
+
+def read_binary_from_file(path: str, encoding: str = "utf-8") -> Iterator[Union[dict, str]]:
+    def chunks():
+        with open(path, "rb") as fh:
+            while True:
+                data = fh.read(65536)
+                if not data:
+                    return
+                yield data
+
+    for block in split_blocks(chunks()):
+        yield from parse_block(block, encoding)
+
+
+def read_binary_from_serial(port: str, baud: int = 115200, encoding: str = "utf-8",
+                            capture: str | None = None) -> Iterator[Union[dict, str]]:
+    if serial is None:
+        raise RuntimeError("pyserial is required to read from serial ports. Install with: pip install pyserial")
+    with serial.Serial(port, baudrate=baud, timeout=0.1) as ser:
+        time.sleep(0.1)
+        try:
+            ser.reset_input_buffer()
+        except Exception:
+            pass
+
+        capture_fh = open(capture, "wb") if capture else None
+
+        def chunks():
+            while True:
+                data = ser.read(max(1, ser.in_waiting))
+                if data:
+                    if capture_fh:
+                        capture_fh.write(data)
+                    yield data
+
+        try:
+            for block in split_blocks(chunks()):
+                yield from parse_block(block, encoding)
+        finally:
+            if capture_fh:
+                capture_fh.close()
+
+
+class RawStreamReplay:
+    """Turns raw stream records into one row per sample.
+
+    Pressure codes are converted with the most recent stream_info; micros()
+    timestamps are unwrapped so they stay monotonic past 71 minutes.
+    """
+
+    FIELDS = ["t_us", "code", "pa", "o2", "co2ppm"]
+
+    def __init__(self) -> None:
+        self.info: dict | None = None
+        self._last_us: int | None = None
+
+    def _unwrap(self, t: int) -> int:
+        # batches arrive after gas samples taken in between, so go by the
+        # nearest 64-bit time rather than only counting forward wraps
+        if self._last_us is None:
+            self._last_us = t
+            return t
+        delta = (t - self._last_us) & 0xFFFFFFFF
+        if delta >= 0x80000000:
+            delta -= 1 << 32
+        self._last_us += delta
+        return self._last_us
+
+    def rows(self, record: Union[dict, str, None]) -> Iterator[dict]:
+        if not isinstance(record, dict):
+            return
+        if "stream_info" in record:
+            self.info = record["stream_info"]
+        elif "pressure_batch" in record:
+            batch = record["pressure_batch"]
+            for t, code in zip(batch["t_us"], batch["code"]):
+                pa = None
+                if self.info is not None:
+                    pa = _r((code - PRESSURE_CODE_ZERO) * self.info["scale"] - self.info["offset"])
+                yield {"t_us": self._unwrap(t), "code": code, "pa": pa}
+        elif "gas_sample" in record:
+            gas = record["gas_sample"]
+            yield {"t_us": self._unwrap(gas["t_us"]), "o2": gas["o2"], "co2ppm": gas["co2ppm"]}
+
+
+PARQUET_ROW_GROUP = 65536  # rows buffered per table before they are written
+
+
+def _parquet_schemas() -> dict:
+    breath_fields = [("seq", pa.uint32()), ("t_us", pa.uint64()), ("insp_ms", pa.uint32()),
+                     ("exp_ms", pa.uint32()), ("flags", pa.uint8())]
+    breath_fields += [(f"{group}.{k}", pa.float32()) for group, keys in BREATH_GROUPS.items() for k in keys]
+    sample_fields = [("t_us", pa.int64()), ("code", pa.uint16()), ("pa", pa.float32()),
+                     ("o2", pa.float32()), ("co2ppm", pa.float32())]
+    return {"breaths": pa.schema(breath_fields), "samples": pa.schema(sample_fields)}
+
+
+class ParquetExport:
+    """Writes breath and raw sample records of one session to a Parquet dataset.
+
+    Each table goes to ROOT/<table>/session=NAME/part-0.parquet, so a whole
+    directory of sessions loads as one frame with a session column. Rows are
+    buffered per column and written a row group at a time; exporting a
+    session again replaces its files.
+    """
+
+    def __init__(self, root: str, session: str) -> None:
+        if pa is None:
+            raise RuntimeError("pyarrow is required for --parquet. Install with: pip install pyarrow")
+        self.root = root
+        self.session = session
+        self.schemas = _parquet_schemas()
+        self.columns = {table: {name: [] for name in schema.names} for table, schema in self.schemas.items()}
+        self.writers: dict = {}
+        self.replay = RawStreamReplay()
+        self.rows = {table: 0 for table in self.schemas}
+
+    def add(self, record: Union[dict, str, None]) -> None:
+        row = flatten_breath(record)
+        if row is not None:
+            self._append("breaths", row)
+        for sample in self.replay.rows(record):
+            self._append("samples", sample)
+
+    def _append(self, table: str, row: dict) -> None:
+        cols = self.columns[table]
+        for name, values in cols.items():
+            values.append(row.get(name))
+        self.rows[table] += 1
+        if len(cols["t_us"]) >= PARQUET_ROW_GROUP:
+            self._flush(table)
+
+    def _flush(self, table: str) -> None:
+        cols = self.columns[table]
+        if not cols["t_us"]:
+            return
+        batch = pa.Table.from_pydict(cols, schema=self.schemas[table])
+        writer = self.writers.get(table)
+        if writer is None:
+            path = os.path.join(self.root, table, f"session={self.session}")
+            os.makedirs(path, exist_ok=True)
+            # timestamps and sequence numbers only grow, delta encoding stores them in a few bits each
+            deltas = [name for name in ("t_us", "seq") if name in self.schemas[table].names]
+            writer = pq.ParquetWriter(os.path.join(path, "part-0.parquet"), self.schemas[table],
+                                      compression="zstd", compression_level=9, use_dictionary=[n for n in self.schemas[table].names
+                                                                          if n not in deltas],
+                                      column_encoding={n: "DELTA_BINARY_PACKED" for n in deltas})
+            self.writers[table] = writer
+        writer.write_table(batch)
+        for values in cols.values():
+            values.clear()
+
+    def close(self) -> None:
+        for table in self.schemas:
+            self._flush(table)
+        for writer in self.writers.values():
+            writer.close()
+        self.writers.clear()
+
+
+def read_parquet_dataset(root: str, table: str = "breaths", sessions: list[str] | None = None,
+                         columns: list[str] | None = None):
+    """Load one table of a --parquet dataset as a pandas DataFrame with a session column."""
+    if pq is None:
+        raise RuntimeError("pyarrow is required to read Parquet. Install with: pip install pyarrow")
+    filters = [("session", "in", sessions)] if sessions else None
+    dataset = pq.read_table(os.path.join(root, table), columns=columns, filters=filters,
+                            partitioning="hive")
+    return dataset.to_pandas()
+
+
+def decode_session_pressure(block: bytes) -> dict:
+    """Expand a raw pressure block: keyframe, then second order time and first order code deltas."""
+    count, tick, code = struct.unpack_from("<HIH", block, 8)
+    times, codes = [tick * SESSION_TICK_US], [code]
+    pos, dt = 16, 0
+    for _ in range(count - 1):
+        b = block[pos]
+        pos += 1
+        hi, lo = b >> 4, b & 0x0F
+        if hi == 0x0F:  # escape, the deltas follow as varints
+            ddt, pos = read_svarint(block, pos)
+            dc, pos = read_svarint(block, pos)
+        else:  # two zigzag nibbles
+            ddt, dc = (hi >> 1) ^ -(hi & 1), (lo >> 1) ^ -(lo & 1)
+        dt += ddt
+        tick += dt
+        code += dc
+        times.append(tick * SESSION_TICK_US)
+        codes.append(code)
+    return {"pressure_batch": {"t_us": times, "code": codes}}
+
+
+def decode_session_gas(block: bytes) -> Iterator[dict]:
+    """Expand a raw O2 / CO2 block into gas_sample records."""
+    count, tick, o2, co2 = struct.unpack_from("<HIHH", block, 8)
+    pos = 18
+    for i in range(count):
+        if i:
+            dt, pos = read_uvarint(block, pos)
+            do2, pos = read_svarint(block, pos)
+            dco2, pos = read_svarint(block, pos)
+            tick, o2, co2 = tick + dt, o2 + do2, co2 + dco2
+        yield {"gas_sample": {"t_us": tick * SESSION_TICK_US, "o2": o2 / 1000, "co2ppm": co2}}
+
+
+def read_session_file(path: str) -> Iterator[dict]:
+    """Yield the records of a session file recorded on the device.
+
+    The header block gives a {"session": ...} record with the calibration and
+    a stream_info record, then come the breaths and, in RAW_LOG recordings,
+    pressure_batch and gas_sample records like the raw serial stream.
+    Blocks with a bad CRC (e.g. the one being written at a power loss) are
+    reported as {"bad_block": {...}} and skipped.
+    """
+    with open(path, "rb") as fh:
+        first = fh.read(8)
+        if len(first) < 8 or first[:4] != SESSION_MAGIC:
+            raise ValueError(f"{path} is not a session file")
+        fh.seek(0)
+        header = fh.read(64)
+        block_size = struct.unpack_from("<H", header, 9)[0]
+        fh.seek(0)
+        offset = 0
+        while True:
+            block = fh.read(block_size)
+            if len(block) < block_size:
+                if block:
+                    yield {"bad_block": {"offset": offset, "reason": "truncated"}}
+                return
+            body, crc = block[:-2], struct.unpack("<H", block[-2:])[0]
+            if block[:4] != SESSION_MAGIC or block[4] != SESSION_FORMAT or crc16_ccitt(body) != crc:
+                yield {"bad_block": {"offset": offset, "reason": "crc"}}
+            elif block[5] == SESSION_BLOCK_INFO:
+                schema, size, record_size, firmware, start_us, corr, weight, o2, co2, model, scale, \
+                    pressure_offset = struct.unpack_from("<BHB24sQ4fBff", block, 8)
+                yield {"session": {"schema": schema, "block_size": size, "record_size": record_size,
+                                   "firmware": firmware.split(b"\0")[0].decode("ascii", errors="replace"),
+                                   "start_us": start_us, "correctionSensor": _r(corr), "weightkg": _r(weight),
+                                   "initialO2": _r(o2), "initialCO2": _r(co2)}}
+                yield {"stream_info": {"sensor_model": model, "scale": scale, "offset": pressure_offset}}
+            elif block[5] == SESSION_BLOCK_BREATHS:
+                count = block[8]
+                for i in range(count):
+                    start = 9 + i * 74
+                    rec = decode_breath_payload(block[start:start + 74])
+                    if rec is not None:
+                        yield rec
+            elif block[5] == SESSION_BLOCK_PRESSURE:
+                yield decode_session_pressure(block)
+            elif block[5] == SESSION_BLOCK_GAS:
+                yield from decode_session_gas(block)
+            offset += block_size
+
+
 def read_from_file(path: str, encoding: str = "utf-8") -> Iterator[Union[dict, str]]:
     with open(path, "r", encoding=encoding, errors="ignore") as fh:
         for line in fh:
@@ -72,13 +595,20 @@ def read_from_serial(port: str, baud: int = 115200, encoding: str = "utf-8") ->
             yield parse_line(line)
 
 
+def _json_default(value):
+    # file chunk data in a capture
+    if isinstance(value, (bytes, bytearray)):
+        return value.hex()
+    raise TypeError(f"{type(value).__name__} is not JSON serializable")
+
+
 def print_record(record: Union[dict, str, None], out_fh = None) -> None:
     if record is None:
         return
     if isinstance(record, dict):
-        print(json.dumps(record, ensure_ascii=False))
+        print(json.dumps(record, ensure_ascii=False, default=_json_default))
         if out_fh:
-            out_fh.write(json.dumps(record, ensure_ascii=False) + "\n")
+            out_fh.write(json.dumps(record, ensure_ascii=False, default=_json_default) + "\n")
     else:
         print(json.dumps({"raw": record}, ensure_ascii=False))
         if out_fh:
@@ -93,30 +623,66 @@ def main(argv: list[str] | None = None) -> int:
     parser.add_argument("--baud", "-b", type=int, default=115200, help="Baud rate for serial")
     parser.add_argument("--encoding", "-e", default="utf-8", help="Text encoding to use")
     parser.add_argument("--raw", action="store_true", help="Print raw lines instead of parsed JSON/object output")
+    parser.add_argument("--binary", action="store_true", help="Input is binary telemetry frames (firmware default) instead of JSON lines")
+    parser.add_argument("--session", action="store_true", help="With --file: the file is a session recorded on the device")
+    parser.add_argument("--capture", help="With --port: also save the received bytes to this file for later replay (implies --binary)")
+    parser.add_argument("--samples-csv", help="Write raw stream pressure / gas samples to this CSV file")
+    parser.add_argument("--parquet", help="Add the breaths and raw samples to the Parquet dataset in this directory")
+    parser.add_argument("--parquet-session", help="Session name in the Parquet dataset (default: input file name, or the start time)")
+    parser.add_argument("--quiet", "-q", action="store_true", help="Do not print records to stdout")
     parser.add_argument("--limit", "-n", type=int, default=0, help="Limit number of lines to read (0 = unlimited)")
 
     args = parser.parse_args(argv)
 
+    parquet = None
     try:
         out_fh = None
         if args.file:
             if not os.path.exists(args.file):
                 print(f"File not found: {args.file}", file=sys.stderr)
                 return 2
-            source = read_from_file(args.file, encoding=args.encoding)
+            if args.session:
+                source = read_session_file(args.file)
+            elif args.binary:
+                source = read_binary_from_file(args.file, encoding=args.encoding)
+            else:
+                source = read_from_file(args.file, encoding=args.encoding)
+        elif args.binary or args.capture:
+            source = read_binary_from_serial(args.port, baud=args.baud, encoding=args.encoding,
+                                             capture=args.capture)
         else:
             source = read_from_serial(args.port, baud=args.baud, encoding=args.encoding)
 
         if args.out_file:
             out_fh = open(args.out_file, "w", encoding=args.encoding, errors="ignore")
 
+        if args.parquet:
+            name = args.parquet_session
+            if not name:
+                name = os.path.splitext(os.path.basename(args.file))[0] if args.file else time.strftime("%Y%m%d-%H%M%S")
+            parquet = ParquetExport(args.parquet, name)
+
+        samples = None
+        replay = RawStreamReplay()
+        if args.samples_csv:
+            samples_fh = open(args.samples_csv, "w", newline="")
+            samples = csv.DictWriter(samples_fh, fieldnames=RawStreamReplay.FIELDS)
+            samples.writeheader()
+
         count = 0
         for record in source:
             # Skip None records (debug lines, empty lines)
             if record is None:
                 continue
             count += 1
-            print_record(record, out_fh=out_fh)
+            if samples:
+                samples.writerows(replay.rows(record))
+            if parquet:
+                parquet.add(record)
+            if not args.quiet:
+                print_record(record, out_fh=out_fh)
+            elif out_fh:
+                out_fh.write(json.dumps(record if isinstance(record, dict) else {"raw": record}, ensure_ascii=False) + "\n")
             if args.limit and count >= args.limit:
                 break
 
@@ -125,6 +691,10 @@ def main(argv: list[str] | None = None) -> int:
     except Exception as exc:
         print(f"Error: {exc}", file=sys.stderr)
         return 1
+    finally:
+        # also on Ctrl+C, the footer makes the files readable
+        if parquet:
+            parquet.close()
 
     return 0
 
@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+"""List, download and delete the session files recorded on the device.
+
+Usage examples:
+  python scripts/session_download.py --port COM6 list
+  python scripts/session_download.py --port COM6 --fast get s0003.vo2
+  python scripts/session_download.py --port COM6 rm s0001.vo2
+
+Talks to src/vo2_session_transfer.h over the wired serial port: text
+commands go out, TELEMETRY_REPLY / FILE_INFO / FILE_CHUNK frames come back
+between the normal telemetry. Every chunk carries its file offset and is
+covered by the frame CRC, so a lost or damaged chunk only means asking
+again from the first missing offset. A download is written to NAME.part
+first and picks up where that file ends when it is started again.
+
+--fast asks the device for the highest baud rate that gets a ping through
+and goes back to the default rate otherwise.
+"""
+from __future__ import annotations
+
+import argparse
+import os
+import sys
+import time
+
+from serial_file_parser import FILE_FLAG_RECORDING, decode_frame
+
+try:
+    import serial
+except Exception:
+    serial = None
+
+FAST_BAUDS = [2000000, 1500000, 921600]
+WINDOW = 65536        # bytes per get command
+REPLY_TIMEOUT = 2.0   # s without any frame of the transfer
+BAUD_CHECK = 1.5      # s the device waits for a command at the new rate
+
+
+class TransferError(RuntimeError):
+    pass
+
+
+class Device:
+    """Command / frame exchange on an open serial port."""
+
+    def __init__(self, port) -> None:
+        self.port = port
+        self._buf = bytearray()
+
+    def command(self, line: str) -> None:
+        self.port.write((line + "\n").encode("ascii"))
+        self.port.flush()
+
+    def frames(self, timeout: float):
+        """Yield decoded frames until timeout s pass without one; other output is skipped."""
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            data = self.port.read(max(1, self.port.in_waiting))
+            if not data:
+                continue
+            self._buf += data
+            while True:
+                idx = self._buf.find(b"\x00")
+                if idx < 0:
+                    break
+                block = bytes(self._buf[:idx])
+                del self._buf[:idx + 1]
+                rec = decode_frame(block) if block else None
+                if rec is not None:
+                    deadline = time.monotonic() + timeout
+                    yield rec
+
+    def drain(self) -> None:
+        self._buf.clear()
+        try:
+            self.port.reset_input_buffer()
+        except Exception:
+            pass
+
+    def ask(self, line: str, timeout: float = REPLY_TIMEOUT) -> dict:
+        """Send a command and return its reply, ignoring other frames."""
+        self.command(line)
+        for rec in self.frames(timeout):
+            if "reply" in rec:
+                return rec["reply"]
+        raise TransferError(f"no reply to {line!r}")
+
+
+def set_fast_baud(dev: Device, default: int, bauds: list[int]) -> int:
+    """Switch to the first rate in bauds that works, returns the rate in use."""
+    for baud in bauds:
+        if baud == default:
+            return default
+        reply = dev.ask(f"baud {baud}")
+        if reply["status"] != "ok":
+            continue
+        time.sleep(0.05)  # the device flushes and reconfigures its UART
+        dev.port.baudrate = baud
+        dev.drain()
+        try:
+            if dev.ask("ping", timeout=0.5)["status"] == "ok":
+                return baud
+        except TransferError:
+            pass
+        # the device falls back on its own when the ping didn't arrive
+        dev.port.baudrate = default
+        time.sleep(BAUD_CHECK + 0.2)
+        dev.drain()
+    return default
+
+
+def list_files(dev: Device) -> list[dict]:
+    dev.command("ls")
+    files = []
+    for rec in dev.frames(REPLY_TIMEOUT):
+        if "file_info" in rec:
+            files.append(rec["file_info"])
+        elif "reply" in rec:
+            if rec["reply"]["status"] != "ok":
+                raise TransferError(rec["reply"]["text"])
+            print(rec["reply"]["text"], file=sys.stderr)
+            return files
+    raise TransferError("no reply to ls")
+
+
+def get_file(dev: Device, name: str, path: str) -> tuple[int, int]:
+    """Download name to path, resuming from path.part. Returns (file size, bytes transferred)."""
+    part = path + ".part"
+    offset = os.path.getsize(part) if os.path.exists(part) else 0
+    transferred = 0
+    with open(part, "ab") as fh:
+        while True:
+            dev.command(f"get {name} {offset} {WINDOW}")
+            done = None
+            for rec in dev.frames(REPLY_TIMEOUT):
+                chunk = rec.get("file_chunk")
+                if chunk is not None:
+                    # anything after a gap is dropped and asked for again
+                    if chunk["offset"] == offset:
+                        fh.write(chunk["data"])
+                        offset += len(chunk["data"])
+                        transferred += len(chunk["data"])
+                    continue
+                reply = rec.get("reply")
+                if reply is None:
+                    continue
+                if reply["status"] != "ok":
+                    raise TransferError(reply["text"])
+                word, _, value = reply["text"].partition(" ")
+                if word == "eof" and offset >= int(value):
+                    done = int(value)
+                break
+            if done is not None:
+                break
+            # reply lost, a gap or more to come: carry on from offset
+    os.replace(part, path)
+    return done, transferred
+
+
+def main(argv: list[str] | None = None) -> int:
+    parser = argparse.ArgumentParser(description="Download session files from the device over serial")
+    parser.add_argument("--port", "-p", required=True, help="Serial port (e.g. COM6 or /dev/ttyUSB0)")
+    parser.add_argument("--baud", "-b", type=int, default=115200, help="Baud rate of the firmware (default 115200)")
+    parser.add_argument("--fast", action="store_true", help="Switch to the fastest working baud rate first")
+    sub = parser.add_subparsers(dest="cmd", required=True)
+    sub.add_parser("list", help="List the files on the device")
+    get = sub.add_parser("get", help="Download a file (resumes NAME.part)")
+    get.add_argument("name")
+    get.add_argument("--out", "-o", help="Output path (default: the file name)")
+    rm = sub.add_parser("rm", help="Delete a file")
+    rm.add_argument("name")
+    args = parser.parse_args(argv)
+
+    if serial is None:
+        print("pyserial is required. Install with: pip install pyserial", file=sys.stderr)
+        return 2
+
+    with serial.Serial(args.port, baudrate=args.baud, timeout=0.05) as port:
+        dev = Device(port)
+        time.sleep(0.1)
+        dev.drain()
+        baud = args.baud
+        try:
+            if args.fast:
+                baud = set_fast_baud(dev, args.baud, FAST_BAUDS)
+                print(f"baud {baud}", file=sys.stderr)
+            if args.cmd == "list":
+                for info in list_files(dev):
+                    mark = " (recording)" if info["flags"] & FILE_FLAG_RECORDING else ""
+                    print(f"{info['name']:<20} {info['size']:>10}{mark}")
+            elif args.cmd == "get":
+                name = args.name.lstrip("/")
+                start = time.monotonic()
+                size, transferred = get_file(dev, name, args.out or name)
+                elapsed = max(time.monotonic() - start, 1e-6)
+                print(f"{name}: {size} bytes, {transferred} transferred in {elapsed:.1f} s, "
+                      f"{transferred / elapsed / 1e6:.3f} MB/s at {baud} baud", file=sys.stderr)
+            elif args.cmd == "rm":
+                reply = dev.ask(f"rm {args.name.lstrip('/')}")
+                if reply["status"] != "ok":
+                    raise TransferError(reply["text"])
+                print(reply["text"], file=sys.stderr)
+        except TransferError as exc:
+            print(f"error: {exc}", file=sys.stderr)
+            return 1
+        finally:
+            if baud != args.baud:
+                # back to the rate the other tools expect
+                try:
+                    dev.ask(f"baud {args.baud}")
+                except TransferError:
+                    pass
+                port.baudrate = args.baud
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""capture_service.py against fake devices on pseudo terminals (Linux, no hardware).
+
+  python -m unittest tools/test_capture_service.py   (from the project root)
+  python tools/test_capture_service.py
+"""
+from __future__ import annotations
+
+import asyncio
+import json
+import os
+import shutil
+import struct
+import sys
+import tempfile
+import threading
+import time
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import capture_service
+from serial_file_parser import TELEMETRY_BREATH, TELEMETRY_VERSION, crc16_ccitt
+
+try:
+    import pty
+    import tty
+except ImportError:  # Windows
+    pty = None
+
+
+def cobs_encode(data: bytes) -> bytes:
+    out = bytearray()
+    block = bytearray()
+    for b in data:
+        if b == 0:
+            out += bytes([len(block) + 1]) + block
+            block.clear()
+            continue
+        block.append(b)
+        if len(block) == 254:
+            out += b"\xff" + block
+            block.clear()
+    out += bytes([len(block) + 1]) + block
+    return bytes(out)
+
+
+def breath_frame(seq: int, t_us: int) -> bytes:
+    payload = struct.pack("<BIQIIB13f", 1, seq, t_us, 1000, 1500, 0, *([1.5] * 13))
+    body = bytes([TELEMETRY_VERSION, TELEMETRY_BREATH]) + payload
+    crc = crc16_ccitt(body)
+    return cobs_encode(body + bytes([crc & 0xFF, crc >> 8])) + b"\x00"
+
+
+class FakeDevice(threading.Thread):
+    """Writes `messages` to the master side of a pty, split into odd sized pieces."""
+
+    def __init__(self, messages: list[bytes], interval: float) -> None:
+        super().__init__(daemon=True)
+        self.master, slave = pty.openpty()
+        tty.setraw(slave)
+        self.port = os.ttyname(slave)
+        self._slave = slave
+        self.messages = messages
+        self.interval = interval
+
+    def run(self) -> None:
+        for i, msg in enumerate(self.messages):
+            # records cut across reads must come out whole
+            cut = (i * 7) % len(msg)
+            os.write(self.master, msg[:cut])
+            time.sleep(self.interval / 2)
+            os.write(self.master, msg[cut:])
+            time.sleep(self.interval / 2)
+
+    def close(self) -> None:
+        os.close(self.master)
+        os.close(self._slave)
+
+
+@unittest.skipIf(pty is None or capture_service.serial is None, "needs pty and pyserial")
+class CaptureServiceTest(unittest.TestCase):
+    def capture(self, devices: dict[str, FakeDevice], binary: bool) -> str:
+        out_dir = tempfile.mkdtemp(prefix="capture_")
+        self.addCleanup(shutil.rmtree, out_dir, True)
+        for dev in devices.values():
+            dev.start()
+
+        async def run():
+            stop = asyncio.Event()
+            task = asyncio.create_task(capture_service.capture(
+                [f"{dev.port}={name}" for name, dev in devices.items()], out_dir, binary=binary, stop=stop))
+            while any(dev.is_alive() for dev in devices.values()):
+                await asyncio.sleep(0.05)
+            await asyncio.sleep(0.3)  # the last reads
+            stop.set()
+            return await task
+
+        captured = asyncio.run(run())
+        for dev in devices.values():
+            dev.close()
+        self.assertEqual(sorted(d.device for d in captured), sorted(devices))
+        return out_dir
+
+    def read(self, path: str) -> list[dict]:
+        with open(path, encoding="utf-8") as fh:
+            return [json.loads(line) for line in fh]
+
+    def test_json_lines_two_devices(self):
+        devices = {
+            "maskA": FakeDevice([json.dumps({"breath": {"seq": i, "t_us": i * 1000}}).encode() + b"\n"
+                                 for i in range(40)], 0.01),
+            "maskB": FakeDevice([b"[  4650][D][BLEDevice.cpp:579] getAdvertising(): log\n"] +
+                                [json.dumps({"event": "EXPIRATION DONE", "n": i}).encode() + b"\n"
+                                 for i in range(25)], 0.017),
+        }
+        out_dir = self.capture(devices, binary=False)
+
+        a = self.read(os.path.join(out_dir, "maskA.jsonl"))
+        b = self.read(os.path.join(out_dir, "maskB.jsonl"))
+        self.assertEqual([r["breath"]["seq"] for r in a], list(range(40)))
+        # text that isn't JSON is kept, like serial_file_parser.py prints it
+        self.assertEqual(b[0]["raw"], "[  4650][D][BLEDevice.cpp:579] getAdvertising(): log")
+        self.assertEqual([r["n"] for r in b[1:]], list(range(25)))
+        self.assertTrue(all(r["device"] == "maskA" for r in a))
+
+        merged = self.read(os.path.join(out_dir, "merged.jsonl"))
+        self.assertEqual(len(merged), 66)
+        times = [r["host_t"] for r in merged]
+        self.assertEqual(times, sorted(times))
+        # both devices were read at the same time, not one after the other
+        a_times = [r["host_t"] for r in merged if r["device"] == "maskA"]
+        b_times = [r["host_t"] for r in merged if r["device"] == "maskB"]
+        self.assertLess(max(a_times[0], b_times[0]), min(a_times[-1], b_times[-1]))
+
+    def test_binary_frames(self):
+        devices = {"mask": FakeDevice([breath_frame(i, i * 3000000) for i in range(30)], 0.005)}
+        out_dir = self.capture(devices, binary=True)
+        recs = self.read(os.path.join(out_dir, "mask.jsonl"))
+        self.assertEqual([r["breath"]["seq"] for r in recs], list(range(30)))
+        self.assertEqual(recs[-1]["breath"]["t_us"], 29 * 3000000)
+
+
+class CaptureArgumentsTest(unittest.TestCase):
+    def test_duplicate_ids_open_nothing(self):
+        out_dir = os.path.join(tempfile.mkdtemp(prefix="capture_"), "out")
+        self.addCleanup(shutil.rmtree, os.path.dirname(out_dir), True)
+        devices = []
+        with self.assertRaises(ValueError):
+            asyncio.run(capture_service.capture(["/dev/null=mask", "/dev/zero=mask"], out_dir, devices=devices))
+        self.assertEqual(devices, [])
+        self.assertFalse(os.path.exists(out_dir))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""read_session_file() of serial_file_parser.py on session files built here.
+
+  python -m unittest tools/test_serial_file_parser.py   (from the project root)
+  python tools/test_serial_file_parser.py
+"""
+from __future__ import annotations
+
+import os
+import struct
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from serial_file_parser import (SESSION_BLOCK_BREATHS, SESSION_BLOCK_GAS, SESSION_BLOCK_INFO, SESSION_FORMAT,
+                                SESSION_MAGIC, crc16_ccitt, read_session_file)
+
+BLOCK_SIZE = 512  # SESSION_BLOCK_SIZE in lib/Telemetry/src/vo2_session_block.h
+
+
+def session_block(block_type: int, seq: int, payload: bytes) -> bytes:
+    """One block as sessionBlockStart() / sessionBlockFinish() write it."""
+    body = SESSION_MAGIC + struct.pack("<BBH", SESSION_FORMAT, block_type, seq) + payload
+    body = body.ljust(BLOCK_SIZE - 2, b"\0")
+    return body + struct.pack("<H", crc16_ccitt(body))
+
+
+def info_block(pressure_offset: float) -> bytes:
+    payload = struct.pack("<BHB24sQ4fBff", 1, BLOCK_SIZE, 74, b"test", 1000000, 1.0, 75.0, 20.9, 400.0,
+                          0, 0.25, pressure_offset)
+    return session_block(SESSION_BLOCK_INFO, 0, payload)
+
+
+def gas_block(seq: int, tick: int) -> bytes:
+    return session_block(SESSION_BLOCK_GAS, seq, struct.pack("<HIHH", 1, tick, 20900, 400))
+
+
+class ReadSessionFileTest(unittest.TestCase):
+    def setUp(self) -> None:
+        fd, self.path = tempfile.mkstemp(suffix=".vo2")
+        os.close(fd)
+
+    def tearDown(self) -> None:
+        os.remove(self.path)
+
+    def write(self, blocks: list[bytes]) -> list[dict]:
+        with open(self.path, "wb") as fh:
+            fh.write(b"".join(blocks))
+        return list(read_session_file(self.path))
+
+    def test_bad_block_offsets(self) -> None:
+        blocks = [info_block(12.5), session_block(SESSION_BLOCK_BREATHS, 1, b"\0"), gas_block(2, 100),
+                  gas_block(3, 200), gas_block(4, 300)]
+        corrupt = bytearray(blocks[3])
+        corrupt[20] ^= 0xFF
+        blocks[3] = bytes(corrupt)
+        records = self.write(blocks + [blocks[4][:100]])  # and a block cut short by a power loss
+
+        self.assertEqual({"sensor_model": 0, "scale": 0.25, "offset": 12.5}, records[1]["stream_info"])
+        bad = [rec["bad_block"] for rec in records if "bad_block" in rec]
+        self.assertEqual([{"offset": 3 * BLOCK_SIZE, "reason": "crc"},
+                          {"offset": 5 * BLOCK_SIZE, "reason": "truncated"}], bad)
+        ticks = [rec["gas_sample"]["t_us"] for rec in records if "gas_sample" in rec]
+        self.assertEqual([10000, 30000], ticks)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,24 +1,37 @@
 #!/usr/bin/env python3
 """Visualize JSON-lines output produced by the device.
 
-Supports two formats:
-  1. Raw sensor output (from serial) - will aggregate per event
-  2. Already-aggregated output (from live_visualize_serial.py) - used directly
+Supports three formats:
+  1. Per-breath records ({"breath": {...}}, current firmware) - one row each
+  2. Raw sensor output (older firmware) - will aggregate per event
+  3. Already-aggregated output (from live_visualize_serial.py) - used directly
 
 Creates an interactive HTML plot (`output_plots.html`) and saves PNGs for key charts.
 
 Usage:
   python tools/visualize_output.py --input output.json
   python tools/visualize_output.py --input test_linterval.json
+  python tools/visualize_output.py --input long_raw_capture.json --stream
+  python tools/visualize_output.py --input captures --sessions s0003
 
+--stream reads the input line by line and aggregates per breath on the fly,
+writing the rows to aggregated.csv as they are complete, so memory stays flat
+for multi-hour raw captures. The format is decided by the first record that
+carries breath data rather than by looking at the whole file.
+
+A directory as --input is a Parquet dataset written by serial_file_parser.py
+--parquet; its breaths are loaded directly, optionally only some sessions.
 """
 from __future__ import annotations
 
 import argparse
+import csv
 import json
 import math
 import os
+import time
 from datetime import datetime
+from typing import Iterator
 
 import pandas as pd
 
@@ -31,6 +44,8 @@ except Exception:
 
 import matplotlib.pyplot as plt
 
+from serial_file_parser import flatten_breath, read_parquet_dataset
+
 
 def is_debug_line(line: str) -> bool:
     """Check if line is an ESP-IDF debug/log line.
@@ -42,6 +57,14 @@ def is_debug_line(line: str) -> bool:
     return s.startswith('[') and '][' in s and ']:' in s
 
 
+# raw stream records (serial_file_parser.py) that carry nothing per breath,
+# skipped by --stream without parsing them
+STREAM_SKIP_PREFIXES = (b'{"pressure_batch"', b'{"gas_sample"', b'{"stream_info"', b'{"file_chunk"',
+                        b'{"sample_timing"')
+STREAM_FLUSH_ROWS = 1000
+AGGREGATED_KEYS = {'volume.VE', 'volume.volumeExp', 'vo2.vo2Total', 'vco2.vco2Total'}
+
+
 def load_json_lines(path: str) -> list[dict]:
     records = []
     with open(path, "r", encoding="utf-8", errors="ignore") as fh:
@@ -69,9 +92,8 @@ def is_data_already_aggregated(records: list[dict]) -> bool:
     if not records:
         return False
     # Check the first few records (in case first one is a header)
-    aggregated_keys = {'volume.VE', 'volume.volumeExp', 'vo2.vo2Total', 'vco2.vco2Total'}
     for rec in records[:5]:
-        found_keys = set(rec.keys()) & aggregated_keys
+        found_keys = set(rec.keys()) & AGGREGATED_KEYS
         if len(found_keys) > 0:
             return True
     return False
@@ -86,59 +108,81 @@ def load_aggregated_data(records: list[dict]) -> pd.DataFrame:
     return df
 
 
-def aggregate_per_event(records: list[dict]) -> pd.DataFrame:
-    """Aggregate raw sensor records per "event" boundary.
-    
+def load_breath_records(records: list[dict]) -> pd.DataFrame:
+    """One row per {"breath": ...} record, no aggregation needed."""
+    rows = [row for row in (flatten_breath(rec) for rec in records) if row is not None]
+    df = pd.DataFrame(rows)
+    if "time" in df.columns:
+        df["time_dt"] = pd.to_datetime(df["time"], format="%H:%M:%S", errors="coerce")
+    return df
+
+
+def load_parquet_breaths(root: str, sessions: list[str] | None = None) -> pd.DataFrame:
+    """Breaths of a serial_file_parser.py --parquet dataset, same columns as load_breath_records()."""
+    df = read_parquet_dataset(root, "breaths", sessions=sessions)
+    if df.empty:
+        return df
+    df = df.sort_values(["session", "t_us"], kind="stable").reset_index(drop=True)
+    # HH:MM:SS since boot like format_ms(), without a Python call per row
+    secs = pd.to_timedelta((df["t_us"] // 1_000_000) % 86400, unit="s")
+    df["time_dt"] = pd.Timestamp("1900-01-01") + secs
+    df["time"] = df["time_dt"].dt.strftime("%H:%M:%S")
+    df["event"] = "EXPIRATION DONE"
+    return df
+
+
+class EventAggregator:
+    """Groups raw sensor records into one row per "event" boundary, record by record.
+
     Events are marked by {"event": "..."} records. Data between events is grouped together.
     Nested dicts (volume, vo2, vco2) are flattened to keys like "volume.VE".
     """
-    rows = []
-    current = {}
-    event_idx = 0
 
-    for rec in records:
-        if not isinstance(rec, dict):
-            continue
-            
+    def __init__(self) -> None:
+        self.current: dict = {}
+        self.event_idx = 0
+
+    def feed(self, rec: dict) -> dict | None:
+        """Add a record, returns the row it completed (if any)."""
+        done = None
         # each rec is like {"event": ...} or {"volume": {...}} etc.
         if "event" in rec:
             # finalize previous if had data
-            if current:
-                current.setdefault("event_idx", event_idx)
-                rows.append(current)
-                current = {}
-                event_idx += 1
+            if self.current:
+                self.current.setdefault("event_idx", self.event_idx)
+                done = self.current
+                self.current = {}
+                self.event_idx += 1
             # store event info
             current_event = rec.get("event")
             if rec.get("time"):
-                current["time"] = rec.get("time")
+                self.current["time"] = rec.get("time")
             if rec.get("duration"):
-                current["duration"] = rec.get("duration")
+                self.current["duration"] = rec.get("duration")
             if current_event:
-                current["event"] = current_event
+                self.current["event"] = current_event
         else:
             # merge dicts inside (volume, vo2, vco2)
             for k, v in rec.items():
                 if isinstance(v, dict):
                     # flatten
                     for fk, fv in v.items():
-                        current[f"{k}.{fk}"] = fv
+                        self.current[f"{k}.{fk}"] = fv
                 else:
-                    current[k] = v
+                    self.current[k] = v
+        return done
 
-    # append last
-    if current:
-        current.setdefault("event_idx", event_idx)
-        rows.append(current)
+    def finish(self) -> dict | None:
+        if not self.current:
+            return None
+        self.current.setdefault("event_idx", self.event_idx)
+        done, self.current = self.current, {}
+        return done
 
-    if not rows:
-        # Return empty dataframe with expected columns if no data
-        return pd.DataFrame()
 
-    # normalize times to datetime if present
-    df = pd.json_normalize(rows)
+def parse_event_times(df: pd.DataFrame) -> pd.DataFrame:
+    """Add time_dt from the HH:MM:SS (or MM:SS) time column."""
     if "time" in df.columns:
-        # assume format HH:MM:SS or MM:SS
         def to_dt(t):
             try:
                 return datetime.strptime(t, "%H:%M:%S")
@@ -148,13 +192,145 @@ def aggregate_per_event(records: list[dict]) -> pd.DataFrame:
                 except Exception:
                     return pd.NaT
 
-        df["time_dt"] = df["time"].apply(lambda x: to_dt(x) if pd.notna(x) else pd.NaT)
+        df["time_dt"] = df["time"].apply(lambda x: to_dt(x) if isinstance(x, str) else pd.NaT)
     else:
         df["time_dt"] = pd.NaT
-
     return df
 
 
+def aggregate_per_event(records: list[dict]) -> pd.DataFrame:
+    """Aggregate raw sensor records per "event" boundary, see EventAggregator."""
+    rows = []
+    agg = EventAggregator()
+    for rec in records:
+        if not isinstance(rec, dict):
+            continue
+        row = agg.feed(rec)
+        if row is not None:
+            rows.append(row)
+    row = agg.finish()
+    if row is not None:
+        rows.append(row)
+
+    if not rows:
+        # Return empty dataframe with expected columns if no data
+        return pd.DataFrame()
+
+    # normalize times to datetime if present
+    return parse_event_times(pd.json_normalize(rows))
+
+
+def iter_json_lines(path: str, stats: dict) -> Iterator[dict]:
+    """Like load_json_lines(), one record at a time; counts lines and bytes in stats."""
+    with open(path, "rb") as fh:
+        for line in fh:
+            stats["lines"] += 1
+            stats["bytes"] += len(line)
+            s = line.strip()
+            if not s or s.startswith(STREAM_SKIP_PREFIXES):
+                continue
+            text = s.decode("utf-8", errors="ignore")
+            if is_debug_line(text):
+                continue
+            try:
+                rec = json.loads(text)
+            except Exception:
+                continue
+            if isinstance(rec, dict):
+                yield rec
+
+
+def stream_rows(records: Iterator[dict]) -> Iterator[dict]:
+    """One row per breath, per aggregated record or per event, whichever comes first in the input."""
+    mode = None
+    events = EventAggregator()
+    for rec in records:
+        if mode is None:
+            if "breath" in rec:
+                mode = "breath"
+            elif set(rec.keys()) & AGGREGATED_KEYS:
+                mode = "aggregated"
+            elif "event" in rec or any(k in rec for k in ("volume", "vo2", "vco2")):
+                mode = "events"
+            else:
+                continue
+            print(f"Streaming {mode} records")
+        if mode == "breath":
+            row = flatten_breath(rec)
+        elif mode == "aggregated":
+            row = pd.json_normalize(rec).iloc[0].to_dict() if any(isinstance(v, dict) for v in rec.values()) else rec
+        else:
+            row = events.feed(rec)
+        if row is not None:
+            yield row
+    if mode == "events":
+        row = events.finish()
+        if row is not None:
+            yield row
+
+
+def rewrite_csv_header(path: str, fields: list[str]) -> None:
+    """Rewrite the CSV at path with the header fields, the rows written so far get empty new columns."""
+    tmp = path + ".tmp"
+    with open(path, newline="", encoding="utf-8") as src, open(tmp, "w", newline="", encoding="utf-8") as dst:
+        writer = csv.DictWriter(dst, fieldnames=fields)
+        writer.writeheader()
+        writer.writerows(csv.DictReader(src))
+    os.replace(tmp, path)
+
+
+def stream_to_csv(path: str, out_csv: str) -> int:
+    """Aggregate path into out_csv without holding the input in memory, returns the row count.
+
+    The header holds every column seen so far. A column that first shows up
+    later (a sensor that starts reporting late) rewrites the file once with
+    the wider header, so no values are lost.
+    """
+    stats = {"lines": 0, "bytes": 0}
+    start = time.perf_counter()
+    rows = 0
+    pending: list[dict] = []
+    fields: list[str] = []
+    fh = open(out_csv, "w", newline="", encoding="utf-8")
+    writer = None
+    rewrites = 0
+    try:
+        def flush():
+            nonlocal fh, writer, rewrites
+            if not pending:
+                return
+            new = [k for k in dict.fromkeys(k for row in pending for k in row) if k not in fields]
+            if new:
+                fields.extend(new)
+                if writer is not None:
+                    fh.close()
+                    rewrite_csv_header(out_csv, fields)
+                    fh = open(out_csv, "a", newline="", encoding="utf-8")
+                    rewrites += 1
+                writer = csv.DictWriter(fh, fieldnames=fields)
+                if rewrites == 0:
+                    writer.writeheader()
+            writer.writerows(pending)
+            pending.clear()
+            fh.flush()
+
+        for row in stream_rows(iter_json_lines(path, stats)):
+            pending.append(row)
+            rows += 1
+            if len(pending) >= STREAM_FLUSH_ROWS:
+                flush()
+        flush()
+    finally:
+        fh.close()
+
+    elapsed = max(time.perf_counter() - start, 1e-9)
+    print(f"Streamed {stats['lines']} lines ({stats['bytes'] / 1e6:.1f} MB) into {rows} rows in {elapsed:.1f} s: "
+          f"{stats['lines'] / elapsed:.0f} lines/s, {rows / elapsed:.0f} rows/s")
+    if rewrites:
+        print(f"New columns appeared after the first rows, the header was rewritten {rewrites} time(s)")
+    return rows
+
+
 def plot_with_plotly(df: pd.DataFrame, out_html: str):
     if px is None:
         print("plotly not installed; skipping interactive plots")
@@ -252,28 +428,50 @@ def main(argv: list[str] | None = None) -> int:
     parser.add_argument("--input", "-i", default="output.json", help="Path to JSON-lines file")
     parser.add_argument("--out-html", default="output_plots.html", help="Interactive HTML output file")
     parser.add_argument("--out-dir", default="output_plots", help="Directory to save PNGs")
+    parser.add_argument("--stream", action="store_true",
+                        help="Constant memory: aggregate while reading, plot from the written aggregated.csv")
+    parser.add_argument("--sessions", nargs="+", help="With a Parquet dataset as input: only these sessions")
     args = parser.parse_args(argv)
 
     if not os.path.exists(args.input):
         print(f"Input file not found: {args.input}")
         return 2
 
-    records = load_json_lines(args.input)
-    if not records:
-        print("No valid JSON records found in input file")
+    if args.stream:
+        os.makedirs(args.out_dir, exist_ok=True)
+        out_csv = os.path.join(args.out_dir, "aggregated.csv")
+        if stream_to_csv(args.input, out_csv) == 0:
+            print("No data to visualize")
+            return 0
+        # one row per breath, small next to the input
+        df = parse_event_times(pd.read_csv(out_csv))
+        plot_with_matplotlib(df, args.out_dir)
+        plot_with_plotly(df, args.out_html)
         return 0
 
+    if os.path.isdir(args.input):
+        df = load_parquet_breaths(args.input, args.sessions)
+        print(f"Loaded {len(df)} breaths from the Parquet dataset")
+    else:
+        records = load_json_lines(args.input)
+        if not records:
+            print("No valid JSON records found in input file")
+            return 0
+
+        # Detect the record format
+        if any(isinstance(rec, dict) and "breath" in rec for rec in records):
+            print("Data contains per-breath records; using them directly")
+            df = load_breath_records(records)
+        elif is_data_already_aggregated(records):
+            print("Data appears to be already aggregated; using directly")
+            df = load_aggregated_data(records)
+        else:
+            print("Data appears to be raw sensor output; aggregating per event")
+            df = aggregate_per_event(records)
+
     # Create output directory
     os.makedirs(args.out_dir, exist_ok=True)
 
-    # Detect if data is already aggregated
-    if is_data_already_aggregated(records):
-        print("Data appears to be already aggregated; using directly")
-        df = load_aggregated_data(records)
-    else:
-        print("Data appears to be raw sensor output; aggregating per event")
-        df = aggregate_per_event(records)
-
     if df.empty:
         print("No data to visualize")
         return 0